@@ -0,0 +1,1671 @@
+/*
+                   Colour conversion service
+
+    Every program here links its own copy of the colour code and
+    recomputes from scratch.  This runs the conversions as a
+    daemon on a Unix domain socket instead, for any number of
+    local client processes.
+
+    Protocol: binary, host byte order, requests pipelined (a client
+    may send many before reading any response; responses on one
+    connection come back in request order).  A request is a
+    struct req_header followed by COUNT items of float input:
+
+        OP_CCT_TO_RGB          1 float, temperature in K
+        OP_WAVELENGTH_TO_RGB   1 float, wavelength in nm
+        OP_SPD_TO_XYZ          81 floats, emittance 380..780 nm
+                               every 5 nm
+        OP_RGB_TO_RGB          3 floats, linear R, G, B in system
+                               FROM, converted to system TO
+
+    FROM (and TO) index the built-in colour systems: 0 NTSC, 1 EBU,
+    2 SMPTE, 3 HDTV, 4 CIE, 5 CIE REC 709.  The response is a
+    struct resp_header and COUNT x 3 floats.  The first two give
+    R, G, B, constrained and normalised as the programs do.
+    SPD_TO_XYZ gives chromaticities x, y, z as spectrum_to_xyz()
+    does.  RGB_TO_RGB gives linear R, G, B, not constrained, and
+    does no chromatic adaptation between white points.
+
+    Batching: each event loop thread reads everything that is
+    ready, then waits up to a short window (50 us by default) for
+    more before converting.  Everything collected is grouped by
+    operation and colour system, gathered into one contiguous
+    batch per group, converted by one loop, and scattered back to
+    the responses.  CCT results also go through an LRU cache
+    shared by all threads, split into shards with their own locks
+    so the threads rarely contend.
+
+    Build:  g++ -O2 -pthread colour_daemon.c -o colour_daemon
+
+    Usage:  colour_daemon serve SOCKET [threads [window_us]]
+            colour_daemon load SOCKET [connections [depth [seconds]]]
+            colour_daemon test
+
+    load is the load generator.  Each connection keeps DEPTH
+    requests in flight, in a mix of single CCTs, wavelength and
+    RGB batches and spectra.  It reports throughput and latency
+    percentiles.  test starts a server in-process, checks that it
+    survives misbehaving clients, checks its answers against the
+    original double precision code and runs the load generator
+    against it.
+
+    The colour code is copied from color_temp.c (John Walker,
+    public domain; see that file for the full credits); bbTemp is
+    thread local here so the event loops can convert temperatures
+    at the same time.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A colour system is defined by the CIE x and y coordinates of
+   its three primary illuminants and the x and y coordinates of
+   the white point. */
+
+struct colourSystem {
+  char *name;         /* Colour system name */
+  double xRed, yRed,  /* Red x, y */
+      xGreen, yGreen, /* Green x, y */
+      xBlue, yBlue,   /* Blue x, y */
+      xWhite, yWhite, /* White point x, y */
+      gamma;          /* Gamma correction for system */
+};
+
+/* White point chromaticities. */
+
+#define IlluminantC 0.3101, 0.3162         /* For NTSC television */
+#define IlluminantD65 0.3127, 0.3291       /* For EBU and SMPTE */
+#define IlluminantE 0.33333333, 0.33333333 /* CIE equal-energy illuminant */
+
+/*  Gamma of nonlinear correction.
+
+    See Charles Poynton's ColorFAQ Item 45 and GammaFAQ Item 6 at:
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+
+*/
+
+#define GAMMA_REC709 0 /* Rec. 709 */
+
+static struct colourSystem
+    /* Name                  xRed    yRed    xGreen  yGreen  xBlue  yBlue White
+       point        Gamma   */
+    NTSCsystem = {"NTSC", 0.67, 0.33,        0.21,        0.71,
+                  0.14,   0.08, IlluminantC, GAMMA_REC709},
+    EBUsystem = {"EBU (PAL/SECAM)", 0.64,        0.33, 0.29, 0.60, 0.15, 0.06,
+                 IlluminantD65,     GAMMA_REC709},
+    SMPTEsystem = {"SMPTE", 0.630, 0.340,         0.310,       0.595,
+                   0.155,   0.070, IlluminantD65, GAMMA_REC709},
+    HDTVsystem = {"HDTV", 0.670, 0.330,         0.210,       0.710,
+                  0.150,  0.060, IlluminantD65, GAMMA_REC709},
+    CIEsystem = {"CIE",  0.7355, 0.2645,      0.2658,      0.7243,
+                 0.1669, 0.0085, IlluminantE, GAMMA_REC709},
+    Rec709system = {"CIE REC 709", 0.64, 0.33,          0.30,        0.60,
+                    0.15,          0.06, IlluminantD65, GAMMA_REC709};
+
+/*                             XYZ_TO_RGB
+
+    Given an additive tricolour system CS, defined by the CIE x
+    and y chromaticities of its three primaries (z is derived
+    trivially as 1-(x+y)), and a desired chromaticity (XC, YC,
+    ZC) in CIE space, determine the contribution of each
+    primary in a linear combination which sums to the desired
+    chromaticity.  If the  requested chromaticity falls outside
+    the Maxwell  triangle (colour gamut) formed by the three
+    primaries, one of the r, g, or b weights will be negative.
+
+    Caller can use constrain_rgb() to desaturate an
+    outside-gamut colour to the closest representation within
+    the available gamut and/or norm_rgb to normalise the RGB
+    components so the largest nonzero component has value 1.
+
+*/
+
+void xyz_to_rgb(struct colourSystem *cs, double xc, double yc, double zc,
+                double *r, double *g, double *b) {
+  double xr, yr, zr, xg, yg, zg, xb, yb, zb;
+  double xw, yw, zw;
+  double rx, ry, rz, gx, gy, gz, bx, by, bz;
+  double rw, gw, bw;
+
+  xr = cs->xRed;
+  yr = cs->yRed;
+  zr = 1 - (xr + yr);
+  xg = cs->xGreen;
+  yg = cs->yGreen;
+  zg = 1 - (xg + yg);
+  xb = cs->xBlue;
+  yb = cs->yBlue;
+  zb = 1 - (xb + yb);
+
+  xw = cs->xWhite;
+  yw = cs->yWhite;
+  zw = 1 - (xw + yw);
+
+  /* xyz -> rgb matrix, before scaling to white. */
+
+  rx = (yg * zb) - (yb * zg);
+  ry = (xb * zg) - (xg * zb);
+  rz = (xg * yb) - (xb * yg);
+  gx = (yb * zr) - (yr * zb);
+  gy = (xr * zb) - (xb * zr);
+  gz = (xb * yr) - (xr * yb);
+  bx = (yr * zg) - (yg * zr);
+  by = (xg * zr) - (xr * zg);
+  bz = (xr * yg) - (xg * yr);
+
+  /* White scaling factors.
+     Dividing by yw scales the white luminance to unity, as conventional. */
+
+  rw = ((rx * xw) + (ry * yw) + (rz * zw)) / yw;
+  gw = ((gx * xw) + (gy * yw) + (gz * zw)) / yw;
+  bw = ((bx * xw) + (by * yw) + (bz * zw)) / yw;
+
+  /* xyz -> rgb matrix, correctly scaled to white. */
+
+  rx = rx / rw;
+  ry = ry / rw;
+  rz = rz / rw;
+  gx = gx / gw;
+  gy = gy / gw;
+  gz = gz / gw;
+  bx = bx / bw;
+  by = by / bw;
+  bz = bz / bw;
+
+  /* rgb of the desired point */
+
+  *r = (rx * xc) + (ry * yc) + (rz * zc);
+  *g = (gx * xc) + (gy * yc) + (gz * zc);
+  *b = (bx * xc) + (by * yc) + (bz * zc);
+}
+
+/*                          CONSTRAIN_RGB
+
+    If the requested RGB shade contains a negative weight for
+    one of the primaries, it lies outside the colour gamut
+    accessible from the given triple of primaries.  Desaturate
+    it by adding white, equal quantities of R, G, and B, enough
+    to make RGB all positive.  The function returns 1 if the
+    components were modified, zero otherwise.
+
+*/
+
+int constrain_rgb(double *r, double *g, double *b) {
+  double w;
+
+  /* Amount of white needed is w = - min(0, *r, *g, *b) */
+
+  w = (0 < *r) ? 0 : *r;
+  w = (w < *g) ? w : *g;
+  w = (w < *b) ? w : *b;
+  w = -w;
+
+  /* Add just enough white to make r, g, b all positive. */
+
+  if (w > 0) {
+    *r += w;
+    *g += w;
+    *b += w;
+    return 1; /* Colour modified to fit RGB gamut */
+  }
+
+  return 0; /* Colour within RGB gamut */
+}
+
+/*                          NORM_RGB
+
+    Normalise RGB components so the most intense (unless all
+    are zero) has a value of 1.
+
+*/
+
+void norm_rgb(double *r, double *g, double *b) {
+#define Max(a, b) (((a) > (b)) ? (a) : (b))
+  double greatest = Max(*r, Max(*g, *b));
+
+  if (greatest > 0) {
+    *r /= greatest;
+    *g /= greatest;
+    *b /= greatest;
+  }
+#undef Max
+}
+
+/* CIE colour matching functions xBar, yBar, and zBar for
+   wavelengths from 380 through 780 nanometers, every 5
+   nanometers.  For a wavelength lambda in this range:
+
+        cie_colour_match[(lambda - 380) / 5][0] = xBar
+        cie_colour_match[(lambda - 380) / 5][1] = yBar
+        cie_colour_match[(lambda - 380) / 5][2] = zBar
+
+    To save memory, this table can be declared as floats
+    rather than doubles; (IEEE) float has enough
+    significant bits to represent the values. It's declared
+    as a double here to avoid warnings about "conversion
+    between floating-point types" from certain persnickety
+    compilers. */
+
+static double cie_colour_match[81][3] = {
+    {0.0014, 0.0000, 0.0065}, {0.0022, 0.0001, 0.0105},
+    {0.0042, 0.0001, 0.0201}, {0.0076, 0.0002, 0.0362},
+    {0.0143, 0.0004, 0.0679}, {0.0232, 0.0006, 0.1102},
+    {0.0435, 0.0012, 0.2074}, {0.0776, 0.0022, 0.3713},
+    {0.1344, 0.0040, 0.6456}, {0.2148, 0.0073, 1.0391},
+    {0.2839, 0.0116, 1.3856}, {0.3285, 0.0168, 1.6230},
+    {0.3483, 0.0230, 1.7471}, {0.3481, 0.0298, 1.7826},
+    {0.3362, 0.0380, 1.7721}, {0.3187, 0.0480, 1.7441},
+    {0.2908, 0.0600, 1.6692}, {0.2511, 0.0739, 1.5281},
+    {0.1954, 0.0910, 1.2876}, {0.1421, 0.1126, 1.0419},
+    {0.0956, 0.1390, 0.8130}, {0.0580, 0.1693, 0.6162},
+    {0.0320, 0.2080, 0.4652}, {0.0147, 0.2586, 0.3533},
+    {0.0049, 0.3230, 0.2720}, {0.0024, 0.4073, 0.2123},
+    {0.0093, 0.5030, 0.1582}, {0.0291, 0.6082, 0.1117},
+    {0.0633, 0.7100, 0.0782}, {0.1096, 0.7932, 0.0573},
+    {0.1655, 0.8620, 0.0422}, {0.2257, 0.9149, 0.0298},
+    {0.2904, 0.9540, 0.0203}, {0.3597, 0.9803, 0.0134},
+    {0.4334, 0.9950, 0.0087}, {0.5121, 1.0000, 0.0057},
+    {0.5945, 0.9950, 0.0039}, {0.6784, 0.9786, 0.0027},
+    {0.7621, 0.9520, 0.0021}, {0.8425, 0.9154, 0.0018},
+    {0.9163, 0.8700, 0.0017}, {0.9786, 0.8163, 0.0014},
+    {1.0263, 0.7570, 0.0011}, {1.0567, 0.6949, 0.0010},
+    {1.0622, 0.6310, 0.0008}, {1.0456, 0.5668, 0.0006},
+    {1.0026, 0.5030, 0.0003}, {0.9384, 0.4412, 0.0002},
+    {0.8544, 0.3810, 0.0002}, {0.7514, 0.3210, 0.0001},
+    {0.6424, 0.2650, 0.0000}, {0.5419, 0.2170, 0.0000},
+    {0.4479, 0.1750, 0.0000}, {0.3608, 0.1382, 0.0000},
+    {0.2835, 0.1070, 0.0000}, {0.2187, 0.0816, 0.0000},
+    {0.1649, 0.0610, 0.0000}, {0.1212, 0.0446, 0.0000},
+    {0.0874, 0.0320, 0.0000}, {0.0636, 0.0232, 0.0000},
+    {0.0468, 0.0170, 0.0000}, {0.0329, 0.0119, 0.0000},
+    {0.0227, 0.0082, 0.0000}, {0.0158, 0.0057, 0.0000},
+    {0.0114, 0.0041, 0.0000}, {0.0081, 0.0029, 0.0000},
+    {0.0058, 0.0021, 0.0000}, {0.0041, 0.0015, 0.0000},
+    {0.0029, 0.0010, 0.0000}, {0.0020, 0.0007, 0.0000},
+    {0.0014, 0.0005, 0.0000}, {0.0010, 0.0004, 0.0000},
+    {0.0007, 0.0002, 0.0000}, {0.0005, 0.0002, 0.0000},
+    {0.0003, 0.0001, 0.0000}, {0.0002, 0.0001, 0.0000},
+    {0.0002, 0.0001, 0.0000}, {0.0001, 0.0000, 0.0000},
+    {0.0001, 0.0000, 0.0000}, {0.0001, 0.0000, 0.0000},
+    {0.0000, 0.0000, 0.0000}};
+
+/*                          SPECTRUM_TO_XYZ
+
+    Calculate the CIE X, Y, and Z coordinates corresponding to
+    a light source with spectral distribution given by  the
+    function SPEC_INTENS, which is called with a series of
+    wavelengths between 380 and 780 nm (the argument is
+    expressed in meters), which returns emittance at  that
+    wavelength in arbitrary units.  The chromaticity
+    coordinates of the spectrum are returned in the x, y, and z
+    arguments which respect the identity:
+
+            x + y + z = 1.
+*/
+
+void spectrum_to_xyz(double (*spec_intens)(double wavelength), double *x,
+                     double *y, double *z) {
+  int i;
+  double lambda, X = 0, Y = 0, Z = 0, XYZ;
+
+  for (i = 0, lambda = 380; lambda < 780.1; i++, lambda += 5) {
+    double Me;
+
+    Me = (*spec_intens)(lambda);
+    X += Me * cie_colour_match[i][0];
+    Y += Me * cie_colour_match[i][1];
+    Z += Me * cie_colour_match[i][2];
+  }
+  XYZ = (X + Y + Z);
+  *x = X / XYZ;
+  *y = Y / XYZ;
+  *z = Z / XYZ;
+}
+
+/*                            BB_SPECTRUM
+
+    Calculate, by Planck's radiation law, the emittance of a black body
+    of temperature bbTemp at the given wavelength (in metres).  */
+
+__thread double bbTemp = 5000; /* Hidden temperature argument
+                                  to BB_SPECTRUM. */
+double bb_spectrum(double wavelength) {
+  double wlm = wavelength * 1e-9; /* Wavelength in meters */
+
+  return (3.74183e-16 * pow(wlm, -5.0)) /
+         (exp(1.4388e-2 / (wlm * bbTemp)) - 1.0);
+}
+double white(double wavelength) { return 1; }
+
+/*                          RGB_TO_XYZ_MATRIX
+
+    The inverse of what xyz_to_rgb() does: the matrix taking linear
+    R, G, B of colour system CS to X, Y, Z, scaled so that
+    R = G = B = 1 is the white point with Y = 1.
+
+*/
+
+void rgb_to_xyz_matrix(struct colourSystem *cs, double m[3][3]) {
+  double p[3][3] = {
+      {cs->xRed, cs->xGreen, cs->xBlue},
+      {cs->yRed, cs->yGreen, cs->yBlue},
+      {1 - cs->xRed - cs->yRed, 1 - cs->xGreen - cs->yGreen,
+       1 - cs->xBlue - cs->yBlue}};
+  double w[3] = {cs->xWhite / cs->yWhite, 1,
+                 (1 - cs->xWhite - cs->yWhite) / cs->yWhite};
+  double inv[3][3], det, s[3];
+
+  /* Cofactor inverse of the primaries' chromaticities. */
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      int i1 = (j + 1) % 3, i2 = (j + 2) % 3, j1 = (i + 1) % 3,
+          j2 = (i + 2) % 3;
+      inv[i][j] = p[i1][j1] * p[i2][j2] - p[i1][j2] * p[i2][j1];
+    }
+  }
+  det = p[0][0] * inv[0][0] + p[0][1] * inv[1][0] + p[0][2] * inv[2][0];
+
+  /* Primary intensities that add up to the white point. */
+  for (int i = 0; i < 3; i++) {
+    s[i] = (inv[i][0] * w[0] + inv[i][1] * w[1] + inv[i][2] * w[2]) / det;
+  }
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      m[i][j] = p[i][j] * s[j];
+    }
+  }
+}
+
+/*                          XYZ_TO_RGB_MATRIX
+
+    The matrix xyz_to_rgb() applies for colour system CS, scaled so
+    the white point at Y = 1 maps to R = G = B = 1; the inverse of
+    rgb_to_xyz_matrix().
+
+*/
+
+void xyz_to_rgb_matrix(struct colourSystem *cs, double m[3][3]) {
+  /* xyz_to_rgb() is linear in x, y, z and already scales each row
+     so the white maps to R = G = B = 1; its columns are the matrix. */
+  for (int k = 0; k < 3; k++) {
+    double e[3] = {0, 0, 0}, r[3];
+
+    e[k] = 1;
+    xyz_to_rgb(cs, e[0], e[1], e[2], &r[0], &r[1], &r[2]);
+    for (int i = 0; i < 3; i++) {
+      m[i][k] = r[i];
+    }
+  }
+}
+
+/*                          CONVERSIONS
+
+    Batch kernels, one contiguous array in and one out, three floats
+    out per item.
+
+*/
+
+#define NSYSTEMS 6
+#define SPD_SAMPLES 81
+
+static struct colourSystem *systems[NSYSTEMS] = {
+    &NTSCsystem, &EBUsystem,  &SMPTEsystem,
+    &HDTVsystem, &CIEsystem, &Rec709system};
+
+static float rgb_rgb[NSYSTEMS][NSYSTEMS][3][3]; /* [from][to] */
+static float cmf[SPD_SAMPLES][3];
+
+static void init_conversions() {
+  for (int f = 0; f < NSYSTEMS; f++) {
+    for (int t = 0; t < NSYSTEMS; t++) {
+      double a[3][3], b[3][3];
+
+      rgb_to_xyz_matrix(systems[f], a);
+      xyz_to_rgb_matrix(systems[t], b);
+      for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+          rgb_rgb[f][t][i][j] =
+              b[i][0] * a[0][j] + b[i][1] * a[1][j] + b[i][2] * a[2][j];
+        }
+      }
+    }
+  }
+  for (int i = 0; i < SPD_SAMPLES; i++) {
+    for (int k = 0; k < 3; k++) {
+      cmf[i][k] = cie_colour_match[i][k];
+    }
+  }
+}
+
+static void finish_rgb(struct colourSystem *cs, double x, double y, double z,
+                       float *out) {
+  double r, g, b;
+
+  xyz_to_rgb(cs, x, y, z, &r, &g, &b);
+  constrain_rgb(&r, &g, &b);
+  norm_rgb(&r, &g, &b);
+  out[0] = r;
+  out[1] = g;
+  out[2] = b;
+}
+
+static void cct_to_rgb_batch(int sys, const float *temp, int n, float *out) {
+  for (int i = 0; i < n; i++) {
+    double x, y, z;
+
+    bbTemp = temp[i];
+    spectrum_to_xyz(bb_spectrum, &x, &y, &z);
+    finish_rgb(systems[sys], x, y, z, &out[3 * i]);
+  }
+}
+
+static void wavelength_to_rgb_batch(int sys, const float *lambda, int n,
+                                    float *out) {
+  for (int i = 0; i < n; i++) {
+    float p = (lambda[i] - 380) / 5;
+    int k;
+    float f, xyz[3], sum;
+
+    /* Written so NaN lands on 380 nm: the input comes off the wire. */
+    p = !(p >= 0) ? 0 : p > 80 ? 80 : p;
+    k = p >= 80 ? 79 : (int)p;
+    f = p - k;
+    for (int c = 0; c < 3; c++) {
+      xyz[c] = cmf[k][c] + (cmf[k + 1][c] - cmf[k][c]) * f;
+    }
+    sum = xyz[0] + xyz[1] + xyz[2];
+    if (sum > 0) {
+      finish_rgb(systems[sys], xyz[0] / sum, xyz[1] / sum, xyz[2] / sum,
+                 &out[3 * i]);
+    } else {
+      out[3 * i] = out[3 * i + 1] = out[3 * i + 2] = 0;
+    }
+  }
+}
+
+static void spd_to_xyz_batch(const float *__restrict spd, int n,
+                             float *__restrict out) {
+  for (int i = 0; i < n; i++) {
+    const float *s = &spd[SPD_SAMPLES * i];
+    float X = 0, Y = 0, Z = 0, sum;
+
+    for (int k = 0; k < SPD_SAMPLES; k++) {
+      X += s[k] * cmf[k][0];
+      Y += s[k] * cmf[k][1];
+      Z += s[k] * cmf[k][2];
+    }
+    sum = X + Y + Z;
+    sum = sum != 0 ? sum : 1;
+    out[3 * i] = X / sum;
+    out[3 * i + 1] = Y / sum;
+    out[3 * i + 2] = Z / sum;
+  }
+}
+
+static void rgb_to_rgb_batch(int from, int to, const float *__restrict in,
+                             int n, float *__restrict out) {
+  float m[3][3];
+
+  memcpy(m, rgb_rgb[from][to], sizeof m);
+  for (int i = 0; i < n; i++) {
+    float r = in[3 * i], g = in[3 * i + 1], b = in[3 * i + 2];
+
+    for (int k = 0; k < 3; k++) {
+      out[3 * i + k] = m[k][0] * r + m[k][1] * g + m[k][2] * b;
+    }
+  }
+}
+
+/*                            CCT CACHE
+
+    An LRU map from (colour system, temperature) to R, G, B, split
+    into shards by key hash, each with its own lock, hash chains
+    and recency list over a fixed pool of entries.
+
+*/
+
+#define CACHE_SHARDS 16
+#define SHARD_ENTRIES 4096 /* A power of two */
+
+struct cache_entry {
+  uint64_t key;
+  float rgb[3];
+  int next_hash;          /* Chain, -1 ends */
+  int prev_lru, next_lru; /* Recency list, most recent at head */
+};
+
+struct cache_shard {
+  pthread_mutex_t lock;
+  int head, tail, used;
+  int bucket[SHARD_ENTRIES];
+  struct cache_entry e[SHARD_ENTRIES];
+  long hits, misses;
+} __attribute__((aligned(64)));
+
+static struct cache_shard cache[CACHE_SHARDS];
+
+static uint64_t cache_key(int sys, float temp) {
+  uint32_t bits;
+
+  memcpy(&bits, &temp, sizeof bits);
+  return (uint64_t)sys << 32 | bits;
+}
+
+static uint64_t key_hash(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  return k;
+}
+
+static void cache_init() {
+  for (int s = 0; s < CACHE_SHARDS; s++) {
+    struct cache_shard *c = &cache[s];
+
+    pthread_mutex_init(&c->lock, NULL);
+    c->head = c->tail = -1;
+    c->used = 0;
+    for (int i = 0; i < SHARD_ENTRIES; i++) {
+      c->bucket[i] = -1;
+    }
+  }
+}
+
+static void lru_unlink(struct cache_shard *c, int i) {
+  struct cache_entry *e = &c->e[i];
+
+  if (e->prev_lru >= 0) {
+    c->e[e->prev_lru].next_lru = e->next_lru;
+  } else {
+    c->head = e->next_lru;
+  }
+  if (e->next_lru >= 0) {
+    c->e[e->next_lru].prev_lru = e->prev_lru;
+  } else {
+    c->tail = e->prev_lru;
+  }
+}
+
+static void lru_push_front(struct cache_shard *c, int i) {
+  c->e[i].prev_lru = -1;
+  c->e[i].next_lru = c->head;
+  if (c->head >= 0) {
+    c->e[c->head].prev_lru = i;
+  }
+  c->head = i;
+  if (c->tail < 0) {
+    c->tail = i;
+  }
+}
+
+static int cache_get(uint64_t key, float *rgb) {
+  uint64_t h = key_hash(key);
+  struct cache_shard *c = &cache[h % CACHE_SHARDS];
+  int found = 0;
+
+  pthread_mutex_lock(&c->lock);
+  for (int i = c->bucket[(h >> 8) & (SHARD_ENTRIES - 1)]; i >= 0;
+       i = c->e[i].next_hash) {
+    if (c->e[i].key == key) {
+      memcpy(rgb, c->e[i].rgb, sizeof c->e[i].rgb);
+      lru_unlink(c, i);
+      lru_push_front(c, i);
+      found = 1;
+      break;
+    }
+  }
+  found ? c->hits++ : c->misses++;
+  pthread_mutex_unlock(&c->lock);
+  return found;
+}
+
+static void cache_put(uint64_t key, const float *rgb) {
+  uint64_t h = key_hash(key);
+  struct cache_shard *c = &cache[h % CACHE_SHARDS];
+  int b = (h >> 8) & (SHARD_ENTRIES - 1), i;
+
+  pthread_mutex_lock(&c->lock);
+  for (i = c->bucket[b]; i >= 0; i = c->e[i].next_hash) {
+    if (c->e[i].key == key) {
+      break; /* Another thread got there first */
+    }
+  }
+  if (i < 0) {
+    if (c->used < SHARD_ENTRIES) {
+      i = c->used++;
+    } else {
+      /* Evict the least recently used, taking it off its chain. */
+      int *p;
+
+      i = c->tail;
+      lru_unlink(c, i);
+      p = &c->bucket[(key_hash(c->e[i].key) >> 8) & (SHARD_ENTRIES - 1)];
+      while (*p != i) {
+        p = &c->e[*p].next_hash;
+      }
+      *p = c->e[i].next_hash;
+    }
+    c->e[i].key = key;
+    memcpy(c->e[i].rgb, rgb, sizeof c->e[i].rgb);
+    c->e[i].next_hash = c->bucket[b];
+    c->bucket[b] = i;
+    lru_push_front(c, i);
+  }
+  pthread_mutex_unlock(&c->lock);
+}
+
+/* CCT batch through the cache: hits are copied, misses converted
+   together and added. */
+
+static void cct_cached_batch(int sys, const float *temp, int n, float *out) {
+  int *miss = (int *)malloc(n * sizeof(int));
+  float *mt = (float *)malloc(n * sizeof(float));
+  float *mo = (float *)malloc(3 * n * sizeof(float));
+  int nmiss = 0;
+
+  for (int i = 0; i < n; i++) {
+    if (!cache_get(cache_key(sys, temp[i]), &out[3 * i])) {
+      miss[nmiss] = i;
+      mt[nmiss++] = temp[i];
+    }
+  }
+  cct_to_rgb_batch(sys, mt, nmiss, mo);
+  for (int j = 0; j < nmiss; j++) {
+    memcpy(&out[3 * miss[j]], &mo[3 * j], 3 * sizeof(float));
+    cache_put(cache_key(sys, mt[j]), &mo[3 * j]);
+  }
+  free(miss);
+  free(mt);
+  free(mo);
+}
+
+/*                            PROTOCOL                              */
+
+enum op { OP_CCT_TO_RGB, OP_WAVELENGTH_TO_RGB, OP_SPD_TO_XYZ, OP_RGB_TO_RGB };
+
+enum status { STATUS_OK, STATUS_BAD_OP, STATUS_BAD_SYSTEM };
+
+struct req_header {
+  uint32_t id;    /* Echoed in the response */
+  uint8_t op;     /* enum op */
+  uint8_t from;   /* Colour system, not used by OP_SPD_TO_XYZ */
+  uint8_t to;     /* Target colour system, OP_RGB_TO_RGB only */
+  uint8_t pad;
+  uint32_t count; /* Items */
+};
+
+struct resp_header {
+  uint32_t id;
+  uint32_t status; /* enum status; no payload unless STATUS_OK */
+  uint32_t count;
+};
+
+#define MAX_COUNT 65536 /* Items per request; more closes the connection */
+
+static int op_in_floats(int op) {
+  return op == OP_SPD_TO_XYZ ? SPD_SAMPLES : op == OP_RGB_TO_RGB ? 3 : 1;
+}
+
+/*                            SERVER
+
+    Parsed requests wait in the loop's pending list with their
+    response space already reserved in the connection's output
+    buffer, so responses stay in order whatever batch they are
+    converted in.  Input stays in place in the connection's input
+    buffer until the batch is done.
+
+    A loop stops reading a connection once a full batch is pending,
+    and stops watching it for input while more than OUT_BACKLOG bytes
+    of its responses are unsent; it is watched again when the client
+    has read enough.  A client that sends without reading then fills
+    its own socket buffer instead of the server's memory.
+
+*/
+
+struct conn {
+  int fd;
+  int dead;
+  char *in, *out;
+  size_t in_len, in_cap, in_used; /* in_used: bytes parsed */
+  size_t out_len, out_cap, out_sent;
+  size_t out_ready; /* Responses converted and ready to send */
+  uint32_t events;  /* Registered with epoll */
+  int closing; /* On the loop's list to close */
+  struct conn *next_dead;
+};
+
+struct pending {
+  struct conn *c;
+  int op, from, to, count;
+  size_t in_off, out_off; /* Payload positions in c->in, c->out */
+};
+
+struct loop {
+  int epfd, timerfd, listenfd;
+  long window_ns;
+  struct pending *pend;
+  int npend, pend_cap;
+  long pend_items;
+  struct conn **touched; /* Connections with parsed input */
+  int ntouched, touched_cap;
+  int timer_armed;
+  long requests, batches;
+};
+
+static void *grow(void *p, size_t *cap, size_t need, size_t size) {
+  if (need > *cap) {
+    *cap = need > 2 * *cap ? need : 2 * *cap;
+    p = realloc(p, *cap * size);
+  }
+  return p;
+}
+
+#define BATCH_ITEMS 65536     /* Convert at once when this much waits */
+#define OUT_BACKLOG (1 << 20) /* Unsent response bytes that stop reading */
+
+static int conn_backlogged(const struct conn *c) {
+  return c->out_len - c->out_sent > OUT_BACKLOG;
+}
+
+/* Watch C for input unless it is backlogged, and for output while
+   it has responses ready to send. */
+
+static void conn_watch(struct loop *l, struct conn *c) {
+  uint32_t want = 0;
+
+  if (!conn_backlogged(c)) {
+    want |= EPOLLIN;
+  }
+  if (c->out_sent < c->out_ready && !c->dead) {
+    want |= EPOLLOUT;
+  }
+  if (want != c->events) {
+    struct epoll_event ev;
+
+    ev.events = want;
+    ev.data.ptr = c;
+    epoll_ctl(l->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = want;
+  }
+}
+
+static void conn_flush(struct loop *l, struct conn *c) {
+  while (c->out_sent < c->out_ready) {
+    /* MSG_NOSIGNAL: a client gone without reading must not raise
+       SIGPIPE and take the whole server down. */
+    ssize_t n = send(c->fd, c->out + c->out_sent, c->out_ready - c->out_sent,
+                     MSG_NOSIGNAL);
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN) {
+        c->dead = 1;
+      }
+      break;
+    }
+    c->out_sent += n;
+  }
+  if (c->out_sent == c->out_len) {
+    c->out_sent = c->out_ready = c->out_len = 0;
+  } else if (c->in_used == 0 && c->out_sent >= OUT_BACKLOG) {
+    /* Nothing pending holds an offset into the buffer, so a client
+       that never quite catches up cannot make it grow forever. */
+    memmove(c->out, c->out + c->out_sent, c->out_len - c->out_sent);
+    c->out_len -= c->out_sent;
+    c->out_ready -= c->out_sent;
+    c->out_sent = 0;
+  }
+  conn_watch(l, c);
+}
+
+/* Reserve a response and return its payload offset. */
+
+static size_t reserve_response(struct conn *c, uint32_t id, uint32_t status,
+                               uint32_t count) {
+  struct resp_header h = {id, status, status == STATUS_OK ? count : 0};
+  size_t payload = status == STATUS_OK ? (size_t)count * 3 * sizeof(float) : 0;
+  size_t need = c->out_len + sizeof h + payload, off;
+
+  c->out = (char *)grow(c->out, &c->out_cap, need, 1);
+  memcpy(c->out + c->out_len, &h, sizeof h);
+  off = c->out_len + sizeof h;
+  c->out_len = need;
+  return off;
+}
+
+/* Parse every complete request in C's input. */
+
+static void conn_parse(struct loop *l, struct conn *c) {
+  size_t pos = c->in_used;
+
+  while (c->in_len - pos >= sizeof(struct req_header)) {
+    struct req_header h;
+    size_t payload;
+    int status = STATUS_OK;
+
+    memcpy(&h, c->in + pos, sizeof h);
+    if (h.count > MAX_COUNT) {
+      /* Requests already parsed still go through the batch, so the
+         bookkeeping below must run before the connection can close. */
+      c->dead = 1;
+      break;
+    }
+    payload = (size_t)h.count * op_in_floats(h.op) * sizeof(float);
+    if (c->in_len - pos - sizeof h < payload) {
+      break;
+    }
+
+    /* Clients may leave the fields an operation does not use set to
+       anything; zero them so they do not split batch groups. */
+    if (h.op == OP_SPD_TO_XYZ) {
+      h.from = 0;
+    }
+    if (h.op != OP_RGB_TO_RGB) {
+      h.to = 0;
+    }
+    if (h.op > OP_RGB_TO_RGB) {
+      status = STATUS_BAD_OP;
+    } else if (h.from >= NSYSTEMS || h.to >= NSYSTEMS) {
+      status = STATUS_BAD_SYSTEM;
+    }
+
+    size_t out_off = reserve_response(c, h.id, status, h.count);
+
+    if (status == STATUS_OK && h.count > 0) {
+      struct pending *p;
+      size_t cap = l->pend_cap;
+
+      l->pend = (struct pending *)grow(l->pend, &cap, l->npend + 1,
+                                       sizeof(struct pending));
+      l->pend_cap = cap;
+      p = &l->pend[l->npend++];
+      p->c = c;
+      p->op = h.op;
+      p->from = h.from;
+      p->to = h.to;
+      p->count = h.count;
+      p->in_off = pos + sizeof h;
+      p->out_off = out_off;
+      l->pend_items += h.count;
+    }
+    l->requests++;
+    pos += sizeof h + payload;
+  }
+
+  if (pos != c->in_used) {
+    size_t cap = l->touched_cap;
+
+    if (c->in_used == 0) {
+      l->touched = (struct conn **)grow(l->touched, &cap, l->ntouched + 1,
+                                        sizeof(struct conn *));
+      l->touched_cap = cap;
+      l->touched[l->ntouched++] = c;
+    }
+    c->in_used = pos;
+  }
+}
+
+static int pending_order(const void *a, const void *b) {
+  const struct pending *p = (const struct pending *)a,
+                       *q = (const struct pending *)b;
+  int ka = (p->op * NSYSTEMS + p->from) * NSYSTEMS + p->to,
+      kb = (q->op * NSYSTEMS + q->from) * NSYSTEMS + q->to;
+
+  return ka - kb;
+}
+
+/* Convert everything pending: group, gather, convert, scatter. */
+
+static void loop_run_batch(struct loop *l) {
+  float *in = NULL, *out = NULL;
+  size_t in_cap = 0, out_cap = 0;
+
+  /* A stable order within a group is not needed: every request has
+     its own response slot. */
+  qsort(l->pend, l->npend, sizeof(struct pending), pending_order);
+
+  for (int a = 0, b; a < l->npend; a = b) {
+    struct pending *p = &l->pend[a];
+    int per = op_in_floats(p->op);
+    long items = 0, k = 0;
+
+    for (b = a; b < l->npend && pending_order(&l->pend[b], p) == 0; b++) {
+      items += l->pend[b].count;
+    }
+    in = (float *)grow(in, &in_cap, items * per, sizeof(float));
+    out = (float *)grow(out, &out_cap, items * 3, sizeof(float));
+    for (int i = a; i < b; i++) {
+      struct pending *q = &l->pend[i];
+
+      memcpy(in + k * per, q->c->in + q->in_off,
+             (size_t)q->count * per * sizeof(float));
+      k += q->count;
+    }
+
+    switch (p->op) {
+    case OP_CCT_TO_RGB:
+      cct_cached_batch(p->from, in, items, out);
+      break;
+    case OP_WAVELENGTH_TO_RGB:
+      wavelength_to_rgb_batch(p->from, in, items, out);
+      break;
+    case OP_SPD_TO_XYZ:
+      spd_to_xyz_batch(in, items, out);
+      break;
+    case OP_RGB_TO_RGB:
+      rgb_to_rgb_batch(p->from, p->to, in, items, out);
+      break;
+    }
+
+    k = 0;
+    for (int i = a; i < b; i++) {
+      struct pending *q = &l->pend[i];
+
+      memcpy(q->c->out + q->out_off, out + 3 * k,
+             (size_t)q->count * 3 * sizeof(float));
+      k += q->count;
+    }
+  }
+  free(in);
+  free(out);
+  l->batches++;
+  l->npend = 0;
+  l->pend_items = 0;
+
+  /* Drop the parsed input and send the responses. */
+  for (int i = 0; i < l->ntouched; i++) {
+    struct conn *c = l->touched[i];
+
+    memmove(c->in, c->in + c->in_used, c->in_len - c->in_used);
+    c->in_len -= c->in_used;
+    c->in_used = 0;
+    c->out_ready = c->out_len;
+    conn_flush(l, c);
+  }
+  l->ntouched = 0;
+}
+
+static void conn_close(struct loop *l, struct conn *c) {
+  epoll_ctl(l->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  free(c->in);
+  free(c->out);
+  free(c);
+}
+
+/* Read and parse until the socket is empty, a full batch is pending
+   or C has too many responses unsent; in the first case epoll wakes
+   the loop again after the batch, in the last conn_flush() does. */
+
+static void conn_read(struct loop *l, struct conn *c) {
+  while (!c->dead && l->pend_items < BATCH_ITEMS && !conn_backlogged(c)) {
+    ssize_t n;
+
+    c->in = (char *)grow(c->in, &c->in_cap, c->in_len + 65536, 1);
+    n = read(c->fd, c->in + c->in_len, c->in_cap - c->in_len);
+    if (n > 0) {
+      c->in_len += n;
+      conn_parse(l, c);
+    } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+      c->dead = 1;
+    } else if (errno == EAGAIN) {
+      break;
+    }
+  }
+  conn_watch(l, c);
+}
+
+static void arm_timer(struct loop *l) {
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof its);
+  its.it_value.tv_sec = l->window_ns / 1000000000;
+  its.it_value.tv_nsec = l->window_ns % 1000000000;
+  timerfd_settime(l->timerfd, 0, &its, NULL);
+  l->timer_armed = 1;
+}
+
+static void *loop_main(void *arg) {
+  struct loop *l = (struct loop *)arg;
+  struct epoll_event ev[64];
+  struct conn *dead = NULL;
+
+  while (1) {
+    int n = epoll_wait(l->epfd, ev, 64, -1);
+
+    for (int i = 0; i < n; i++) {
+      if (ev[i].data.ptr == NULL) {
+        /* Listening socket; EPOLLEXCLUSIVE wakes one loop. */
+        int fd = accept4(l->listenfd, NULL, NULL, SOCK_NONBLOCK);
+        struct conn *c;
+        struct epoll_event e;
+
+        if (fd < 0) {
+          continue;
+        }
+        c = (struct conn *)calloc(1, sizeof *c);
+        c->fd = fd;
+        c->events = e.events = EPOLLIN;
+        e.data.ptr = c;
+        epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &e);
+      } else if (ev[i].data.ptr == &l->timerfd) {
+        uint64_t expirations;
+
+        if (read(l->timerfd, &expirations, sizeof expirations) !=
+            sizeof expirations) {
+          continue; /* Re-armed since the expiry was queued */
+        }
+        l->timer_armed = 0;
+        if (l->npend > 0 || l->ntouched > 0) {
+          loop_run_batch(l);
+        }
+      } else {
+        struct conn *c = (struct conn *)ev[i].data.ptr;
+
+        if (ev[i].events & (EPOLLHUP | EPOLLERR)) {
+          /* Reported even while input is not watched; nobody is
+             left to read the responses. */
+          c->dead = 1;
+        }
+        if (ev[i].events & EPOLLOUT) {
+          conn_flush(l, c);
+        }
+        if (ev[i].events & EPOLLIN) {
+          conn_read(l, c);
+        }
+        if (c->dead && !c->closing) {
+          c->closing = 1;
+          c->next_dead = dead;
+          dead = c;
+        }
+      }
+    }
+
+    if (l->pend_items >= BATCH_ITEMS || (l->window_ns == 0 && l->ntouched) ||
+        (dead && l->ntouched)) {
+      loop_run_batch(l);
+    } else if (l->ntouched > 0 && !l->timer_armed) {
+      arm_timer(l);
+    }
+
+    /* Connections close only once nothing pending refers to them. */
+    if (l->ntouched == 0) {
+      while (dead) {
+        struct conn *next = dead->next_dead;
+
+        conn_close(l, dead);
+        dead = next;
+      }
+    }
+  }
+  return NULL;
+}
+
+static int listen_unix(const char *path) {
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof addr.sun_path - 1);
+  unlink(path);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof addr) < 0 ||
+      listen(fd, 128) < 0) {
+    return -1;
+  }
+  return fd;
+}
+
+static struct loop *loops;
+static int nloops;
+
+/* Start NTHREADS event loops on PATH; returns 0 on failure. */
+
+int serve_start(const char *path, int nthreads, long window_ns) {
+  int listenfd = listen_unix(path);
+
+  if (listenfd < 0) {
+    return 0;
+  }
+  init_conversions();
+  cache_init();
+  nloops = nthreads;
+  loops = (struct loop *)calloc(nthreads, sizeof(struct loop));
+  for (int i = 0; i < nthreads; i++) {
+    struct loop *l = &loops[i];
+    struct epoll_event e;
+    pthread_t t;
+
+    l->epfd = epoll_create1(0);
+    l->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    l->listenfd = listenfd;
+    l->window_ns = window_ns;
+    e.events = EPOLLIN | EPOLLEXCLUSIVE;
+    e.data.ptr = NULL;
+    epoll_ctl(l->epfd, EPOLL_CTL_ADD, listenfd, &e);
+    e.events = EPOLLIN;
+    e.data.ptr = &l->timerfd;
+    epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->timerfd, &e);
+    pthread_create(&t, NULL, loop_main, l);
+    pthread_detach(t);
+  }
+  return 1;
+}
+
+/*                          LOAD GENERATOR
+
+    One thread per connection with blocking I/O.  It keeps DEPTH
+    requests in flight, sending a new one each time a response
+    comes back.  Latency is from send to complete response.
+
+*/
+
+struct client_stats {
+  long requests, items;
+  long hist[40]; /* Latency in microseconds, log2 buckets */
+  int errors;
+};
+
+struct client {
+  const char *path;
+  int depth;
+  double seconds;
+  unsigned rng;
+  struct client_stats st;
+};
+
+static double now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int connect_unix(const char *path) {
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof addr.sun_path - 1);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+    return -1;
+  }
+  return fd;
+}
+
+static int write_all(int fd, const void *buf, size_t n) {
+  for (size_t done = 0; done < n;) {
+    ssize_t k = send(fd, (const char *)buf + done, n - done, MSG_NOSIGNAL);
+
+    if (k < 0 && errno != EINTR) {
+      return 0;
+    }
+    done += k > 0 ? k : 0;
+  }
+  return 1;
+}
+
+static int read_all(int fd, void *buf, size_t n) {
+  for (size_t done = 0; done < n;) {
+    ssize_t k = read(fd, (char *)buf + done, n - done);
+
+    if (k == 0 || (k < 0 && errno != EINTR)) {
+      return 0;
+    }
+    done += k > 0 ? k : 0;
+  }
+  return 1;
+}
+
+/* Build a request from the mix: 50% one CCT (from 1000 distinct
+   values, so mostly cache hits), 20% 64 wavelengths, 20% 64 RGB
+   pixels, 10% 4 spectra. */
+
+static size_t make_request(unsigned *rng, uint32_t id, char *buf) {
+  struct req_header h;
+  float *p = (float *)(buf + sizeof h);
+  int r;
+
+  *rng = *rng * 1103515245 + 12345;
+  r = (*rng >> 16) % 100;
+  h.id = id;
+  h.from = (*rng >> 8) % NSYSTEMS;
+  h.to = (*rng >> 12) % NSYSTEMS;
+  h.pad = 0;
+  if (r < 50) {
+    h.op = OP_CCT_TO_RGB;
+    h.count = 1;
+    p[0] = 1000 + 10 * ((*rng >> 4) % 1000);
+  } else if (r < 70) {
+    h.op = OP_WAVELENGTH_TO_RGB;
+    h.count = 64;
+    for (int i = 0; i < 64; i++) {
+      p[i] = 380 + 6.25f * i;
+    }
+  } else if (r < 90) {
+    h.op = OP_RGB_TO_RGB;
+    h.count = 64;
+    for (int i = 0; i < 3 * 64; i++) {
+      p[i] = (i * 37 % 101) / 100.0f;
+    }
+  } else {
+    h.op = OP_SPD_TO_XYZ;
+    h.count = 4;
+    for (int i = 0; i < 4 * SPD_SAMPLES; i++) {
+      p[i] = 1 + (i % SPD_SAMPLES) * 0.01f * (i / SPD_SAMPLES);
+    }
+  }
+  memcpy(buf, &h, sizeof h);
+  return sizeof h + (size_t)h.count * op_in_floats(h.op) * sizeof(float);
+}
+
+static void *client_main(void *arg) {
+  struct client *cl = (struct client *)arg;
+  int fd = connect_unix(cl->path);
+  double *sent = (double *)malloc(cl->depth * sizeof(double));
+  char *req = (char *)malloc(sizeof(struct req_header) +
+                             4 * SPD_SAMPLES * sizeof(float));
+  float payload[3 * 64];
+  double end = now_ns() + cl->seconds * 1e9;
+  uint32_t next = 0;
+  long inflight = 0;
+
+  if (fd < 0) {
+    cl->st.errors++;
+    return NULL;
+  }
+
+  /* Request id modulo depth is its slot in SENT. */
+  while (inflight < cl->depth) {
+    size_t n = make_request(&cl->rng, next, req);
+
+    sent[next % cl->depth] = now_ns();
+    write_all(fd, req, n);
+    next++;
+    inflight++;
+  }
+
+  while (inflight > 0) {
+    struct resp_header h;
+    double lat;
+    int b = 0;
+
+    if (!read_all(fd, &h, sizeof h) ||
+        !read_all(fd, payload, (size_t)h.count * 3 * sizeof(float))) {
+      cl->st.errors++;
+      break;
+    }
+    lat = (now_ns() - sent[h.id % cl->depth]) / 1e3;
+    while (b < 39 && lat >= 2.0 * (1L << b)) {
+      b++;
+    }
+    cl->st.hist[b]++;
+    cl->st.requests++;
+    cl->st.items += h.count;
+    cl->st.errors += h.status != STATUS_OK;
+    inflight--;
+
+    if (now_ns() < end) {
+      size_t n = make_request(&cl->rng, next, req);
+
+      sent[next % cl->depth] = now_ns();
+      write_all(fd, req, n);
+      next++;
+      inflight++;
+    }
+  }
+
+  close(fd);
+  free(sent);
+  free(req);
+  return NULL;
+}
+
+/* Upper edge of the bucket holding the Q'th fraction of requests. */
+
+static double hist_quantile(const long *hist, long total, double q) {
+  long seen = 0;
+
+  for (int b = 0; b < 40; b++) {
+    seen += hist[b];
+    if (seen >= q * total) {
+      return 2.0 * (1L << b);
+    }
+  }
+  return 2.0 * (1L << 40);
+}
+
+int run_load(const char *path, int nconn, int depth, double seconds) {
+  struct client *cl = (struct client *)calloc(nconn, sizeof(struct client));
+  pthread_t *t = (pthread_t *)malloc(nconn * sizeof(pthread_t));
+  struct client_stats all;
+  double t0 = now_ns();
+
+  memset(&all, 0, sizeof all);
+  for (int i = 0; i < nconn; i++) {
+    cl[i].path = path;
+    cl[i].depth = depth;
+    cl[i].seconds = seconds;
+    cl[i].rng = 2 * i + 1;
+    pthread_create(&t[i], NULL, client_main, &cl[i]);
+  }
+  for (int i = 0; i < nconn; i++) {
+    pthread_join(t[i], NULL);
+    all.requests += cl[i].st.requests;
+    all.items += cl[i].st.items;
+    all.errors += cl[i].st.errors;
+    for (int b = 0; b < 40; b++) {
+      all.hist[b] += cl[i].st.hist[b];
+    }
+  }
+  t0 = (now_ns() - t0) / 1e9;
+
+  printf("%d connections x %d in flight: %ld requests (%ld items) in %.2f s,"
+         " %.0f req/s, %.0f items/s\n",
+         nconn, depth, all.requests, all.items, t0, all.requests / t0,
+         all.items / t0);
+  printf("latency: p50 < %.0f us, p99 < %.0f us, p99.9 < %.0f us; %d errors\n",
+         hist_quantile(all.hist, all.requests, 0.5),
+         hist_quantile(all.hist, all.requests, 0.99),
+         hist_quantile(all.hist, all.requests, 0.999), all.errors);
+  free(cl);
+  free(t);
+  return all.errors == 0;
+}
+
+/*                          BUILT-IN TEST                           */
+
+static int send_request(int fd, uint32_t id, int op, int from, int to,
+                        const float *items, uint32_t count) {
+  struct req_header h = {id, (uint8_t)op, (uint8_t)from, (uint8_t)to, 0,
+                         count};
+  size_t n = (size_t)count * op_in_floats(op) * sizeof(float);
+  char *buf = (char *)malloc(sizeof h + n);
+  int ok;
+
+  memcpy(buf, &h, sizeof h);
+  memcpy(buf + sizeof h, items, n);
+  ok = write_all(fd, buf, sizeof h + n);
+  free(buf);
+  return ok;
+}
+
+/* Read the response to request ID, of at most MAX items, into OUT. */
+
+static int read_response(int fd, uint32_t id, float *out, uint32_t max) {
+  struct resp_header r;
+
+  return read_all(fd, &r, sizeof r) && r.id == id &&
+         r.status == STATUS_OK && r.count <= max &&
+         read_all(fd, out, r.count * 3 * sizeof(float));
+}
+
+static int close_to(const float *got, const double *want, int n, double tol) {
+  int ok = 1;
+
+  for (int i = 0; i < n; i++) {
+    ok &= fabs(got[i] - want[i]) < tol;
+  }
+  return ok;
+}
+
+/* One request of each kind, pipelined, checked against the original
+   double precision code rather than the server's own kernels; then
+   RGB to RGB within one system, which must give the input back, and
+   there and back between two systems. */
+
+static int check_answers(const char *path) {
+  static const float temps[3] = {1500, 6500, 9000}, lambdas[2] = {450, 610};
+  static const float rgb[3] = {0.2f, 0.5f, 0.8f};
+  float spd[SPD_SAMPLES], got[9], back[3];
+  double want[9], m[3][3], xyz[3];
+  int fd = connect_unix(path), ok = 1;
+
+  if (fd < 0) {
+    return 0;
+  }
+  for (int i = 0; i < SPD_SAMPLES; i++) {
+    spd[i] = 1;
+  }
+
+  ok &= send_request(fd, 0, OP_CCT_TO_RGB, 2, 0, temps, 3);
+  ok &= send_request(fd, 1, OP_WAVELENGTH_TO_RGB, 3, 0, lambdas, 2);
+  ok &= send_request(fd, 2, OP_SPD_TO_XYZ, 0, 0, spd, 1);
+  ok &= send_request(fd, 3, OP_RGB_TO_RGB, 2, 0, rgb, 1);
+  ok &= send_request(fd, 4, OP_RGB_TO_RGB, 4, 4, rgb, 1);
+
+  ok &= read_response(fd, 0, got, 3);
+  for (int i = 0; i < 3; i++) {
+    double x, y, z, *c = &want[3 * i];
+
+    bbTemp = temps[i];
+    spectrum_to_xyz(bb_spectrum, &x, &y, &z);
+    xyz_to_rgb(&SMPTEsystem, x, y, z, &c[0], &c[1], &c[2]);
+    constrain_rgb(&c[0], &c[1], &c[2]);
+    norm_rgb(&c[0], &c[1], &c[2]);
+  }
+  ok &= close_to(got, want, 9, 1e-5);
+
+  /* On the 5 nm grid, so straight from the table. */
+  ok &= read_response(fd, 1, got, 2);
+  for (int i = 0; i < 2; i++) {
+    const double *m = cie_colour_match[(int)(lambdas[i] - 380) / 5];
+    double sum = m[0] + m[1] + m[2], *c = &want[3 * i];
+
+    xyz_to_rgb(&HDTVsystem, m[0] / sum, m[1] / sum, m[2] / sum, &c[0], &c[1],
+               &c[2]);
+    constrain_rgb(&c[0], &c[1], &c[2]);
+    norm_rgb(&c[0], &c[1], &c[2]);
+  }
+  ok &= close_to(got, want, 6, 1e-5);
+
+  ok &= read_response(fd, 2, got, 1);
+  want[0] = want[1] = want[2] = 0;
+  for (int i = 0; i < SPD_SAMPLES; i++) {
+    for (int k = 0; k < 3; k++) {
+      want[k] += cie_colour_match[i][k];
+    }
+  }
+  want[3] = want[0] + want[1] + want[2];
+  for (int k = 0; k < 3; k++) {
+    want[k] /= want[3];
+  }
+  ok &= close_to(got, want, 3, 1e-5);
+
+  /* SMPTE to X, Y, Z by its matrix, then xyz_to_rgb() into NTSC. */
+  ok &= read_response(fd, 3, got, 1);
+  rgb_to_xyz_matrix(&SMPTEsystem, m);
+  for (int k = 0; k < 3; k++) {
+    xyz[k] = m[k][0] * rgb[0] + m[k][1] * rgb[1] + m[k][2] * rgb[2];
+  }
+  xyz_to_rgb(&NTSCsystem, xyz[0], xyz[1], xyz[2], &want[0], &want[1],
+             &want[2]);
+  ok &= close_to(got, want, 3, 1e-5);
+
+  for (int k = 0; k < 3; k++) {
+    want[k] = rgb[k];
+  }
+  ok &= read_response(fd, 4, got, 1);
+  ok &= close_to(got, want, 3, 1e-6);
+
+  ok &= send_request(fd, 5, OP_RGB_TO_RGB, 1, 5, rgb, 1);
+  ok &= read_response(fd, 5, got, 1);
+  ok &= send_request(fd, 6, OP_RGB_TO_RGB, 5, 1, got, 1);
+  ok &= read_response(fd, 6, back, 1);
+  ok &= close_to(back, want, 3, 1e-5);
+
+  close(fd);
+  return ok;
+}
+
+/* Inputs from misbehaving clients must not take the server down:
+   a NaN wavelength, a header over MAX_COUNT after a good request in
+   the same write, a client that pipelines requests and closes
+   without reading the responses, and one that stays connected and
+   keeps sending without reading: the server must stop reading it,
+   so its sends block, and must still answer others meanwhile.  The
+   server must still answer a fresh connection after each. */
+
+static int check_bad_clients(const char *path) {
+  static const float lambdas[3] = {NAN, 500, INFINITY};
+  static float items[3 * 4096];
+  float got[9], t = 6500;
+  int ok = 1, fd, hog;
+
+  fd = connect_unix(path);
+  ok &= fd >= 0 && send_request(fd, 0, OP_WAVELENGTH_TO_RGB, 0, 0, lambdas, 3);
+  ok &= fd >= 0 && read_response(fd, 0, got, 3);
+  close(fd);
+
+  fd = connect_unix(path);
+  if (fd >= 0) {
+    char buf[sizeof(struct req_header) * 2 + sizeof(float)];
+    struct req_header h = {0, OP_CCT_TO_RGB, 0, 0, 0, 1};
+
+    memcpy(buf, &h, sizeof h);
+    memcpy(buf + sizeof h, &t, sizeof t);
+    h.id = 1;
+    h.count = 1000000;
+    memcpy(buf + sizeof h + sizeof t, &h, sizeof h);
+    ok &= write_all(fd, buf, sizeof buf);
+    close(fd);
+  }
+
+  fd = connect_unix(path);
+  /* Less than OUT_BACKLOG of responses, or the writes would block. */
+  for (int i = 0; fd >= 0 && i < 16; i++) {
+    if (!send_request(fd, i, OP_RGB_TO_RGB, 0, 1, items, 4096)) {
+      break;
+    }
+  }
+  close(fd);
+
+  hog = connect_unix(path);
+  if (hog >= 0) {
+    struct req_header h = {0, OP_RGB_TO_RGB, 0, 1, 0, 4096};
+    size_t len = sizeof h + sizeof items, pos = 0;
+    char *req = (char *)malloc(len);
+    double give_up = now_ns() + 5e9;
+    int blocked = 0;
+
+    memcpy(req, &h, sizeof h);
+    memcpy(req + sizeof h, items, sizeof items);
+    while (!blocked && now_ns() < give_up) {
+      ssize_t n = send(hog, req + pos, len - pos, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+      if (n > 0) {
+        pos = (pos + n) % len;
+      } else if (n < 0 && errno == EAGAIN) {
+        /* Still full after a pause: the server has stopped reading. */
+        struct timespec pause = {0, 100000000};
+
+        nanosleep(&pause, NULL);
+        n = send(hog, req + pos, len - pos, MSG_DONTWAIT | MSG_NOSIGNAL);
+        blocked = n < 0 && errno == EAGAIN;
+        if (n > 0) {
+          pos = (pos + n) % len;
+        }
+      } else if (n < 0 && errno != EINTR) {
+        break;
+      }
+    }
+    free(req);
+    ok &= blocked;
+
+    fd = connect_unix(path);
+    ok &= fd >= 0 && send_request(fd, 6, OP_CCT_TO_RGB, 0, 0, &t, 1);
+    ok &= fd >= 0 && read_response(fd, 6, got, 1);
+    close(fd);
+    close(hog);
+  } else {
+    ok = 0;
+  }
+
+  fd = connect_unix(path);
+  ok &= fd >= 0 && send_request(fd, 7, OP_CCT_TO_RGB, 0, 0, &t, 1);
+  ok &= fd >= 0 && read_response(fd, 7, got, 1);
+  close(fd);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  if (argc >= 3 && strcmp(argv[1], "serve") == 0) {
+    int threads = argc > 3 ? atoi(argv[3]) : 2;
+    long window = argc > 4 ? atol(argv[4]) : 50;
+
+    if (threads < 1 || threads > 256 || window < 0 || window > 1000000) {
+      fprintf(stderr, "threads must be 1..256 and window_us 0..1000000\n");
+      return 2;
+    }
+    window *= 1000;
+    if (!serve_start(argv[2], threads, window)) {
+      perror(argv[2]);
+      return 1;
+    }
+    pause();
+  } else if (argc >= 3 && strcmp(argv[1], "load") == 0) {
+    int nconn = argc > 3 ? atoi(argv[3]) : 4;
+    int depth = argc > 4 ? atoi(argv[4]) : 16;
+
+    if (nconn < 1 || depth < 1) {
+      fprintf(stderr, "connections and depth must be at least 1\n");
+      return 2;
+    }
+    return !run_load(argv[2], nconn, depth, argc > 5 ? atof(argv[5]) : 3);
+  } else if (argc == 2 && strcmp(argv[1], "test") == 0) {
+    char path[64];
+    int ok;
+
+    snprintf(path, sizeof path, "/tmp/colour_daemon.%d", (int)getpid());
+    if (!serve_start(path, 2, 50000)) {
+      perror(path);
+      return 1;
+    }
+    ok = check_bad_clients(path);
+    printf("bad clients %s\n", ok ? "survived" : "NOT HANDLED");
+    ok &= check_answers(path);
+    printf("answers %s\n", ok ? "match direct computation" : "WRONG");
+    ok &= run_load(path, 4, 16, 2);
+
+    long hits = 0, misses = 0, requests = 0, batches = 0;
+
+    for (int s = 0; s < CACHE_SHARDS; s++) {
+      pthread_mutex_lock(&cache[s].lock);
+      hits += cache[s].hits;
+      misses += cache[s].misses;
+      pthread_mutex_unlock(&cache[s].lock);
+    }
+    for (int i = 0; i < nloops; i++) {
+      requests += __atomic_load_n(&loops[i].requests, __ATOMIC_RELAXED);
+      batches += __atomic_load_n(&loops[i].batches, __ATOMIC_RELAXED);
+    }
+    printf("server: %.1f requests per batch, CCT cache hit rate %.1f%%\n",
+           (double)requests / (batches ? batches : 1),
+           100.0 * hits / (hits + misses ? hits + misses : 1));
+    unlink(path);
+    return !ok;
+  } else {
+    fprintf(stderr, "Usage: colour_daemon serve SOCKET [threads [window_us]]\n"
+                    "       colour_daemon load SOCKET [connections [depth "
+                    "[seconds]]]\n"
+                    "       colour_daemon test\n");
+    return 2;
+  }
+  return 0;
+}
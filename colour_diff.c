@@ -0,0 +1,688 @@
+/*
+              Batch colour difference for calibration QA
+
+    Compares two buffers of colours, fixture measurements against
+    reference values, and reports how far apart they are in one of
+    three metrics:
+
+        uv      distance in the CIE 1976 u', v' chromaticity plane,
+                as from xy_to_upvp()
+        de76    CIELAB Delta E*ab (1976), Euclidean in L*a*b*
+        de2000  CIEDE2000, Sharma, Wu and Dalal's formulation
+
+    The colours are X, Y, Z with the white at Y = 1, or linear R, G,
+    B in a colourSystem; L*a*b* is taken relative to that system's
+    white point.  The max, mean and any percentile come out of the
+    same pass: each block of differences goes straight into running
+    sums and a log-spaced histogram (128 bins per octave, so a
+    percentile is good to under 1%), and nothing is stored per
+    colour.
+
+    The batch kernels work in float on blocks of 1024 pairs and
+    vectorize: the cube root, atan2 and exp they need are done
+    with polynomial and bit tricks instead of libm.  CIEDE2000
+    also avoids most of its trigonometry.  Delta H' comes from
+    dot and cross products of a*b* vectors.  The mean hue comes
+    from the bisector of the two hue directions, and the cos terms
+    of T come from the sine and cosine of that one angle.  Plain
+    double libm versions of all three metrics are kept as the
+    reference.
+
+    Build:  g++ -O3 -march=native -fno-math-errno colour_diff.c -o colour_diff
+
+    The built-in test checks the reference and batch CIEDE2000
+    against pairs from Sharma et al.'s test data, measures the
+    batch kernels' error against the reference on random colours,
+    and times 4 million pairs per metric.
+
+    The colour code is copied from color_temp.c (John Walker,
+    public domain; see that file for the full credits).
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* A colour system is defined by the CIE x and y coordinates of
+   its three primary illuminants and the x and y coordinates of
+   the white point. */
+
+struct colourSystem {
+  char *name;         /* Colour system name */
+  double xRed, yRed,  /* Red x, y */
+      xGreen, yGreen, /* Green x, y */
+      xBlue, yBlue,   /* Blue x, y */
+      xWhite, yWhite, /* White point x, y */
+      gamma;          /* Gamma correction for system */
+};
+
+/* White point chromaticities. */
+
+#define IlluminantC 0.3101, 0.3162         /* For NTSC television */
+#define IlluminantD65 0.3127, 0.3291       /* For EBU and SMPTE */
+#define IlluminantE 0.33333333, 0.33333333 /* CIE equal-energy illuminant */
+
+/*  Gamma of nonlinear correction.
+
+    See Charles Poynton's ColorFAQ Item 45 and GammaFAQ Item 6 at:
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+
+*/
+
+#define GAMMA_REC709 0 /* Rec. 709 */
+
+static struct colourSystem
+    /* Name                  xRed    yRed    xGreen  yGreen  xBlue  yBlue White
+       point        Gamma   */
+    NTSCsystem = {"NTSC", 0.67, 0.33,        0.21,        0.71,
+                  0.14,   0.08, IlluminantC, GAMMA_REC709},
+    EBUsystem = {"EBU (PAL/SECAM)", 0.64,        0.33, 0.29, 0.60, 0.15, 0.06,
+                 IlluminantD65,     GAMMA_REC709},
+    SMPTEsystem = {"SMPTE", 0.630, 0.340,         0.310,       0.595,
+                   0.155,   0.070, IlluminantD65, GAMMA_REC709},
+    HDTVsystem = {"HDTV", 0.670, 0.330,         0.210,       0.710,
+                  0.150,  0.060, IlluminantD65, GAMMA_REC709},
+    CIEsystem = {"CIE",  0.7355, 0.2645,      0.2658,      0.7243,
+                 0.1669, 0.0085, IlluminantE, GAMMA_REC709},
+    Rec709system = {"CIE REC 709", 0.64, 0.33,          0.30,        0.60,
+                    0.15,          0.06, IlluminantD65, GAMMA_REC709};
+
+/*                          XY_TO_UPVP
+
+    Given 1931 chromaticities x, y, determine 1976 coordinates u', v'
+
+*/
+
+void xy_to_upvp(double xc, double yc, double *up, double *vp) {
+  *up = (4 * xc) / ((-2 * xc) + (12 * yc) + 3);
+  *vp = (9 * yc) / ((-2 * xc) + (12 * yc) + 3);
+}
+
+
+/*                          RGB_TO_XYZ_MATRIX
+
+    The inverse of what xyz_to_rgb() does: the matrix taking linear
+    R, G, B of colour system CS to X, Y, Z, scaled so that
+    R = G = B = 1 is the white point with Y = 1.
+
+*/
+
+void rgb_to_xyz_matrix(struct colourSystem *cs, double m[3][3]) {
+  double p[3][3] = {
+      {cs->xRed, cs->xGreen, cs->xBlue},
+      {cs->yRed, cs->yGreen, cs->yBlue},
+      {1 - cs->xRed - cs->yRed, 1 - cs->xGreen - cs->yGreen,
+       1 - cs->xBlue - cs->yBlue}};
+  double w[3] = {cs->xWhite / cs->yWhite, 1,
+                 (1 - cs->xWhite - cs->yWhite) / cs->yWhite};
+  double inv[3][3], det, s[3];
+
+  /* Cofactor inverse of the primaries' chromaticities. */
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      int i1 = (j + 1) % 3, i2 = (j + 2) % 3, j1 = (i + 1) % 3,
+          j2 = (i + 2) % 3;
+      inv[i][j] = p[i1][j1] * p[i2][j2] - p[i1][j2] * p[i2][j1];
+    }
+  }
+  det = p[0][0] * inv[0][0] + p[0][1] * inv[1][0] + p[0][2] * inv[2][0];
+
+  /* Primary intensities that add up to the white point. */
+  for (int i = 0; i < 3; i++) {
+    s[i] = (inv[i][0] * w[0] + inv[i][1] * w[1] + inv[i][2] * w[2]) / det;
+  }
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      m[i][j] = p[i][j] * s[j];
+    }
+  }
+}
+
+/*                          REFERENCE METRICS
+
+    Straightforward double precision, one pair at a time.
+
+*/
+
+struct lab_white {
+  double Xn, Yn, Zn;     /* White, Y = 1 */
+  double upn, vpn;       /* Its u', v' */
+  float fXn, fYn, fZn;   /* The same for the float kernels */
+  float fupn, fvpn;
+  float m[3][3];         /* Linear RGB to XYZ */
+};
+
+void make_white(struct colourSystem *cs, struct lab_white *w) {
+  double m[3][3];
+
+  w->Xn = cs->xWhite / cs->yWhite;
+  w->Yn = 1;
+  w->Zn = (1 - cs->xWhite - cs->yWhite) / cs->yWhite;
+  xy_to_upvp(cs->xWhite, cs->yWhite, &w->upn, &w->vpn);
+  w->fXn = w->Xn;
+  w->fYn = w->Yn;
+  w->fZn = w->Zn;
+  w->fupn = w->upn;
+  w->fvpn = w->vpn;
+  rgb_to_xyz_matrix(cs, m);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      w->m[i][j] = m[i][j];
+    }
+  }
+}
+
+/* Black has no chromaticity; it is taken to be the white's. */
+
+double ref_delta_uv(const struct lab_white *w, const double *c1,
+                    const double *c2) {
+  double u[2], v[2];
+  const double *c[2] = {c1, c2};
+
+  for (int k = 0; k < 2; k++) {
+    double sum = c[k][0] + c[k][1] + c[k][2];
+
+    if (sum > 0) {
+      xy_to_upvp(c[k][0] / sum, c[k][1] / sum, &u[k], &v[k]);
+    } else {
+      u[k] = w->upn;
+      v[k] = w->vpn;
+    }
+  }
+  return hypot(u[1] - u[0], v[1] - v[0]);
+}
+
+static double lab_f(double t) {
+  return t > 216.0 / 24389 ? cbrt(t) : t * (24389.0 / 27 / 116) + 16.0 / 116;
+}
+
+void ref_xyz_to_lab(const struct lab_white *w, const double *xyz,
+                    double *lab) {
+  double fx = lab_f(xyz[0] / w->Xn), fy = lab_f(xyz[1] / w->Yn),
+         fz = lab_f(xyz[2] / w->Zn);
+
+  lab[0] = 116 * fy - 16;
+  lab[1] = 500 * (fx - fy);
+  lab[2] = 200 * (fy - fz);
+}
+
+double ref_de76(const double *lab1, const double *lab2) {
+  double dL = lab2[0] - lab1[0], da = lab2[1] - lab1[1],
+         db = lab2[2] - lab1[2];
+
+  return sqrt(dL * dL + da * da + db * db);
+}
+
+double ref_de2000(const double *lab1, const double *lab2) {
+  const double deg = M_PI / 180, pow25_7 = 6103515625.0;
+  double L1 = lab1[0], a1 = lab1[1], b1 = lab1[2];
+  double L2 = lab2[0], a2 = lab2[1], b2 = lab2[2];
+  double Cb = (hypot(a1, b1) + hypot(a2, b2)) / 2, Cb7 = pow(Cb, 7);
+  double G = 0.5 * (1 - sqrt(Cb7 / (Cb7 + pow25_7)));
+  double a1p = (1 + G) * a1, a2p = (1 + G) * a2;
+  double C1p = hypot(a1p, b1), C2p = hypot(a2p, b2);
+  double h1p = C1p == 0 ? 0 : atan2(b1, a1p) / deg;
+  double h2p = C2p == 0 ? 0 : atan2(b2, a2p) / deg;
+  double dhp, hbp;
+
+  h1p += h1p < 0 ? 360 : 0;
+  h2p += h2p < 0 ? 360 : 0;
+
+  if (C1p * C2p == 0) {
+    dhp = 0;
+    hbp = h1p + h2p;
+  } else {
+    dhp = h2p - h1p;
+    dhp += dhp > 180 ? -360 : dhp < -180 ? 360 : 0;
+    if (fabs(h1p - h2p) <= 180) {
+      hbp = (h1p + h2p) / 2;
+    } else {
+      hbp = (h1p + h2p + (h1p + h2p < 360 ? 360 : -360)) / 2;
+    }
+  }
+
+  double dLp = L2 - L1, dCp = C2p - C1p;
+  double dHp = 2 * sqrt(C1p * C2p) * sin(dhp / 2 * deg);
+  double Lbp = (L1 + L2) / 2, Cbp = (C1p + C2p) / 2, Cbp7 = pow(Cbp, 7);
+  double T = 1 - 0.17 * cos((hbp - 30) * deg) + 0.24 * cos(2 * hbp * deg) +
+             0.32 * cos((3 * hbp + 6) * deg) - 0.20 * cos((4 * hbp - 63) * deg);
+  double dtheta = 30 * exp(-((hbp - 275) / 25) * ((hbp - 275) / 25));
+  double RC = 2 * sqrt(Cbp7 / (Cbp7 + pow25_7));
+  double SL = 1 + 0.015 * (Lbp - 50) * (Lbp - 50) /
+                      sqrt(20 + (Lbp - 50) * (Lbp - 50));
+  double SC = 1 + 0.045 * Cbp, SH = 1 + 0.015 * Cbp * T;
+  double RT = -sin(2 * dtheta * deg) * RC;
+  double l = dLp / SL, c = dCp / SC, h = dHp / SH;
+
+  return sqrt(l * l + c * c + h * h + RT * c * h);
+}
+
+/*                        FLOAT BUILDING BLOCKS
+
+    Pure float and integer arithmetic, so loops using them
+    vectorize without a vector libm.
+
+*/
+
+/* 2^x for -87 < x <= 0, as in real_rainbow.c. */
+
+static inline __attribute__((always_inline)) float exp2_neg(float x) {
+  float r = x + 12582912.0f;
+  float f = x - (r - 12582912.0f);
+  float p =
+      1.0f +
+      f * (0.6931472f +
+           f * (0.2402265f +
+                f * (0.05550411f + f * (0.009618129f + f * 0.001333355f))));
+  int bits;
+  float scale;
+
+  memcpy(&bits, &r, sizeof bits);
+  bits = (bits - 0x4B400000 + 127) << 23;
+  memcpy(&scale, &bits, sizeof scale);
+  return p * scale;
+}
+
+/* Cube root of x > 0: a first guess from dividing the exponent by
+   three, then three Newton steps. */
+
+static inline __attribute__((always_inline)) float cbrt_pos(float x) {
+  int bits;
+  float y;
+
+  memcpy(&bits, &x, sizeof bits);
+  bits = bits / 3 + 709921077;
+  memcpy(&y, &bits, sizeof y);
+  for (int k = 0; k < 3; k++) {
+    y = (2 * y + x / (y * y)) * (1 / 3.0f);
+  }
+  return y;
+}
+
+/* atan2(y, x) in degrees, 0 <= result < 360.  Odd degree-11
+   polynomial on [0, 1], then folded into the right octant. */
+
+static inline __attribute__((always_inline)) float atan2_deg(float y,
+                                                             float x) {
+  float ax = fabsf(x), ay = fabsf(y);
+  float mx = ax > ay ? ax : ay, mn = ax > ay ? ay : ax;
+  float a = mn / (mx > 0 ? mx : 1), s = a * a;
+  float p = 0.05265332f - 0.01172120f * s;
+  float r = a * (0.99997726f +
+                 s * (-0.33262347f +
+                      s * (0.19354346f + s * (-0.11643287f + s * p))));
+
+  r *= 57.29577951f;
+  r = ay > ax ? 90 - r : r;
+  r = x < 0 ? 180 - r : r;
+  r = y < 0 ? 360 - r : r;
+  return r < 360 ? r : 0;
+}
+
+static inline __attribute__((always_inline)) float lab_f_fast(float t) {
+  return t > 216.0f / 24389 ? cbrt_pos(t)
+                            : t * (24389.0f / 27 / 116) + 16.0f / 116;
+}
+
+/*                          BATCH KERNELS
+
+    Buffers hold N colours as X, Y, Z (or R, G, B) triples; L*a*b*
+    is kept as separate L, a and b arrays within a block.
+
+*/
+
+#define BLOCK 1024
+
+static void rgb_block_to_xyz(const struct lab_white *w,
+                             const float *__restrict rgb, int n,
+                             float *__restrict xyz) {
+  for (int i = 0; i < n; i++) {
+    float r = rgb[3 * i], g = rgb[3 * i + 1], b = rgb[3 * i + 2];
+
+    for (int k = 0; k < 3; k++) {
+      xyz[3 * i + k] = w->m[k][0] * r + w->m[k][1] * g + w->m[k][2] * b;
+    }
+  }
+}
+
+static void xyz_block_to_lab(const struct lab_white *w,
+                             const float *__restrict xyz, int n,
+                             float *__restrict L, float *__restrict a,
+                             float *__restrict b) {
+  float iX = 1 / w->fXn, iY = 1 / w->fYn, iZ = 1 / w->fZn;
+
+  for (int i = 0; i < n; i++) {
+    float fx = lab_f_fast(xyz[3 * i] * iX),
+          fy = lab_f_fast(xyz[3 * i + 1] * iY),
+          fz = lab_f_fast(xyz[3 * i + 2] * iZ);
+
+    L[i] = 116 * fy - 16;
+    a[i] = 500 * (fx - fy);
+    b[i] = 200 * (fy - fz);
+  }
+}
+
+/* u' = 4X / (X + 15Y + 3Z), v' = 9Y / (X + 15Y + 3Z), which is
+   xy_to_upvp() with x and y written out in terms of X, Y, Z. */
+
+void delta_uv_batch(const struct lab_white *w, const float *__restrict c1,
+                    const float *__restrict c2, int n, float *__restrict out) {
+  float upn = w->fupn, vpn = w->fvpn;
+
+  for (int i = 0; i < n; i++) {
+    float d1 = c1[3 * i] + 15 * c1[3 * i + 1] + 3 * c1[3 * i + 2];
+    float d2 = c2[3 * i] + 15 * c2[3 * i + 1] + 3 * c2[3 * i + 2];
+    float i1 = 1 / (d1 > 0 ? d1 : 1), i2 = 1 / (d2 > 0 ? d2 : 1);
+    float u1 = d1 > 0 ? 4 * c1[3 * i] * i1 : upn;
+    float v1 = d1 > 0 ? 9 * c1[3 * i + 1] * i1 : vpn;
+    float u2 = d2 > 0 ? 4 * c2[3 * i] * i2 : upn;
+    float v2 = d2 > 0 ? 9 * c2[3 * i + 1] * i2 : vpn;
+
+    out[i] = sqrtf((u2 - u1) * (u2 - u1) + (v2 - v1) * (v2 - v1));
+  }
+}
+
+void de76_batch(const float *__restrict L1, const float *__restrict a1,
+                const float *__restrict b1, const float *__restrict L2,
+                const float *__restrict a2, const float *__restrict b2, int n,
+                float *__restrict out) {
+  for (int i = 0; i < n; i++) {
+    float dL = L2[i] - L1[i], da = a2[i] - a1[i], db = b2[i] - b1[i];
+
+    out[i] = sqrtf(dL * dL + da * da + db * db);
+  }
+}
+
+/*                          DE2000_BATCH
+
+    ref_de2000() rearranged for SIMD:
+
+      - Delta H' = 2 sqrt(C1' C2') sin(Delta h' / 2), whose square
+        is Delta a'^2 + Delta b^2 - Delta C'^2, so only its sign,
+        that of the cross product, needs a hue.  (Written as
+        2 (C1' C2' - a1' a2' - b1 b2) it would lose most of its
+        float precision to cancellation for nearby colours.)
+      - The mean hue h' bar, with all its cases for wrapping and
+        zero chroma, is the direction of the sum of the two unit
+        hue vectors (a zero vector for zero chroma).
+      - cos(h - 30), cos 2h, cos(3h + 6), cos(4h - 63) come from
+        cos h and sin h by angle addition.
+
+    That leaves one atan2, for the hue rotation term.  The sum of
+    the hue vectors vanishes only for exactly opposite hues; then
+    u1 turned by 90 degrees is used.
+
+*/
+
+void de2000_batch(const float *__restrict L1, const float *__restrict A1,
+                  const float *__restrict B1, const float *__restrict L2,
+                  const float *__restrict A2, const float *__restrict B2,
+                  int n, float *__restrict out) {
+  const float pow25_7 = 6103515625.0f, deg = 0.01745329252f;
+  const float c30 = 0.8660254f, s30 = 0.5f, c6 = 0.9945219f, s6 = 0.1045285f,
+              c63 = 0.4539905f, s63 = 0.8910065f;
+
+  for (int i = 0; i < n; i++) {
+    float a1 = A1[i], b1 = B1[i], a2 = A2[i], b2 = B2[i];
+    float Cb = (sqrtf(a1 * a1 + b1 * b1) + sqrtf(a2 * a2 + b2 * b2)) * 0.5f;
+    float Cb2 = Cb * Cb, Cb7 = Cb2 * Cb2 * Cb2 * Cb;
+    float G = 0.5f * (1 - sqrtf(Cb7 / (Cb7 + pow25_7)));
+    float a1p = (1 + G) * a1, a2p = (1 + G) * a2;
+    float C1p = sqrtf(a1p * a1p + b1 * b1), C2p = sqrtf(a2p * a2p + b2 * b2);
+
+    /* Delta H' */
+    float P = C1p * C2p, cross = a1p * b2 - b1 * a2p;
+    float da = a2p - a1p, db = b2 - b1, dC = C2p - C1p;
+    float hh = da * da + db * db - dC * dC;
+    float dHp = sqrtf(hh > 0 ? hh : 0);
+    dHp = cross < 0 ? -dHp : dHp;
+
+    /* Mean hue direction */
+    float r1 = C1p > 0 ? 1 / C1p : 0, r2 = C2p > 0 ? 1 / C2p : 0;
+    float ux = a1p * r1 + a2p * r2, uy = b1 * r1 + b2 * r2;
+    float nn = ux * ux + uy * uy;
+    int opposite = nn < 1e-12f && P > 0;
+    float ox = -b1 * r1, oy = a1p * r1;
+    ux = opposite ? ox : ux;
+    uy = opposite ? oy : uy;
+    nn = opposite ? 1 : nn;
+    float rn = nn > 0 ? 1 / sqrtf(nn) : 0;
+    float ch = nn > 0 ? ux * rn : 1, sh = uy * rn;
+    float hbp = atan2_deg(sh, ch);
+
+    float c2h = ch * ch - sh * sh, s2h = 2 * sh * ch;
+    float c3h = ch * c2h - sh * s2h, s3h = sh * c2h + ch * s2h;
+    float c4h = c2h * c2h - s2h * s2h, s4h = 2 * s2h * c2h;
+    float T = 1 - 0.17f * (ch * c30 + sh * s30) + 0.24f * c2h +
+              0.32f * (c3h * c6 - s3h * s6) - 0.20f * (c4h * c63 + s4h * s63);
+
+    float e = (hbp - 275) * (1 / 25.0f);
+    float dtheta = 30 * exp2_neg(-1.442695041f * (e * e < 87 ? e * e : 87));
+    float x = 2 * dtheta * deg, x2 = x * x;
+    float sin2t =
+        x * (1 + x2 * (-1 / 6.0f + x2 * (1 / 120.0f + x2 * (-1 / 5040.0f))));
+
+    float Lbp = (L1[i] + L2[i]) * 0.5f, Cbp = (C1p + C2p) * 0.5f;
+    float Cbp2 = Cbp * Cbp, Cbp7 = Cbp2 * Cbp2 * Cbp2 * Cbp;
+    float RC = 2 * sqrtf(Cbp7 / (Cbp7 + pow25_7));
+    float l50 = (Lbp - 50) * (Lbp - 50);
+    float SL = 1 + 0.015f * l50 / sqrtf(20 + l50);
+    float SC = 1 + 0.045f * Cbp, SH = 1 + 0.015f * Cbp * T;
+    float RT = -sin2t * RC;
+    float l = (L2[i] - L1[i]) / SL, c = dC / SC, h = dHp / SH;
+    float s = l * l + c * c + h * h + RT * c * h;
+
+    out[i] = sqrtf(s > 0 ? s : 0);
+  }
+}
+
+/*                          SUMMARY STATISTICS
+
+    The histogram bins are the top 16 bits of the float: sign,
+    exponent and 7 bits of mantissa, so 128 bins per octave,
+    from 2^-20 up to 2^10.  Smaller differences count in the first
+    bin and larger ones in the last.
+
+*/
+
+#define HIST_MIN_EXP -20
+#define HIST_BINS (30 << 7)
+
+struct diff_stats {
+  long n;
+  double sum;
+  float max;
+  unsigned hist[HIST_BINS];
+};
+
+void stats_reset(struct diff_stats *st) { memset(st, 0, sizeof *st); }
+
+static void stats_add(struct diff_stats *st, const float *d, int n) {
+  float sum = 0, max = st->max;
+
+  for (int i = 0; i < n; i++) {
+    int bits, bin;
+
+    memcpy(&bits, &d[i], sizeof bits);
+    bin = (bits >> 16) - ((127 + HIST_MIN_EXP) << 7);
+    bin = bin > 0 ? bin : 0;
+    bin = bin < HIST_BINS - 1 ? bin : HIST_BINS - 1;
+    st->hist[bin]++;
+    sum += d[i];
+    max = d[i] > max ? d[i] : max;
+  }
+  st->n += n;
+  st->sum += sum;
+  st->max = max;
+}
+
+/* The P'th percentile (0..100), from the middle of its bin. */
+
+float stats_percentile(const struct diff_stats *st, double p) {
+  long want = (long)ceil(p / 100 * st->n), seen = 0;
+  int bin = 0;
+
+  for (; bin < HIST_BINS - 1; bin++) {
+    seen += st->hist[bin];
+    if (seen >= want) {
+      break;
+    }
+  }
+
+  int bits = (bin + ((127 + HIST_MIN_EXP) << 7)) << 16 | 0x8000;
+  float v;
+
+  memcpy(&v, &bits, sizeof v);
+  return v < st->max ? v : st->max;
+}
+
+/*                          COLOUR_DIFF
+
+    Difference between N colours A and B, added to ST.  INPUT_RGB
+    colours are linear R, G, B of the white's colour system.
+
+*/
+
+enum diff_metric { METRIC_UV, METRIC_DE76, METRIC_DE2000 };
+enum diff_input { INPUT_XYZ, INPUT_RGB };
+
+void colour_diff(const struct lab_white *w, enum diff_metric metric,
+                 enum diff_input input, const float *a, const float *b,
+                 long n, struct diff_stats *st) {
+  float xa[3 * BLOCK], xb[3 * BLOCK], d[BLOCK];
+  float L1[BLOCK], A1[BLOCK], B1[BLOCK], L2[BLOCK], A2[BLOCK], B2[BLOCK];
+
+  for (long base = 0; base < n; base += BLOCK) {
+    int m = n - base < BLOCK ? n - base : BLOCK;
+    const float *pa = a + 3 * base, *pb = b + 3 * base;
+
+    if (input == INPUT_RGB) {
+      rgb_block_to_xyz(w, pa, m, xa);
+      rgb_block_to_xyz(w, pb, m, xb);
+      pa = xa;
+      pb = xb;
+    }
+
+    if (metric == METRIC_UV) {
+      delta_uv_batch(w, pa, pb, m, d);
+    } else {
+      xyz_block_to_lab(w, pa, m, L1, A1, B1);
+      xyz_block_to_lab(w, pb, m, L2, A2, B2);
+      if (metric == METRIC_DE76) {
+        de76_batch(L1, A1, B1, L2, A2, B2, m, d);
+      } else {
+        de2000_batch(L1, A1, B1, L2, A2, B2, m, d);
+      }
+    }
+    stats_add(st, d, m);
+  }
+}
+
+/*                          BUILT-IN TEST                           */
+
+/* Pairs from Sharma, Wu and Dalal, "The CIEDE2000 color-difference
+   formula: implementation notes, supplementary test data, and
+   mathematical observations" (2005): L*a*b* 1, L*a*b* 2, Delta E 00. */
+
+static const double sharma[][7] = {
+    {50.0000, 2.6772, -79.7751, 50.0000, 0.0000, -82.7485, 2.0425},
+    {50.0000, 3.1571, -77.2803, 50.0000, 0.0000, -82.7485, 2.8615},
+    {50.0000, 2.8361, -74.0200, 50.0000, 0.0000, -82.7485, 3.4412},
+    {50.0000, 0.0000, 0.0000, 50.0000, -1.0000, 2.0000, 2.3669},
+    {50.0000, 2.5000, 0.0000, 73.0000, 25.0000, -18.0000, 27.1492},
+    {50.0000, 2.5000, 0.0000, 61.0000, -5.0000, 29.0000, 22.8977},
+    {50.0000, 2.5000, 0.0000, 56.0000, -27.0000, -3.0000, 31.9030},
+    {50.0000, 2.5000, 0.0000, 58.0000, 24.0000, 15.0000, 19.4535},
+};
+
+static double now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double frand() { return rand() / (RAND_MAX + 1.0); }
+
+int main() {
+  static const char *names[] = {"delta u'v'", "Delta E76", "CIEDE2000"};
+  struct colourSystem *cs = &SMPTEsystem;
+  struct lab_white w;
+  const int check = 200000;
+  const long n = 4000000;
+  double worst_ref = 0, worst_batch = 0;
+  static struct diff_stats st;
+
+  make_white(cs, &w);
+
+  /* CIEDE2000 against the published values. */
+  for (size_t i = 0; i < sizeof sharma / sizeof sharma[0]; i++) {
+    const double *s = sharma[i];
+    float L1 = s[0], a1 = s[1], b1 = s[2], L2 = s[3], a2 = s[4], b2 = s[5];
+    float d;
+
+    de2000_batch(&L1, &a1, &b1, &L2, &a2, &b2, 1, &d);
+    worst_ref = fmax(worst_ref, fabs(ref_de2000(s, s + 3) - s[6]));
+    worst_batch = fmax(worst_batch, fabs(d - s[6]));
+  }
+  printf("Sharma et al. test pairs: reference off by %.1e, batch by %.1e\n",
+         worst_ref, worst_batch);
+
+  /* Batch kernels against the reference on random XYZ pairs: one
+     colour anywhere in the unit cube, the other a small step away. */
+  float *a = (float *)malloc(3 * n * sizeof(float)),
+        *b = (float *)malloc(3 * n * sizeof(float));
+
+  srand(1);
+  for (long i = 0; i < 3 * n; i++) {
+    a[i] = frand();
+    b[i] = fmax(0, a[i] + 0.05 * (frand() - 0.5));
+  }
+
+  printf("\n%-11s %12s %10s %9s %9s %9s %9s\n", "metric", "batch error",
+         "ns/pair", "mean", "p50", "p95", "max");
+  for (int metric = METRIC_UV; metric <= METRIC_DE2000; metric++) {
+    double err = 0, t0;
+
+    for (int i = 0; i < check; i++) {
+      double c1[3] = {a[3 * i], a[3 * i + 1], a[3 * i + 2]};
+      double c2[3] = {b[3 * i], b[3 * i + 1], b[3 * i + 2]};
+      double l1[3], l2[3], ref;
+
+      ref_xyz_to_lab(&w, c1, l1);
+      ref_xyz_to_lab(&w, c2, l2);
+      ref = metric == METRIC_UV     ? ref_delta_uv(&w, c1, c2)
+            : metric == METRIC_DE76 ? ref_de76(l1, l2)
+                                    : ref_de2000(l1, l2);
+      stats_reset(&st);
+      colour_diff(&w, (enum diff_metric)metric, INPUT_XYZ, &a[3 * i],
+                  &b[3 * i], 1, &st);
+      err = fmax(err, fabs(st.sum - ref));
+    }
+
+    stats_reset(&st);
+    t0 = now_ns();
+    colour_diff(&w, (enum diff_metric)metric, INPUT_XYZ, a, b, n, &st);
+    t0 = now_ns() - t0;
+    printf("%-11s %12.1e %10.2f %9.4f %9.4f %9.4f %9.4f\n", names[metric],
+           err, t0 / n, st.sum / st.n, stats_percentile(&st, 50),
+           stats_percentile(&st, 95), st.max);
+  }
+
+  /* The same buffers read as linear SMPTE RGB. */
+  stats_reset(&st);
+  double t0 = now_ns();
+  colour_diff(&w, METRIC_DE2000, INPUT_RGB, a, b, n, &st);
+  t0 = now_ns() - t0;
+  printf("%-11s %12s %10.2f %9.4f %9.4f %9.4f %9.4f\n", "DE2000 RGB", "",
+         t0 / n, st.sum / st.n, stats_percentile(&st, 50),
+         stats_percentile(&st, 95), st.max);
+
+  free(a);
+  free(b);
+  return 0;
+}
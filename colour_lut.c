@@ -0,0 +1,880 @@
+/*
+            Memory-mappable lookup tables for a colour system
+
+    Tables built over xyz_to_rgb(), black body temperatures or
+    gamma_correct() for a colour system defined at run time would
+    otherwise be recomputed by every process at start-up.  This
+    program writes them once to a binary file that consumers
+    mmap() read-only, so any number of processes share one
+    physical copy of the pages and start without computing
+    anything.
+
+    File layout (native byte order, little-endian on the machines
+    we run):
+
+        struct lut_header       magic, version, colour system,
+                                CMF source, table directory,
+                                header checksum
+        page-aligned tables     one per struct lut_table entry
+
+    Every table records its sample grid (start, step, count),
+    channels per sample and precision, and carries an FNV-1a
+    checksum of its bytes.  The header checksum is always checked
+    on load; table checksums only by "verify", since that touches
+    every page.
+
+    Build:  g++ -O2 colour_lut.c -o colour_lut
+
+    Usage:  colour_lut build FILE [NAME xR yR xG yG xB yB xW yW GAMMA]
+            colour_lut info FILE
+            colour_lut verify FILE
+            colour_lut bench FILE
+
+    Without a colour system on the command line build uses SMPTE.
+    GAMMA 0 means Rec. 709, as in struct colourSystem.
+
+    The colour code is copied from color_temp.c (John Walker,
+    public domain; see that file for the full credits).
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A colour system is defined by the CIE x and y coordinates of
+   its three primary illuminants and the x and y coordinates of
+   the white point. */
+
+struct colourSystem {
+  char *name;         /* Colour system name */
+  double xRed, yRed,  /* Red x, y */
+      xGreen, yGreen, /* Green x, y */
+      xBlue, yBlue,   /* Blue x, y */
+      xWhite, yWhite, /* White point x, y */
+      gamma;          /* Gamma correction for system */
+};
+
+/* White point chromaticities. */
+
+#define IlluminantC 0.3101, 0.3162         /* For NTSC television */
+#define IlluminantD65 0.3127, 0.3291       /* For EBU and SMPTE */
+#define IlluminantE 0.33333333, 0.33333333 /* CIE equal-energy illuminant */
+
+/*  Gamma of nonlinear correction.
+
+    See Charles Poynton's ColorFAQ Item 45 and GammaFAQ Item 6 at:
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+
+*/
+
+#define GAMMA_REC709 0 /* Rec. 709 */
+
+static struct colourSystem
+    /* Name                  xRed    yRed    xGreen  yGreen  xBlue  yBlue White
+       point        Gamma   */
+    NTSCsystem = {"NTSC", 0.67, 0.33,        0.21,        0.71,
+                  0.14,   0.08, IlluminantC, GAMMA_REC709},
+    EBUsystem = {"EBU (PAL/SECAM)", 0.64,        0.33, 0.29, 0.60, 0.15, 0.06,
+                 IlluminantD65,     GAMMA_REC709},
+    SMPTEsystem = {"SMPTE", 0.630, 0.340,         0.310,       0.595,
+                   0.155,   0.070, IlluminantD65, GAMMA_REC709},
+    HDTVsystem = {"HDTV", 0.670, 0.330,         0.210,       0.710,
+                  0.150,  0.060, IlluminantD65, GAMMA_REC709},
+    CIEsystem = {"CIE",  0.7355, 0.2645,      0.2658,      0.7243,
+                 0.1669, 0.0085, IlluminantE, GAMMA_REC709},
+    Rec709system = {"CIE REC 709", 0.64, 0.33,          0.30,        0.60,
+                    0.15,          0.06, IlluminantD65, GAMMA_REC709};
+
+/*                             XYZ_TO_RGB
+
+    Given an additive tricolour system CS, defined by the CIE x
+    and y chromaticities of its three primaries (z is derived
+    trivially as 1-(x+y)), and a desired chromaticity (XC, YC,
+    ZC) in CIE space, determine the contribution of each
+    primary in a linear combination which sums to the desired
+    chromaticity.  If the  requested chromaticity falls outside
+    the Maxwell  triangle (colour gamut) formed by the three
+    primaries, one of the r, g, or b weights will be negative.
+
+    Caller can use constrain_rgb() to desaturate an
+    outside-gamut colour to the closest representation within
+    the available gamut and/or norm_rgb to normalise the RGB
+    components so the largest nonzero component has value 1.
+
+*/
+
+void xyz_to_rgb(struct colourSystem *cs, double xc, double yc, double zc,
+                double *r, double *g, double *b) {
+  double xr, yr, zr, xg, yg, zg, xb, yb, zb;
+  double xw, yw, zw;
+  double rx, ry, rz, gx, gy, gz, bx, by, bz;
+  double rw, gw, bw;
+
+  xr = cs->xRed;
+  yr = cs->yRed;
+  zr = 1 - (xr + yr);
+  xg = cs->xGreen;
+  yg = cs->yGreen;
+  zg = 1 - (xg + yg);
+  xb = cs->xBlue;
+  yb = cs->yBlue;
+  zb = 1 - (xb + yb);
+
+  xw = cs->xWhite;
+  yw = cs->yWhite;
+  zw = 1 - (xw + yw);
+
+  /* xyz -> rgb matrix, before scaling to white. */
+
+  rx = (yg * zb) - (yb * zg);
+  ry = (xb * zg) - (xg * zb);
+  rz = (xg * yb) - (xb * yg);
+  gx = (yb * zr) - (yr * zb);
+  gy = (xr * zb) - (xb * zr);
+  gz = (xb * yr) - (xr * yb);
+  bx = (yr * zg) - (yg * zr);
+  by = (xg * zr) - (xr * zg);
+  bz = (xr * yg) - (xg * yr);
+
+  /* White scaling factors.
+     Dividing by yw scales the white luminance to unity, as conventional. */
+
+  rw = ((rx * xw) + (ry * yw) + (rz * zw)) / yw;
+  gw = ((gx * xw) + (gy * yw) + (gz * zw)) / yw;
+  bw = ((bx * xw) + (by * yw) + (bz * zw)) / yw;
+
+  /* xyz -> rgb matrix, correctly scaled to white. */
+
+  rx = rx / rw;
+  ry = ry / rw;
+  rz = rz / rw;
+  gx = gx / gw;
+  gy = gy / gw;
+  gz = gz / gw;
+  bx = bx / bw;
+  by = by / bw;
+  bz = bz / bw;
+
+  /* rgb of the desired point */
+
+  *r = (rx * xc) + (ry * yc) + (rz * zc);
+  *g = (gx * xc) + (gy * yc) + (gz * zc);
+  *b = (bx * xc) + (by * yc) + (bz * zc);
+}
+
+/*                          CONSTRAIN_RGB
+
+    If the requested RGB shade contains a negative weight for
+    one of the primaries, it lies outside the colour gamut
+    accessible from the given triple of primaries.  Desaturate
+    it by adding white, equal quantities of R, G, and B, enough
+    to make RGB all positive.  The function returns 1 if the
+    components were modified, zero otherwise.
+
+*/
+
+int constrain_rgb(double *r, double *g, double *b) {
+  double w;
+
+  /* Amount of white needed is w = - min(0, *r, *g, *b) */
+
+  w = (0 < *r) ? 0 : *r;
+  w = (w < *g) ? w : *g;
+  w = (w < *b) ? w : *b;
+  w = -w;
+
+  /* Add just enough white to make r, g, b all positive. */
+
+  if (w > 0) {
+    *r += w;
+    *g += w;
+    *b += w;
+    return 1; /* Colour modified to fit RGB gamut */
+  }
+
+  return 0; /* Colour within RGB gamut */
+}
+
+/*                          GAMMA_CORRECT_RGB
+
+    Transform linear RGB values to nonlinear RGB values. Rec.
+    709 is ITU-R Recommendation BT. 709 (1990) ``Basic
+    Parameter Values for the HDTV Standard for the Studio and
+    for International Programme Exchange'', formerly CCIR Rec.
+    709. For details see
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+*/
+
+void gamma_correct(const struct colourSystem *cs, double *c) {
+  double gamma;
+
+  gamma = cs->gamma;
+
+  if (gamma == GAMMA_REC709) {
+    /* Rec. 709 gamma correction. */
+    double cc = 0.018;
+
+    if (*c < cc) {
+      *c *= ((1.099 * pow(cc, 0.45)) - 0.099) / cc;
+    } else {
+      *c = (1.099 * pow(*c, 0.45)) - 0.099;
+    }
+  } else {
+    /* Nonlinear colour = (Linear colour)^(1/gamma) */
+    *c = pow(*c, 1.0 / gamma);
+  }
+}
+
+void gamma_correct_rgb(const struct colourSystem *cs, double *r, double *g,
+                       double *b) {
+  gamma_correct(cs, r);
+  gamma_correct(cs, g);
+  gamma_correct(cs, b);
+}
+
+/*                          NORM_RGB
+
+    Normalise RGB components so the most intense (unless all
+    are zero) has a value of 1.
+
+*/
+
+void norm_rgb(double *r, double *g, double *b) {
+#define Max(a, b) (((a) > (b)) ? (a) : (b))
+  double greatest = Max(*r, Max(*g, *b));
+
+  if (greatest > 0) {
+    *r /= greatest;
+    *g /= greatest;
+    *b /= greatest;
+  }
+#undef Max
+}
+
+/*                          SPECTRUM_TO_XYZ
+
+    Calculate the CIE X, Y, and Z coordinates corresponding to
+    a light source with spectral distribution given by  the
+    function SPEC_INTENS, which is called with a series of
+    wavelengths between 380 and 780 nm (the argument is
+    expressed in meters), which returns emittance at  that
+    wavelength in arbitrary units.  The chromaticity
+    coordinates of the spectrum are returned in the x, y, and z
+    arguments which respect the identity:
+
+            x + y + z = 1.
+*/
+
+void spectrum_to_xyz(double (*spec_intens)(double wavelength), double *x,
+                     double *y, double *z) {
+  int i;
+  double lambda, X = 0, Y = 0, Z = 0, XYZ;
+
+  /* CIE colour matching functions xBar, yBar, and zBar for
+     wavelengths from 380 through 780 nanometers, every 5
+     nanometers.  For a wavelength lambda in this range:
+
+          cie_colour_match[(lambda - 380) / 5][0] = xBar
+          cie_colour_match[(lambda - 380) / 5][1] = yBar
+          cie_colour_match[(lambda - 380) / 5][2] = zBar
+
+      To save memory, this table can be declared as floats
+      rather than doubles; (IEEE) float has enough
+      significant bits to represent the values. It's declared
+      as a double here to avoid warnings about "conversion
+      between floating-point types" from certain persnickety
+      compilers. */
+
+  static double cie_colour_match[81][3] = {
+      {0.0014, 0.0000, 0.0065}, {0.0022, 0.0001, 0.0105},
+      {0.0042, 0.0001, 0.0201}, {0.0076, 0.0002, 0.0362},
+      {0.0143, 0.0004, 0.0679}, {0.0232, 0.0006, 0.1102},
+      {0.0435, 0.0012, 0.2074}, {0.0776, 0.0022, 0.3713},
+      {0.1344, 0.0040, 0.6456}, {0.2148, 0.0073, 1.0391},
+      {0.2839, 0.0116, 1.3856}, {0.3285, 0.0168, 1.6230},
+      {0.3483, 0.0230, 1.7471}, {0.3481, 0.0298, 1.7826},
+      {0.3362, 0.0380, 1.7721}, {0.3187, 0.0480, 1.7441},
+      {0.2908, 0.0600, 1.6692}, {0.2511, 0.0739, 1.5281},
+      {0.1954, 0.0910, 1.2876}, {0.1421, 0.1126, 1.0419},
+      {0.0956, 0.1390, 0.8130}, {0.0580, 0.1693, 0.6162},
+      {0.0320, 0.2080, 0.4652}, {0.0147, 0.2586, 0.3533},
+      {0.0049, 0.3230, 0.2720}, {0.0024, 0.4073, 0.2123},
+      {0.0093, 0.5030, 0.1582}, {0.0291, 0.6082, 0.1117},
+      {0.0633, 0.7100, 0.0782}, {0.1096, 0.7932, 0.0573},
+      {0.1655, 0.8620, 0.0422}, {0.2257, 0.9149, 0.0298},
+      {0.2904, 0.9540, 0.0203}, {0.3597, 0.9803, 0.0134},
+      {0.4334, 0.9950, 0.0087}, {0.5121, 1.0000, 0.0057},
+      {0.5945, 0.9950, 0.0039}, {0.6784, 0.9786, 0.0027},
+      {0.7621, 0.9520, 0.0021}, {0.8425, 0.9154, 0.0018},
+      {0.9163, 0.8700, 0.0017}, {0.9786, 0.8163, 0.0014},
+      {1.0263, 0.7570, 0.0011}, {1.0567, 0.6949, 0.0010},
+      {1.0622, 0.6310, 0.0008}, {1.0456, 0.5668, 0.0006},
+      {1.0026, 0.5030, 0.0003}, {0.9384, 0.4412, 0.0002},
+      {0.8544, 0.3810, 0.0002}, {0.7514, 0.3210, 0.0001},
+      {0.6424, 0.2650, 0.0000}, {0.5419, 0.2170, 0.0000},
+      {0.4479, 0.1750, 0.0000}, {0.3608, 0.1382, 0.0000},
+      {0.2835, 0.1070, 0.0000}, {0.2187, 0.0816, 0.0000},
+      {0.1649, 0.0610, 0.0000}, {0.1212, 0.0446, 0.0000},
+      {0.0874, 0.0320, 0.0000}, {0.0636, 0.0232, 0.0000},
+      {0.0468, 0.0170, 0.0000}, {0.0329, 0.0119, 0.0000},
+      {0.0227, 0.0082, 0.0000}, {0.0158, 0.0057, 0.0000},
+      {0.0114, 0.0041, 0.0000}, {0.0081, 0.0029, 0.0000},
+      {0.0058, 0.0021, 0.0000}, {0.0041, 0.0015, 0.0000},
+      {0.0029, 0.0010, 0.0000}, {0.0020, 0.0007, 0.0000},
+      {0.0014, 0.0005, 0.0000}, {0.0010, 0.0004, 0.0000},
+      {0.0007, 0.0002, 0.0000}, {0.0005, 0.0002, 0.0000},
+      {0.0003, 0.0001, 0.0000}, {0.0002, 0.0001, 0.0000},
+      {0.0002, 0.0001, 0.0000}, {0.0001, 0.0000, 0.0000},
+      {0.0001, 0.0000, 0.0000}, {0.0001, 0.0000, 0.0000},
+      {0.0000, 0.0000, 0.0000}};
+
+  for (i = 0, lambda = 380; lambda < 780.1; i++, lambda += 5) {
+    double Me;
+
+    Me = (*spec_intens)(lambda);
+    X += Me * cie_colour_match[i][0];
+    Y += Me * cie_colour_match[i][1];
+    Z += Me * cie_colour_match[i][2];
+  }
+  XYZ = (X + Y + Z);
+  *x = X / XYZ;
+  *y = Y / XYZ;
+  *z = Z / XYZ;
+}
+
+/*                            BB_SPECTRUM
+
+    Calculate, by Planck's radiation law, the emittance of a black body
+    of temperature bbTemp at the given wavelength (in metres).  */
+
+double bbTemp = 5000; /* Hidden temperature argument
+                         to BB_SPECTRUM. */
+double bb_spectrum(double wavelength) {
+  double wlm = wavelength * 1e-9; /* Wavelength in meters */
+
+  return (3.74183e-16 * pow(wlm, -5.0)) /
+         (exp(1.4388e-2 / (wlm * bbTemp)) - 1.0);
+}
+double white(double wavelength) { return 1; }
+
+/*                          FILE FORMAT                             */
+
+#define LUT_MAGIC "CLRLUT\r\n" /* 8 bytes; the \r\n catches text-mode damage */
+#define LUT_VERSION 1
+#define LUT_PAGE 4096
+#define LUT_MAX_TABLES 8
+
+enum lut_kind {
+  LUT_XYZ_TO_RGB = 1, /* 3x3 matrix, one sample of 9 channels */
+  LUT_BLACKBODY = 2,  /* Kelvin -> x, y, z, r, g, b (r, g, b linear,
+                         constrained and normalised) */
+  LUT_GAMMA = 3       /* Linear 0..1 -> gamma_correct() */
+};
+
+enum lut_cmf {
+  CMF_CIE1931_5NM = 1 /* The 5 nm table in spectrum_to_xyz() */
+};
+
+struct lut_table {
+  uint32_t kind;      /* enum lut_kind */
+  uint32_t precision; /* Bytes per value: 4 (float) or 8 (double) */
+  uint32_t channels;  /* Values per sample */
+  uint32_t count;     /* Samples */
+  double start, step; /* Sample i is at start + i * step */
+  uint64_t offset;    /* From the start of the file, page aligned */
+  uint64_t bytes;
+  uint64_t checksum; /* FNV-1a of the table's bytes */
+};
+
+struct lut_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_bytes; /* sizeof(struct lut_header) when written */
+  uint64_t file_bytes;
+  uint64_t header_checksum; /* FNV-1a of the header with this field 0 */
+  struct {
+    char name[32];
+    double xRed, yRed, xGreen, yGreen, xBlue, yBlue, xWhite, yWhite, gamma;
+  } cs;
+  uint32_t cmf;
+  uint32_t ntables;
+  struct lut_table table[LUT_MAX_TABLES];
+};
+
+static uint64_t fnv1a(const void *p, size_t n) {
+  const unsigned char *s = (const unsigned char *)p;
+  uint64_t h = 14695981039346656037ULL;
+
+  for (size_t i = 0; i < n; i++) {
+    h = (h ^ s[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+static uint64_t header_checksum(const struct lut_header *h) {
+  struct lut_header copy = *h;
+
+  copy.header_checksum = 0;
+  return fnv1a(&copy, sizeof copy);
+}
+
+/*                             BUILD
+
+    Lay the header out in page 0 and each table on the pages after
+    it, fill them in memory and write the file under a temporary
+    name, renaming it into place so a consumer never maps a half
+    written table.  Returns 0 with a message on stderr if the file
+    cannot be written.
+
+*/
+
+#define BB_FIRST 1000.0
+#define BB_LAST 40000.0
+#define BB_STEP 10.0
+#define GAMMA_SAMPLES 4096
+
+static size_t page_round(size_t n) {
+  return (n + LUT_PAGE - 1) & ~(size_t)(LUT_PAGE - 1);
+}
+
+static struct lut_table *add_table(struct lut_header *h, enum lut_kind kind,
+                                   uint32_t precision, uint32_t channels,
+                                   uint32_t count, double start, double step) {
+  struct lut_table *t = &h->table[h->ntables++];
+  uint64_t end = h->file_bytes;
+
+  t->kind = kind;
+  t->precision = precision;
+  t->channels = channels;
+  t->count = count;
+  t->start = start;
+  t->step = step;
+  t->offset = end;
+  t->bytes = (uint64_t)precision * channels * count;
+  h->file_bytes = end + page_round(t->bytes);
+  return t;
+}
+
+int lut_build(const char *path, struct colourSystem *cs) {
+  struct lut_header h;
+  struct lut_table *mt, *bt, *gt;
+  unsigned char *file;
+  char tmp[4096];
+  int fd, ok;
+
+  memset(&h, 0, sizeof h);
+  memcpy(h.magic, LUT_MAGIC, 8);
+  h.version = LUT_VERSION;
+  h.header_bytes = sizeof h;
+  h.file_bytes = page_round(sizeof h);
+  snprintf(h.cs.name, sizeof h.cs.name, "%s", cs->name);
+  h.cs.xRed = cs->xRed;
+  h.cs.yRed = cs->yRed;
+  h.cs.xGreen = cs->xGreen;
+  h.cs.yGreen = cs->yGreen;
+  h.cs.xBlue = cs->xBlue;
+  h.cs.yBlue = cs->yBlue;
+  h.cs.xWhite = cs->xWhite;
+  h.cs.yWhite = cs->yWhite;
+  h.cs.gamma = cs->gamma;
+  h.cmf = CMF_CIE1931_5NM;
+
+  mt = add_table(&h, LUT_XYZ_TO_RGB, 8, 9, 1, 0, 0);
+  bt = add_table(&h, LUT_BLACKBODY, 4, 6,
+                 (uint32_t)((BB_LAST - BB_FIRST) / BB_STEP) + 1, BB_FIRST,
+                 BB_STEP);
+  gt = add_table(&h, LUT_GAMMA, 4, 1, GAMMA_SAMPLES, 0,
+                 1.0 / (GAMMA_SAMPLES - 1));
+
+  file = (unsigned char *)calloc(1, h.file_bytes);
+  if (!file) {
+    fprintf(stderr, "%s: no memory for %llu bytes of tables\n", path,
+            (unsigned long long)h.file_bytes);
+    return 0;
+  }
+
+  double *m = (double *)(file + mt->offset);
+  xyz_to_rgb(cs, 1, 0, 0, &m[0], &m[3], &m[6]);
+  xyz_to_rgb(cs, 0, 1, 0, &m[1], &m[4], &m[7]);
+  xyz_to_rgb(cs, 0, 0, 1, &m[2], &m[5], &m[8]);
+
+  float *bb = (float *)(file + bt->offset);
+  for (uint32_t i = 0; i < bt->count; i++) {
+    double x, y, z, r, g, b;
+
+    bbTemp = bt->start + i * bt->step;
+    spectrum_to_xyz(bb_spectrum, &x, &y, &z);
+    xyz_to_rgb(cs, x, y, z, &r, &g, &b);
+    constrain_rgb(&r, &g, &b);
+    norm_rgb(&r, &g, &b);
+    bb[6 * i] = x;
+    bb[6 * i + 1] = y;
+    bb[6 * i + 2] = z;
+    bb[6 * i + 3] = r;
+    bb[6 * i + 4] = g;
+    bb[6 * i + 5] = b;
+  }
+
+  float *gm = (float *)(file + gt->offset);
+  for (uint32_t i = 0; i < gt->count; i++) {
+    double c = gt->start + i * gt->step;
+
+    gamma_correct(cs, &c);
+    gm[i] = c;
+  }
+
+  for (uint32_t i = 0; i < h.ntables; i++) {
+    h.table[i].checksum = fnv1a(file + h.table[i].offset, h.table[i].bytes);
+  }
+  h.header_checksum = header_checksum(&h);
+  memcpy(file, &h, sizeof h);
+
+  snprintf(tmp, sizeof tmp, "%s.tmp.%d", path, (int)getpid());
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(tmp);
+    free(file);
+    return 0;
+  }
+  ok = 1;
+  for (size_t done = 0; ok && done < h.file_bytes;) {
+    ssize_t n = write(fd, file + done, h.file_bytes - done);
+
+    if (n < 0 && errno != EINTR) {
+      perror(tmp);
+      ok = 0;
+    } else if (n > 0) {
+      done += n;
+    }
+  }
+  if (close(fd) < 0 && ok) {
+    perror(tmp);
+    ok = 0;
+  }
+  if (ok && rename(tmp, path) < 0) {
+    perror(path);
+    ok = 0;
+  }
+  if (!ok) {
+    unlink(tmp);
+  }
+  free(file);
+  return ok;
+}
+
+/*                              LOAD
+
+    Map the file read-only and check the header.  Returns NULL with
+    a message on stderr if the file is not a table file this code
+    understands.
+
+*/
+
+struct lut {
+  const struct lut_header *h;
+  const unsigned char *base;
+  size_t size;
+};
+
+const struct lut_table *lut_find(const struct lut *l, enum lut_kind kind) {
+  for (uint32_t i = 0; i < l->h->ntables; i++) {
+    if (l->h->table[i].kind == (uint32_t)kind) {
+      return &l->h->table[i];
+    }
+  }
+  return NULL;
+}
+
+int lut_open(const char *path, struct lut *l) {
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  const char *why = NULL;
+  void *p;
+
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return 0;
+  }
+  if ((size_t)st.st_size < sizeof(struct lut_header)) {
+    fprintf(stderr, "%s: too short for a table file\n", path);
+    close(fd);
+    return 0;
+  }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror(path);
+    return 0;
+  }
+
+  l->base = (const unsigned char *)p;
+  l->h = (const struct lut_header *)p;
+  l->size = st.st_size;
+
+  if (memcmp(l->h->magic, LUT_MAGIC, 8) != 0) {
+    why = "bad magic";
+  } else if (l->h->version != LUT_VERSION ||
+             l->h->header_bytes != sizeof(struct lut_header)) {
+    why = "unsupported version";
+  } else if (l->h->header_checksum != header_checksum(l->h)) {
+    why = "header checksum mismatch";
+  } else if (l->h->file_bytes != l->size ||
+             l->h->ntables > LUT_MAX_TABLES) {
+    why = "truncated or corrupt";
+  } else {
+    for (uint32_t i = 0; i < l->h->ntables && !why; i++) {
+      const struct lut_table *t = &l->h->table[i];
+
+      if (t->offset % LUT_PAGE || t->offset + t->bytes > l->size ||
+          t->bytes != (uint64_t)t->precision * t->channels * t->count) {
+        why = "bad table directory";
+      }
+    }
+  }
+  if (why) {
+    fprintf(stderr, "%s: %s\n", path, why);
+    munmap(p, st.st_size);
+    return 0;
+  }
+  return 1;
+}
+
+void lut_close(struct lut *l) { munmap((void *)l->base, l->size); }
+
+int lut_verify(const struct lut *l) {
+  int ok = 1;
+
+  for (uint32_t i = 0; i < l->h->ntables; i++) {
+    const struct lut_table *t = &l->h->table[i];
+
+    if (fnv1a(l->base + t->offset, t->bytes) != t->checksum) {
+      fprintf(stderr, "table %u (kind %u): checksum mismatch\n", i, t->kind);
+      ok = 0;
+    }
+  }
+  return ok;
+}
+
+/*                            LOOKUPS                               */
+
+/* The table of KIND, if it has the layout the lookups below read:
+   PRECISION bytes per value, CHANNELS values per sample and at least
+   two samples to interpolate between.  NULL with a message on stderr
+   otherwise. */
+
+const struct lut_table *lut_expect(const struct lut *l, enum lut_kind kind,
+                                   uint32_t precision, uint32_t channels) {
+  const struct lut_table *t = lut_find(l, kind);
+
+  if (!t) {
+    fprintf(stderr, "no table of kind %u\n", (unsigned)kind);
+  } else if (t->precision != precision || t->channels != channels ||
+             t->count < 2) {
+    fprintf(stderr, "table of kind %u: %u x %u x %u bytes, expected "
+                    "%u channels of %u bytes\n",
+            (unsigned)kind, t->count, t->channels, t->precision, channels,
+            precision);
+    t = NULL;
+  }
+  return t;
+}
+
+/* Linear RGB of a black body at TEMP kelvin, interpolated between the
+   two nearest samples and clamped to the table's range. */
+
+void lut_blackbody_rgb(const struct lut *l, const struct lut_table *t,
+                       double temp, double *r, double *g, double *b) {
+  const float *v = (const float *)(l->base + t->offset);
+  double p = (temp - t->start) / t->step;
+  uint32_t i;
+  double f;
+
+  p = p < 0 ? 0 : p > t->count - 1 ? t->count - 1 : p;
+  i = (uint32_t)p;
+  i = i > t->count - 2 ? t->count - 2 : i;
+  f = p - i;
+  v += 6 * i;
+  *r = v[3] + (v[9] - v[3]) * f;
+  *g = v[4] + (v[10] - v[4]) * f;
+  *b = v[5] + (v[11] - v[5]) * f;
+}
+
+double lut_gamma(const struct lut *l, const struct lut_table *t, double c) {
+  const float *v = (const float *)(l->base + t->offset);
+  double p = (c - t->start) / t->step;
+  uint32_t i;
+
+  p = p < 0 ? 0 : p > t->count - 1 ? t->count - 1 : p;
+  i = (uint32_t)p;
+  i = i > t->count - 2 ? t->count - 2 : i;
+  return v[i] + (v[i + 1] - v[i]) * (p - i);
+}
+
+static const char *kind_name(uint32_t kind) {
+  switch (kind) {
+  case LUT_XYZ_TO_RGB:
+    return "xyz_to_rgb";
+  case LUT_BLACKBODY:
+    return "blackbody";
+  case LUT_GAMMA:
+    return "gamma";
+  }
+  return "unknown";
+}
+
+static double now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  struct lut l;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s build|info|verify|bench FILE [colour system]\n",
+            argv[0]);
+    return 2;
+  }
+
+  if (strcmp(argv[1], "build") == 0) {
+    struct colourSystem custom, *cs = &SMPTEsystem;
+
+    if (argc == 13) {
+      custom.name = argv[3];
+      custom.xRed = atof(argv[4]);
+      custom.yRed = atof(argv[5]);
+      custom.xGreen = atof(argv[6]);
+      custom.yGreen = atof(argv[7]);
+      custom.xBlue = atof(argv[8]);
+      custom.yBlue = atof(argv[9]);
+      custom.xWhite = atof(argv[10]);
+      custom.yWhite = atof(argv[11]);
+      custom.gamma = atof(argv[12]);
+      cs = &custom;
+    } else if (argc != 3) {
+      fprintf(stderr, "build wants NAME and 9 numbers, or nothing\n");
+      return 2;
+    }
+    if (!lut_build(argv[2], cs)) {
+      return 1;
+    }
+    return 0;
+  }
+
+  if (!lut_open(argv[2], &l)) {
+    return 1;
+  }
+
+  if (strcmp(argv[1], "info") == 0) {
+    printf("%s: version %u, %llu bytes, colour system \"%s\"\n", argv[2],
+           l.h->version, (unsigned long long)l.h->file_bytes, l.h->cs.name);
+    printf("  primaries R %.4f,%.4f G %.4f,%.4f B %.4f,%.4f  white "
+           "%.4f,%.4f  gamma %g\n",
+           l.h->cs.xRed, l.h->cs.yRed, l.h->cs.xGreen, l.h->cs.yGreen,
+           l.h->cs.xBlue, l.h->cs.yBlue, l.h->cs.xWhite, l.h->cs.yWhite,
+           l.h->cs.gamma);
+    printf("  CMF source %u\n", l.h->cmf);
+    for (uint32_t i = 0; i < l.h->ntables; i++) {
+      const struct lut_table *t = &l.h->table[i];
+
+      printf("  %-10s %5u x %u x %u bytes, start %g step %g, at %llu\n",
+             kind_name(t->kind), t->count, t->channels, t->precision,
+             t->start, t->step, (unsigned long long)t->offset);
+    }
+  } else if (strcmp(argv[1], "verify") == 0) {
+    if (!lut_verify(&l)) {
+      lut_close(&l);
+      return 1;
+    }
+    printf("%s: ok\n", argv[2]);
+  } else if (strcmp(argv[1], "bench") == 0) {
+    /* Start-up cost of mapping the file against rebuilding the black
+       body table, and the error of the interpolated lookups. */
+    const struct lut_table *bt = lut_expect(&l, LUT_BLACKBODY, 4, 6);
+    const struct lut_table *gt = lut_expect(&l, LUT_GAMMA, 4, 1);
+    struct colourSystem cs = {(char *)l.h->cs.name, l.h->cs.xRed, l.h->cs.yRed,
+                              l.h->cs.xGreen, l.h->cs.yGreen, l.h->cs.xBlue,
+                              l.h->cs.yBlue,  l.h->cs.xWhite, l.h->cs.yWhite,
+                              l.h->cs.gamma};
+    double t0, t_open, t_build, max_bb = 0, max_gamma = 0, sum = 0;
+    volatile double sink;
+    struct lut l2;
+
+    if (!bt || !gt) {
+      lut_close(&l);
+      return 1;
+    }
+
+    t0 = now_ns();
+    lut_open(argv[2], &l2);
+    t_open = now_ns() - t0;
+    lut_close(&l2);
+
+    /* All the work the table saves, with the results kept so the
+       compiler cannot drop the loop. */
+    t0 = now_ns();
+    for (uint32_t i = 0; i < bt->count; i++) {
+      double x, y, z, r, g, b;
+
+      bbTemp = bt->start + i * bt->step;
+      spectrum_to_xyz(bb_spectrum, &x, &y, &z);
+      xyz_to_rgb(&cs, x, y, z, &r, &g, &b);
+      constrain_rgb(&r, &g, &b);
+      norm_rgb(&r, &g, &b);
+      sum += x + y + z + r + g + b;
+    }
+    sink = sum;
+    t_build = now_ns() - t0;
+    (void)sink;
+
+    for (double t = bt->start; t <= bt->start + (bt->count - 1) * bt->step;
+         t += 0.37 * bt->step) {
+      double x, y, z, r, g, b, lr, lg, lb;
+
+      bbTemp = t;
+      spectrum_to_xyz(bb_spectrum, &x, &y, &z);
+      xyz_to_rgb(&cs, x, y, z, &r, &g, &b);
+      constrain_rgb(&r, &g, &b);
+      norm_rgb(&r, &g, &b);
+      lut_blackbody_rgb(&l, bt, t, &lr, &lg, &lb);
+      max_bb = fmax(max_bb, fabs(r - lr));
+      max_bb = fmax(max_bb, fmax(fabs(g - lg), fabs(b - lb)));
+    }
+    for (double c = 0; c <= 1; c += 1e-5) {
+      double ref = c;
+
+      gamma_correct(&cs, &ref);
+      max_gamma = fmax(max_gamma, fabs(ref - lut_gamma(&l, gt, c)));
+    }
+
+    printf("open+validate: %8.1f us\n", t_open / 1e3);
+    printf("recompute bb:  %8.1f us (%u temperatures)\n", t_build / 1e3,
+           bt->count);
+    printf("max error: blackbody rgb %.2e, gamma %.2e\n", max_bb, max_gamma);
+  } else {
+    fprintf(stderr, "unknown command %s\n", argv[1]);
+    lut_close(&l);
+    return 2;
+  }
+
+  lut_close(&l);
+  return 0;
+}
@@ -0,0 +1,747 @@
+/*
+                  HDR output: PQ, HLG and half float
+
+    norm_rgb() scales every colour so its brightest channel is 1,
+    which throws away absolute luminance: a 1500 K and a 9000 K
+    black body come out equally bright.  HDR displays can show
+    the difference, so this path keeps it.  Luminance is taken
+    from the unnormalised spectrum_to_xyz() sums (cd/m^2 for a
+    radiance spectrum), scaled by an exposure, and encoded for the
+    display as one of:
+
+        pq10    SMPTE ST 2084 (PQ), Rec. 2020 primaries, packed
+                10:10:10:2 words, absolute 0..10000 cd/m^2
+        hlg10   ARIB STD-B67 / BT.2100 HLG, Rec. 2020 primaries,
+                packed 10:10:10:2, for a display with a
+                1000 cd/m^2 peak: the BT.2100 inverse OOTF takes
+                display light back to scene light first
+        f16     linear scRGB half floats (Rec. 709 primaries,
+                1.0 = 80 cd/m^2, negative values allowed), R, G,
+                B, A per pixel, converted with F16C when the
+                compiler targets it
+
+    Neither transfer function calls pow() or log() per pixel, nor
+    does the HLG inverse OOTF.  All are tabulated on a log scale.
+    A float's top bits, exponent and 6 bits of mantissa, pick a
+    segment (64 per octave, covering 2^-32..1), and the remaining
+    mantissa bits are the position within it for linear
+    interpolation.  The tables are
+    built once from the exact formulas.
+
+    Build:  g++ -O3 -march=native hdr_output.c -o hdr_output
+
+    Usage:  hdr_output [pq10 | hlg10 | f16]
+
+    Prints a black body series from 1000 to 12000 K with the 6500 K
+    body exposed to 203 cd/m^2 (the BT.2408 reference white), checks
+    the tables against the exact functions and, for HLG, that the
+    6500 K body lands at the 75% signal BT.2408 gives reference
+    white, and times the encoding of a 3840x2160 frame.
+
+    The colour code is copied from color_temp.c (John Walker,
+    public domain; see that file for the full credits).
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+/* A colour system is defined by the CIE x and y coordinates of
+   its three primary illuminants and the x and y coordinates of
+   the white point. */
+
+struct colourSystem {
+  const char *name;   /* Colour system name */
+  double xRed, yRed,  /* Red x, y */
+      xGreen, yGreen, /* Green x, y */
+      xBlue, yBlue,   /* Blue x, y */
+      xWhite, yWhite, /* White point x, y */
+      gamma;          /* Gamma correction for system */
+};
+
+/* White point chromaticities. */
+
+#define IlluminantC 0.3101, 0.3162         /* For NTSC television */
+#define IlluminantD65 0.3127, 0.3291       /* For EBU and SMPTE */
+#define IlluminantE 0.33333333, 0.33333333 /* CIE equal-energy illuminant */
+
+/*  Gamma of nonlinear correction.
+
+    See Charles Poynton's ColorFAQ Item 45 and GammaFAQ Item 6 at:
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+
+*/
+
+#define GAMMA_REC709 0 /* Rec. 709 */
+
+static struct colourSystem
+    /* Name                  xRed    yRed    xGreen  yGreen  xBlue  yBlue White
+       point        Gamma   */
+    NTSCsystem = {"NTSC", 0.67, 0.33,        0.21,        0.71,
+                  0.14,   0.08, IlluminantC, GAMMA_REC709},
+    EBUsystem = {"EBU (PAL/SECAM)", 0.64,        0.33, 0.29, 0.60, 0.15, 0.06,
+                 IlluminantD65,     GAMMA_REC709},
+    SMPTEsystem = {"SMPTE", 0.630, 0.340,         0.310,       0.595,
+                   0.155,   0.070, IlluminantD65, GAMMA_REC709},
+    HDTVsystem = {"HDTV", 0.670, 0.330,         0.210,       0.710,
+                  0.150,  0.060, IlluminantD65, GAMMA_REC709},
+    CIEsystem = {"CIE",  0.7355, 0.2645,      0.2658,      0.7243,
+                 0.1669, 0.0085, IlluminantE, GAMMA_REC709},
+    Rec709system = {"CIE REC 709", 0.64, 0.33,          0.30,        0.60,
+                    0.15,          0.06, IlluminantD65, GAMMA_REC709};
+
+/*                             XYZ_TO_RGB
+
+    Given an additive tricolour system CS, defined by the CIE x
+    and y chromaticities of its three primaries (z is derived
+    trivially as 1-(x+y)), and a desired chromaticity (XC, YC,
+    ZC) in CIE space, determine the contribution of each
+    primary in a linear combination which sums to the desired
+    chromaticity.  If the  requested chromaticity falls outside
+    the Maxwell  triangle (colour gamut) formed by the three
+    primaries, one of the r, g, or b weights will be negative.
+
+    Caller can use constrain_rgb() to desaturate an
+    outside-gamut colour to the closest representation within
+    the available gamut and/or norm_rgb to normalise the RGB
+    components so the largest nonzero component has value 1.
+
+*/
+
+void xyz_to_rgb(struct colourSystem *cs, double xc, double yc, double zc,
+                double *r, double *g, double *b) {
+  double xr, yr, zr, xg, yg, zg, xb, yb, zb;
+  double xw, yw, zw;
+  double rx, ry, rz, gx, gy, gz, bx, by, bz;
+  double rw, gw, bw;
+
+  xr = cs->xRed;
+  yr = cs->yRed;
+  zr = 1 - (xr + yr);
+  xg = cs->xGreen;
+  yg = cs->yGreen;
+  zg = 1 - (xg + yg);
+  xb = cs->xBlue;
+  yb = cs->yBlue;
+  zb = 1 - (xb + yb);
+
+  xw = cs->xWhite;
+  yw = cs->yWhite;
+  zw = 1 - (xw + yw);
+
+  /* xyz -> rgb matrix, before scaling to white. */
+
+  rx = (yg * zb) - (yb * zg);
+  ry = (xb * zg) - (xg * zb);
+  rz = (xg * yb) - (xb * yg);
+  gx = (yb * zr) - (yr * zb);
+  gy = (xr * zb) - (xb * zr);
+  gz = (xb * yr) - (xr * yb);
+  bx = (yr * zg) - (yg * zr);
+  by = (xg * zr) - (xr * zg);
+  bz = (xr * yg) - (xg * yr);
+
+  /* White scaling factors.
+     Dividing by yw scales the white luminance to unity, as conventional. */
+
+  rw = ((rx * xw) + (ry * yw) + (rz * zw)) / yw;
+  gw = ((gx * xw) + (gy * yw) + (gz * zw)) / yw;
+  bw = ((bx * xw) + (by * yw) + (bz * zw)) / yw;
+
+  /* xyz -> rgb matrix, correctly scaled to white. */
+
+  rx = rx / rw;
+  ry = ry / rw;
+  rz = rz / rw;
+  gx = gx / gw;
+  gy = gy / gw;
+  gz = gz / gw;
+  bx = bx / bw;
+  by = by / bw;
+  bz = bz / bw;
+
+  /* rgb of the desired point */
+
+  *r = (rx * xc) + (ry * yc) + (rz * zc);
+  *g = (gx * xc) + (gy * yc) + (gz * zc);
+  *b = (bx * xc) + (by * yc) + (bz * zc);
+}
+
+/* CIE colour matching functions xBar, yBar, and zBar for
+   wavelengths from 380 through 780 nanometers, every 5
+   nanometers.  For a wavelength lambda in this range:
+
+        cie_colour_match[(lambda - 380) / 5][0] = xBar
+        cie_colour_match[(lambda - 380) / 5][1] = yBar
+        cie_colour_match[(lambda - 380) / 5][2] = zBar
+
+    To save memory, this table can be declared as floats
+    rather than doubles; (IEEE) float has enough
+    significant bits to represent the values. It's declared
+    as a double here to avoid warnings about "conversion
+    between floating-point types" from certain persnickety
+    compilers. */
+
+static double cie_colour_match[81][3] = {
+    {0.0014, 0.0000, 0.0065}, {0.0022, 0.0001, 0.0105},
+    {0.0042, 0.0001, 0.0201}, {0.0076, 0.0002, 0.0362},
+    {0.0143, 0.0004, 0.0679}, {0.0232, 0.0006, 0.1102},
+    {0.0435, 0.0012, 0.2074}, {0.0776, 0.0022, 0.3713},
+    {0.1344, 0.0040, 0.6456}, {0.2148, 0.0073, 1.0391},
+    {0.2839, 0.0116, 1.3856}, {0.3285, 0.0168, 1.6230},
+    {0.3483, 0.0230, 1.7471}, {0.3481, 0.0298, 1.7826},
+    {0.3362, 0.0380, 1.7721}, {0.3187, 0.0480, 1.7441},
+    {0.2908, 0.0600, 1.6692}, {0.2511, 0.0739, 1.5281},
+    {0.1954, 0.0910, 1.2876}, {0.1421, 0.1126, 1.0419},
+    {0.0956, 0.1390, 0.8130}, {0.0580, 0.1693, 0.6162},
+    {0.0320, 0.2080, 0.4652}, {0.0147, 0.2586, 0.3533},
+    {0.0049, 0.3230, 0.2720}, {0.0024, 0.4073, 0.2123},
+    {0.0093, 0.5030, 0.1582}, {0.0291, 0.6082, 0.1117},
+    {0.0633, 0.7100, 0.0782}, {0.1096, 0.7932, 0.0573},
+    {0.1655, 0.8620, 0.0422}, {0.2257, 0.9149, 0.0298},
+    {0.2904, 0.9540, 0.0203}, {0.3597, 0.9803, 0.0134},
+    {0.4334, 0.9950, 0.0087}, {0.5121, 1.0000, 0.0057},
+    {0.5945, 0.9950, 0.0039}, {0.6784, 0.9786, 0.0027},
+    {0.7621, 0.9520, 0.0021}, {0.8425, 0.9154, 0.0018},
+    {0.9163, 0.8700, 0.0017}, {0.9786, 0.8163, 0.0014},
+    {1.0263, 0.7570, 0.0011}, {1.0567, 0.6949, 0.0010},
+    {1.0622, 0.6310, 0.0008}, {1.0456, 0.5668, 0.0006},
+    {1.0026, 0.5030, 0.0003}, {0.9384, 0.4412, 0.0002},
+    {0.8544, 0.3810, 0.0002}, {0.7514, 0.3210, 0.0001},
+    {0.6424, 0.2650, 0.0000}, {0.5419, 0.2170, 0.0000},
+    {0.4479, 0.1750, 0.0000}, {0.3608, 0.1382, 0.0000},
+    {0.2835, 0.1070, 0.0000}, {0.2187, 0.0816, 0.0000},
+    {0.1649, 0.0610, 0.0000}, {0.1212, 0.0446, 0.0000},
+    {0.0874, 0.0320, 0.0000}, {0.0636, 0.0232, 0.0000},
+    {0.0468, 0.0170, 0.0000}, {0.0329, 0.0119, 0.0000},
+    {0.0227, 0.0082, 0.0000}, {0.0158, 0.0057, 0.0000},
+    {0.0114, 0.0041, 0.0000}, {0.0081, 0.0029, 0.0000},
+    {0.0058, 0.0021, 0.0000}, {0.0041, 0.0015, 0.0000},
+    {0.0029, 0.0010, 0.0000}, {0.0020, 0.0007, 0.0000},
+    {0.0014, 0.0005, 0.0000}, {0.0010, 0.0004, 0.0000},
+    {0.0007, 0.0002, 0.0000}, {0.0005, 0.0002, 0.0000},
+    {0.0003, 0.0001, 0.0000}, {0.0002, 0.0001, 0.0000},
+    {0.0002, 0.0001, 0.0000}, {0.0001, 0.0000, 0.0000},
+    {0.0001, 0.0000, 0.0000}, {0.0001, 0.0000, 0.0000},
+    {0.0000, 0.0000, 0.0000}};
+
+/*                          SPECTRUM_TO_XYZ
+
+    Calculate the CIE X, Y, and Z coordinates corresponding to
+    a light source with spectral distribution given by  the
+    function SPEC_INTENS, which is called with a series of
+    wavelengths between 380 and 780 nm (the argument is
+    expressed in meters), which returns emittance at  that
+    wavelength in arbitrary units.  The chromaticity
+    coordinates of the spectrum are returned in the x, y, and z
+    arguments which respect the identity:
+
+            x + y + z = 1.
+*/
+
+void spectrum_to_xyz(double (*spec_intens)(double wavelength), double *x,
+                     double *y, double *z) {
+  int i;
+  double lambda, X = 0, Y = 0, Z = 0, XYZ;
+
+  for (i = 0, lambda = 380; lambda < 780.1; i++, lambda += 5) {
+    double Me;
+
+    Me = (*spec_intens)(lambda);
+    X += Me * cie_colour_match[i][0];
+    Y += Me * cie_colour_match[i][1];
+    Z += Me * cie_colour_match[i][2];
+  }
+  XYZ = (X + Y + Z);
+  *x = X / XYZ;
+  *y = Y / XYZ;
+  *z = Z / XYZ;
+}
+
+/*                            BB_SPECTRUM
+
+    Calculate, by Planck's radiation law, the emittance of a black body
+    of temperature bbTemp at the given wavelength (in metres).  */
+
+double bbTemp = 5000; /* Hidden temperature argument
+                         to BB_SPECTRUM. */
+double bb_spectrum(double wavelength) {
+  double wlm = wavelength * 1e-9; /* Wavelength in meters */
+
+  return (3.74183e-16 * pow(wlm, -5.0)) /
+         (exp(1.4388e-2 / (wlm * bbTemp)) - 1.0);
+}
+double white(double wavelength) { return 1; }
+
+/*                          SPECTRUM_TO_XYZ_ABS
+
+    As spectrum_to_xyz(), but returning X, Y, Z themselves.  For a
+    spectral radiance in W / (sr m^2 m) sampled every 5 nm, Y is
+    the luminance in cd/m^2: 683 lm/W times the sum, times the
+    5e-9 m sample spacing.
+
+*/
+
+void spectrum_to_xyz_abs(double (*spec_intens)(double wavelength), double *X,
+                         double *Y, double *Z) {
+  int i;
+  double lambda;
+
+  *X = *Y = *Z = 0;
+  for (i = 0, lambda = 380; lambda < 780.1; i++, lambda += 5) {
+    double Le = (*spec_intens)(lambda) * (683 * 5e-9);
+
+    *X += Le * cie_colour_match[i][0];
+    *Y += Le * cie_colour_match[i][1];
+    *Z += Le * cie_colour_match[i][2];
+  }
+}
+
+/* bb_spectrum() is exitance; a black body's radiance is that
+   over pi. */
+
+double bb_radiance(double wavelength) { return bb_spectrum(wavelength) / M_PI; }
+
+/*                          XYZ_TO_RGB_MATRIX
+
+    The matrix xyz_to_rgb() applies for colour system CS, as
+    floats, so absolute X, Y, Z can be converted without being
+    reduced to chromaticities first.  With it, the white point at
+    Y = 1 maps to R = G = B = 1.
+
+*/
+
+static void xyz_to_rgb_matrix(struct colourSystem *cs, float m[3][3]) {
+  /* xyz_to_rgb() is linear in x, y, z and already scales each row
+     so the white maps to R = G = B = 1; its columns are the matrix. */
+  for (int k = 0; k < 3; k++) {
+    double e[3] = {0, 0, 0}, r[3];
+
+    e[k] = 1;
+    xyz_to_rgb(cs, e[0], e[1], e[2], &r[0], &r[1], &r[2]);
+    for (int i = 0; i < 3; i++) {
+      m[i][k] = r[i];
+    }
+  }
+}
+
+/*                          TRANSFER FUNCTIONS                      */
+
+/* SMPTE ST 2084 inverse EOTF: absolute luminance over 10000 cd/m^2
+   to signal. */
+
+double pq_encode(double y) {
+  const double m1 = 2610.0 / 16384, m2 = 2523.0 / 4096 * 128,
+               c1 = 3424.0 / 4096, c2 = 2413.0 / 4096 * 32,
+               c3 = 2392.0 / 4096 * 32;
+  double p = pow(y > 0 ? y : 0, m1);
+
+  return pow((c1 + c2 * p) / (1 + c3 * p), m2);
+}
+
+/* BT.2100 HLG OETF: scene light relative to the nominal peak to
+   signal. */
+
+double hlg_encode(double e) {
+  const double a = 0.17883277, b = 1 - 4 * a, c = 0.5 - a * log(4 * a);
+
+  e = e > 0 ? e : 0;
+  return e <= 1.0 / 12 ? sqrt(3 * e) : a * log(12 * e - b) + c;
+}
+
+/* BT.2100 HLG inverse OOTF with black at 0 and a 1000 cd/m^2
+   display: scene light is display light times this gain, for
+   display luminance Y relative to the peak (the OOTF raises scene
+   luminance to the power 1.2, and scales the colour with it). */
+
+double hlg_scene_gain(double y) { return pow(y > 0 ? y : 0, 1 / 1.2 - 1); }
+
+#define LUT_SUB 6 /* log2 of segments per octave */
+#define LUT_MIN_EXP -32
+#define LUT_SEGMENTS (-LUT_MIN_EXP << LUT_SUB)
+
+struct transfer_lut {
+  float v[LUT_SEGMENTS + 2]; /* The last repeats f(1) for lut_eval(1) */
+};
+
+static void lut_build(struct transfer_lut *t, double (*f)(double)) {
+  for (int i = 0; i <= LUT_SEGMENTS; i++) {
+    t->v[i] = f(ldexp(1 + (double)(i & ((1 << LUT_SUB) - 1)) / (1 << LUT_SUB),
+                      LUT_MIN_EXP + (i >> LUT_SUB)));
+  }
+  t->v[LUT_SEGMENTS + 1] = t->v[LUT_SEGMENTS];
+}
+
+/* f(x) for 0 <= x <= 1 from the table; x below 2^-32 counts as
+   2^-32 and x above 1 as 1.  The clamping is done on the float's
+   bits as an integer (negative floats are negative integers), as
+   GCC will not if-convert the float version and then cannot
+   vectorize. */
+
+static inline __attribute__((always_inline)) float
+lut_eval(const float *__restrict v, float x) {
+  const int lo = (127 + LUT_MIN_EXP) << 23, hi = 127 << 23;
+  int bits, seg;
+
+  memcpy(&bits, &x, sizeof bits);
+  bits = bits > lo ? bits : lo;
+  bits = bits < hi ? bits : hi;
+  seg = (bits - lo) >> (23 - LUT_SUB);
+  float f = (bits & ((1 << (23 - LUT_SUB)) - 1)) *
+            (1.0f / (1 << (23 - LUT_SUB)));
+
+  return v[seg] + (v[seg + 1] - v[seg]) * f;
+}
+
+/*                            ENCODERS
+
+    Each takes N pixels of absolute X, Y, Z in cd/m^2.  Colours
+    outside the output primaries are desaturated as by
+    constrain_rgb() for the 10-bit formats; scRGB can hold them
+    as they are.
+
+*/
+
+enum hdr_mode { HDR_PQ10, HDR_HLG10, HDR_F16 };
+
+#define HLG_PEAK 1000.0f /* cd/m^2 that HLG signal 1.0 stands for */
+#define SCRGB_UNIT 80.0f /* cd/m^2 that scRGB 1.0 stands for */
+
+static struct colourSystem Rec2020system = {
+    "Rec. 2020", 0.708, 0.292, 0.170, 0.797, 0.131, 0.046, IlluminantD65,
+    GAMMA_REC709};
+
+struct hdr_encoder {
+  enum hdr_mode mode;
+  float m[3][3]; /* X, Y, Z to linear R, G, B, premultiplied by the
+                    format's 1 / unit */
+  struct transfer_lut lut;
+  struct transfer_lut ootf; /* hlg_scene_gain(), HLG only */
+};
+
+void hdr_init(struct hdr_encoder *e, enum hdr_mode mode) {
+  float unit = mode == HDR_PQ10 ? 10000 : mode == HDR_HLG10 ? HLG_PEAK
+                                                              : SCRGB_UNIT;
+
+  e->mode = mode;
+  xyz_to_rgb_matrix(mode == HDR_F16 ? &Rec709system : &Rec2020system, e->m);
+  for (int i = 0; i < 3; i++) {
+    for (int k = 0; k < 3; k++) {
+      e->m[i][k] /= unit;
+    }
+  }
+  if (mode != HDR_F16) {
+    lut_build(&e->lut, mode == HDR_PQ10 ? pq_encode : hlg_encode);
+  }
+  if (mode == HDR_HLG10) {
+    lut_build(&e->ootf, hlg_scene_gain);
+  }
+}
+
+/* Display luminance of linear Rec. 2020 R, G, B. */
+
+static inline __attribute__((always_inline)) float rec2020_luma(float r,
+                                                                float g,
+                                                                float b) {
+  return 0.2627f * r + 0.6780f * g + 0.0593f * b;
+}
+
+static inline __attribute__((always_inline)) void
+to_rgb(const float m[3][3], const float *xyz, float *r, float *g, float *b) {
+  *r = m[0][0] * xyz[0] + m[0][1] * xyz[1] + m[0][2] * xyz[2];
+  *g = m[1][0] * xyz[0] + m[1][1] * xyz[1] + m[1][2] * xyz[2];
+  *b = m[2][0] * xyz[0] + m[2][1] * xyz[1] + m[2][2] * xyz[2];
+}
+
+/* PQ or HLG, packed as R | G << 10 | B << 20 | 3 << 30, full range.
+   Desaturating, the HLG inverse OOTF and table lookup are separate
+   loops over a block, which keeps each simple enough for GCC to
+   vectorize. */
+
+static void encode_10bit(const struct hdr_encoder *e,
+                         const float *__restrict xyz, int n,
+                         uint32_t *__restrict out) {
+  const float *__restrict v = e->lut.v, *__restrict o = e->ootf.v;
+  float rgb[3 * 256], m[3][3];
+
+  memcpy(m, e->m, sizeof m);
+  for (int base = 0; base < n; base += 256) {
+    int cnt = n - base < 256 ? n - base : 256;
+
+    for (int i = 0; i < cnt; i++) {
+      float r, g, b, w;
+
+      to_rgb(m, &xyz[3 * (base + i)], &r, &g, &b);
+      w = r < g ? r : g;
+      w = w < b ? w : b;
+      w = w < 0 ? w : 0;
+      rgb[3 * i] = r - w;
+      rgb[3 * i + 1] = g - w;
+      rgb[3 * i + 2] = b - w;
+    }
+    if (e->mode == HDR_HLG10) {
+      for (int i = 0; i < cnt; i++) {
+        float s = lut_eval(o, rec2020_luma(rgb[3 * i], rgb[3 * i + 1],
+                                           rgb[3 * i + 2]));
+
+        rgb[3 * i] *= s;
+        rgb[3 * i + 1] *= s;
+        rgb[3 * i + 2] *= s;
+      }
+    }
+    for (int i = 0; i < cnt; i++) {
+      uint32_t cr = (int)(lut_eval(v, rgb[3 * i]) * 1023 + 0.5f);
+      uint32_t cg = (int)(lut_eval(v, rgb[3 * i + 1]) * 1023 + 0.5f);
+      uint32_t cb = (int)(lut_eval(v, rgb[3 * i + 2]) * 1023 + 0.5f);
+
+      out[base + i] = cr | cg << 10 | cb << 20 | 3u << 30;
+    }
+  }
+}
+
+/* IEEE half from float, round to nearest even, for when F16C is not
+   available. */
+
+static uint16_t float_to_half(float f) {
+  uint32_t x, sign, mant;
+  int exp;
+
+  memcpy(&x, &f, sizeof x);
+  sign = (x >> 16) & 0x8000;
+  exp = (int)((x >> 23) & 0xff) - 127 + 15;
+  mant = x & 0x7fffff;
+
+  if (exp >= 31) {
+    /* Overflow to infinity; NaN stays NaN. */
+    return sign | 0x7c00 | (((x >> 23) & 0xff) == 0xff && mant ? 0x200 : 0);
+  }
+  if (exp <= 0) {
+    if (exp < -10) {
+      return sign;
+    }
+    mant |= 0x800000;
+    int shift = 14 - exp;
+    uint32_t h = mant >> shift, rest = mant & ((1u << shift) - 1),
+             half = 1u << (shift - 1);
+
+    h += rest > half || (rest == half && (h & 1));
+    return sign | h;
+  }
+
+  uint32_t h = (exp << 10) | (mant >> 13), rest = mant & 0x1fff;
+
+  h += rest > 0x1000 || (rest == 0x1000 && (h & 1));
+  return sign | h; /* A carry out of the mantissa bumps the exponent */
+}
+
+/* Linear scRGB, R, G, B, A = 1 as halves. */
+
+static void encode_f16(const struct hdr_encoder *e,
+                       const float *__restrict xyz, int n,
+                       uint16_t *__restrict out) {
+  float rgba[4 * 256], m[3][3];
+
+  memcpy(m, e->m, sizeof m);
+  for (int base = 0; base < n; base += 256) {
+    int cnt = n - base < 256 ? n - base : 256;
+
+    for (int i = 0; i < cnt; i++) {
+      to_rgb(m, &xyz[3 * (base + i)], &rgba[4 * i], &rgba[4 * i + 1],
+             &rgba[4 * i + 2]);
+      rgba[4 * i + 3] = 1;
+    }
+
+    uint16_t *o = out + 4 * base;
+    int k = 0;
+#ifdef __F16C__
+    for (; k + 8 <= 4 * cnt; k += 8) {
+      __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(&rgba[k]),
+                                  _MM_FROUND_TO_NEAREST_INT);
+      _mm_storeu_si128((__m128i *)&o[k], h);
+    }
+#endif
+    for (; k < 4 * cnt; k++) {
+      o[k] = float_to_half(rgba[k]);
+    }
+  }
+}
+
+/* OUT gets N uint32_t for the 10-bit modes, 4 N uint16_t for f16. */
+
+void hdr_encode(const struct hdr_encoder *e, const float *xyz, int n,
+                void *out) {
+  if (e->mode == HDR_F16) {
+    encode_f16(e, xyz, n, (uint16_t *)out);
+  } else {
+    encode_10bit(e, xyz, n, (uint32_t *)out);
+  }
+}
+
+/*                          BUILT-IN TEST                           */
+
+static double now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Largest table error, in 10-bit code values, over a log sweep. */
+
+static double lut_error(const struct transfer_lut *t, double (*f)(double)) {
+  double worst = 0;
+
+  for (double x = 1e-9; x <= 1; x *= 1.0001) {
+    double d = fabs(lut_eval(t->v, (float)x) - f(x)) * 1023;
+
+    worst = d > worst ? d : worst;
+  }
+  return worst;
+}
+
+int main(int argc, char **argv) {
+  static const char *names[] = {"pq10", "hlg10", "f16"};
+  static const double temps[] = {1000, 1500, 2000, 3000, 4000,
+                                 5000, 6500, 9000, 12000};
+  enum hdr_mode mode = HDR_PQ10;
+  static struct hdr_encoder enc;
+  double X, Y, Z, exposure;
+  int failed = 0;
+
+  for (int i = 0; i < 3 && argc > 1; i++) {
+    if (strcmp(argv[1], names[i]) == 0) {
+      mode = (enum hdr_mode)i;
+      break;
+    } else if (i == 2) {
+      fprintf(stderr, "Usage: hdr_output [pq10 | hlg10 | f16]\n");
+      return 2;
+    }
+  }
+  hdr_init(&enc, mode);
+
+  bbTemp = 6500;
+  spectrum_to_xyz_abs(bb_radiance, &X, &Y, &Z);
+  exposure = 203 / Y;
+
+  printf("Black bodies, 6500 K exposed to 203 cd/m^2, %s:\n\n", names[mode]);
+  printf("  Temp      cd/m^2   R      G      B\n");
+  for (size_t i = 0; i < sizeof temps / sizeof temps[0]; i++) {
+    float xyz[3];
+    uint32_t word;
+    uint16_t half[4];
+
+    bbTemp = temps[i];
+    spectrum_to_xyz_abs(bb_radiance, &X, &Y, &Z);
+    xyz[0] = X * exposure;
+    xyz[1] = Y * exposure;
+    xyz[2] = Z * exposure;
+    printf("  %5.0f K  %9.3f", bbTemp, xyz[1]);
+    if (mode == HDR_F16) {
+      hdr_encode(&enc, xyz, 1, half);
+      printf("   %04x   %04x   %04x\n", half[0], half[1], half[2]);
+    } else {
+      hdr_encode(&enc, xyz, 1, &word);
+      printf("   %4u   %4u   %4u\n", word & 1023, word >> 10 & 1023,
+             word >> 20 & 1023);
+    }
+  }
+
+  if (mode != HDR_F16) {
+    printf("\nTable error: %.3f code values at most\n",
+           lut_error(&enc.lut, mode == HDR_PQ10 ? pq_encode : hlg_encode));
+  }
+
+  /* BT.2408: HLG reference white, 203 cd/m^2 on a 1000 cd/m^2
+     display, is a 75% signal, code 767.  D65 white must get it in
+     every channel.  The 6500 K body is a little off D65, so its
+     channels spread a few codes either side; their luma must get
+     it. */
+  if (mode == HDR_HLG10) {
+    float xyz[2][3] = {{203 * 0.3127f / 0.3291f, 203,
+                        203 * (1 - 0.3127f - 0.3291f) / 0.3291f}};
+    uint32_t word[2];
+    int code[2][3];
+
+    bbTemp = 6500;
+    spectrum_to_xyz_abs(bb_radiance, &X, &Y, &Z);
+    xyz[1][0] = X * exposure;
+    xyz[1][1] = Y * exposure;
+    xyz[1][2] = Z * exposure;
+    hdr_encode(&enc, xyz[0], 2, word);
+    for (int k = 0; k < 2; k++) {
+      for (int c = 0; c < 3; c++) {
+        code[k][c] = word[k] >> 10 * c & 1023;
+      }
+    }
+    for (int c = 0; c < 3; c++) {
+      failed |= abs(code[0][c] - 767) > 1;
+    }
+    failed |= fabs(rec2020_luma(code[1][0], code[1][1], code[1][2]) - 767) > 1;
+    printf("Reference white: D65 %d %d %d, 6500 K %d %d %d; 767 +/- 1 %s\n",
+           code[0][0], code[0][1], code[0][2], code[1][0], code[1][1],
+           code[1][2], failed ? "FAILED" : "ok");
+  }
+
+  /* A 4K frame spread over 0.001 .. 4000 cd/m^2. */
+  int n = 3840 * 2160;
+  float *frame = (float *)malloc(3 * n * sizeof(float));
+  void *out = malloc(8 * (size_t)n);
+  double t0, t_lut, t_pow;
+
+  srand(1);
+  for (int i = 0; i < n; i++) {
+    float y = 0.001f * powf(4e6f, rand() / (float)RAND_MAX);
+
+    frame[3 * i] = y * (0.8f + 0.4f * rand() / RAND_MAX);
+    frame[3 * i + 1] = y;
+    frame[3 * i + 2] = y * (0.6f + 0.8f * rand() / RAND_MAX);
+  }
+
+  t0 = now_ns();
+  for (int rep = 0; rep < 10; rep++) {
+    hdr_encode(&enc, frame, n, out);
+  }
+  t_lut = (now_ns() - t0) / (10.0 * n);
+
+  /* The same with the exact transfer function per channel. */
+  t0 = now_ns();
+  if (mode != HDR_F16) {
+    double (*f)(double) = mode == HDR_PQ10 ? pq_encode : hlg_encode;
+    uint32_t *o = (uint32_t *)out;
+
+    for (int i = 0; i < n; i++) {
+      float r, g, b;
+
+      to_rgb(enc.m, &frame[3 * i], &r, &g, &b);
+      if (mode == HDR_HLG10) {
+        double s = hlg_scene_gain(rec2020_luma(r, g, b));
+
+        r *= s;
+        g *= s;
+        b *= s;
+      }
+      o[i] = (uint32_t)(f(r) * 1023 + 0.5) |
+             (uint32_t)(f(g) * 1023 + 0.5) << 10 |
+             (uint32_t)(f(b) * 1023 + 0.5) << 20 | 3u << 30;
+    }
+  }
+  t_pow = (now_ns() - t0) / n;
+
+  printf("\n3840x2160 frame: %.2f ns/pixel", t_lut);
+  if (mode != HDR_F16) {
+    printf(" (%.1f ns/pixel with pow() per channel)", t_pow);
+  }
+  printf("\n");
+
+  free(frame);
+  free(out);
+  return failed;
+}
@@ -0,0 +1,361 @@
+/*
+              Dithering for low bit depth LED output
+
+    The programs here turn colours into bytes with (int)(r * 255),
+    which bands visibly in slow black body fades and at the dim
+    end of the rainbow, where one code step is a large fraction of
+    the light.  This is the quantization stage for 8-bit and
+    narrower LED drivers, fused with gamma correction so it is one
+    pass over the frame:
+
+        linear float  ->  Rec. 709 gamma (table)  ->  + dither
+                      ->  code 0 .. 2^bits - 1
+
+    and four ways of choosing the code:
+
+        round     plain rounding, what the programs do now
+        temporal  error diffusion from frame to frame: every LED
+                  channel keeps the rounding error it made last
+                  frame and adds it in this frame, so the average
+                  over frames is exact
+        bayer     ordered dithering with a 1-D Bayer threshold
+                  (bit reversed index) along the strip
+        blue      ordered dithering with a 1-D blue noise mask
+                  made by void and cluster at start-up
+
+    The ordered masks are shifted by the golden ratio every frame,
+    so they dither in time as well as along the strip.  Each mode
+    has its own loop so every one of them vectorizes.
+
+    Build:  g++ -O3 -march=native led_dither.c -o led_dither
+
+    The built-in test shows a slow dim ramp over 100000 LEDs for
+    256 frames at 8 and 5 bits and reports, per mode, how far the
+    time-averaged output is from the exact value and the cost per
+    LED.
+
+    The gamma code is copied from color_temp.c (John Walker,
+    public domain; see that file for the full credits).
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* A colour system is defined by the CIE x and y coordinates of
+   its three primary illuminants and the x and y coordinates of
+   the white point. */
+
+struct colourSystem {
+  char *name;         /* Colour system name */
+  double xRed, yRed,  /* Red x, y */
+      xGreen, yGreen, /* Green x, y */
+      xBlue, yBlue,   /* Blue x, y */
+      xWhite, yWhite, /* White point x, y */
+      gamma;          /* Gamma correction for system */
+};
+
+/* White point chromaticities. */
+
+#define IlluminantC 0.3101, 0.3162         /* For NTSC television */
+#define IlluminantD65 0.3127, 0.3291       /* For EBU and SMPTE */
+#define IlluminantE 0.33333333, 0.33333333 /* CIE equal-energy illuminant */
+
+/*  Gamma of nonlinear correction.
+
+    See Charles Poynton's ColorFAQ Item 45 and GammaFAQ Item 6 at:
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+
+*/
+
+#define GAMMA_REC709 0 /* Rec. 709 */
+
+static struct colourSystem
+    /* Name                  xRed    yRed    xGreen  yGreen  xBlue  yBlue White
+       point        Gamma   */
+    NTSCsystem = {"NTSC", 0.67, 0.33,        0.21,        0.71,
+                  0.14,   0.08, IlluminantC, GAMMA_REC709},
+    EBUsystem = {"EBU (PAL/SECAM)", 0.64,        0.33, 0.29, 0.60, 0.15, 0.06,
+                 IlluminantD65,     GAMMA_REC709},
+    SMPTEsystem = {"SMPTE", 0.630, 0.340,         0.310,       0.595,
+                   0.155,   0.070, IlluminantD65, GAMMA_REC709},
+    HDTVsystem = {"HDTV", 0.670, 0.330,         0.210,       0.710,
+                  0.150,  0.060, IlluminantD65, GAMMA_REC709},
+    CIEsystem = {"CIE",  0.7355, 0.2645,      0.2658,      0.7243,
+                 0.1669, 0.0085, IlluminantE, GAMMA_REC709},
+    Rec709system = {"CIE REC 709", 0.64, 0.33,          0.30,        0.60,
+                    0.15,          0.06, IlluminantD65, GAMMA_REC709};
+
+/*                          GAMMA_CORRECT_RGB
+
+    Transform linear RGB values to nonlinear RGB values. Rec.
+    709 is ITU-R Recommendation BT. 709 (1990) ``Basic
+    Parameter Values for the HDTV Standard for the Studio and
+    for International Programme Exchange'', formerly CCIR Rec.
+    709. For details see
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+*/
+
+void gamma_correct(const struct colourSystem *cs, double *c) {
+  double gamma;
+
+  gamma = cs->gamma;
+
+  if (gamma == GAMMA_REC709) {
+    /* Rec. 709 gamma correction. */
+    double cc = 0.018;
+
+    if (*c < cc) {
+      *c *= ((1.099 * pow(cc, 0.45)) - 0.099) / cc;
+    } else {
+      *c = (1.099 * pow(*c, 0.45)) - 0.099;
+    }
+  } else {
+    /* Nonlinear colour = (Linear colour)^(1/gamma) */
+    *c = pow(*c, 1.0 / gamma);
+  }
+}
+
+void gamma_correct_rgb(const struct colourSystem *cs, double *r, double *g,
+                       double *b) {
+  gamma_correct(cs, r);
+  gamma_correct(cs, g);
+  gamma_correct(cs, b);
+}
+
+
+/*                          DITHER STATE                            */
+
+#define GAMMA_TABLE 1024 /* Entries over linear 0..1, plus one */
+#define MASK_SIZE 256    /* Ordered mask length, a power of two */
+#define GOLDEN 0.61803398875f
+
+enum dither_mode { DITHER_ROUND, DITHER_TEMPORAL, DITHER_BAYER, DITHER_BLUE };
+
+struct dither {
+  enum dither_mode mode;
+  int bits;     /* Output depth, 1..8 */
+  int channels; /* Size of err[] */
+  long frame;
+  float *err; /* Carried rounding error per channel, temporal mode */
+  float gamma[GAMMA_TABLE + 1];
+  float mask[MASK_SIZE]; /* Thresholds in [0, 1) */
+};
+
+/* 1-D void and cluster: each new point goes where the points already
+   placed are thinnest, measured by a circular Gaussian filter; the
+   order of placement is the threshold rank. */
+
+static void blue_noise_mask(float *mask) {
+  static float energy[MASK_SIZE], kernel[MASK_SIZE];
+  static unsigned char taken[MASK_SIZE];
+
+  for (int i = 0; i < MASK_SIZE; i++) {
+    int d = i < MASK_SIZE / 2 ? i : MASK_SIZE - i;
+
+    kernel[i] = expf(-d * d / (2 * 1.5f * 1.5f));
+    energy[i] = 0;
+    taken[i] = 0;
+  }
+  for (int rank = 0; rank < MASK_SIZE; rank++) {
+    int best = 0;
+
+    for (int i = 1; i < MASK_SIZE; i++) {
+      if (!taken[i] && (taken[best] || energy[i] < energy[best])) {
+        best = i;
+      }
+    }
+    taken[best] = 1;
+    mask[best] = (rank + 0.5f) / MASK_SIZE;
+    for (int i = 0; i < MASK_SIZE; i++) {
+      energy[i] += kernel[(i - best) & (MASK_SIZE - 1)];
+    }
+  }
+}
+
+static void bayer_mask(float *mask) {
+  for (int i = 0; i < MASK_SIZE; i++) {
+    int r = 0;
+
+    for (int b = 1, v = i; b < MASK_SIZE; b <<= 1, v >>= 1) {
+      r = r << 1 | (v & 1);
+    }
+    mask[i] = (r + 0.5f) / MASK_SIZE;
+  }
+}
+
+void dither_init(struct dither *d, struct colourSystem *cs,
+                 enum dither_mode mode, int bits, int channels) {
+  d->mode = mode;
+  d->bits = bits;
+  d->channels = channels;
+  d->frame = 0;
+  d->err = (float *)calloc(channels, sizeof(float));
+  for (int i = 0; i <= GAMMA_TABLE; i++) {
+    double c = (double)i / GAMMA_TABLE;
+
+    gamma_correct(cs, &c);
+    d->gamma[i] = c;
+  }
+  if (mode == DITHER_BLUE) {
+    blue_noise_mask(d->mask);
+  } else {
+    bayer_mask(d->mask);
+  }
+}
+
+/*                          DITHER_FRAME
+
+    Quantize the N linear channel values LIN of the next frame into
+    OUT.  Values outside 0..1 are clamped to it; in temporal mode
+    they would otherwise wind up the carried error without limit
+    and hold the output at an extreme code long after the input
+    came back.
+
+    The loops stay free of floating point compares: with the
+    default -ftrapping-math GCC will not turn those into selects,
+    and a branch stops vectorization.  Clamping is done on the
+    integer table index and code instead, and the ordered
+    thresholds for the frame are shifted once, before the loop.
+
+*/
+
+/* Gamma encoded value of linear X, clamped to 0..1, scaled to code
+   units.  The clamp compares the bit pattern as an int, which orders
+   like the float for x >= 0 and is negative for x < 0; NaN comes out
+   as 1. */
+
+static inline __attribute__((always_inline)) float
+encode(const float *__restrict gamma, float x, float levels) {
+  int bits;
+
+  memcpy(&bits, &x, sizeof bits);
+  bits = bits > 0 ? bits : 0;
+  bits = bits < 0x3F800000 ? bits : 0x3F800000;
+  memcpy(&x, &bits, sizeof x);
+  x *= GAMMA_TABLE;
+  int j = (int)x;
+  j = j > 0 ? j : 0;
+  j = j < GAMMA_TABLE - 1 ? j : GAMMA_TABLE - 1;
+  float f = x - j;
+
+  return (gamma[j] + (gamma[j + 1] - gamma[j]) * f) * levels;
+}
+
+static inline __attribute__((always_inline)) int clamp_code(int q,
+                                                            int levels) {
+  q = q > 0 ? q : 0;
+  return q < levels ? q : levels;
+}
+
+void dither_frame(struct dither *d, const float *__restrict lin, int n,
+                  unsigned char *__restrict out) {
+  const float *__restrict gamma = d->gamma;
+  int levels = (1 << d->bits) - 1;
+  float *__restrict err = d->err;
+
+  switch (d->mode) {
+  case DITHER_ROUND:
+    for (int i = 0; i < n; i++) {
+      out[i] = clamp_code((int)(encode(gamma, lin[i], levels) + 0.5f), levels);
+    }
+    break;
+
+  case DITHER_TEMPORAL:
+    for (int i = 0; i < n; i++) {
+      float v = encode(gamma, lin[i], levels) + err[i];
+      int q = clamp_code((int)(v + 0.5f), levels);
+
+      err[i] = v - q;
+      out[i] = q;
+    }
+    break;
+
+  case DITHER_BAYER:
+  case DITHER_BLUE: {
+    float thr[MASK_SIZE], shift = d->frame * GOLDEN;
+
+    shift -= (int)shift;
+    for (int k = 0; k < MASK_SIZE; k++) {
+      thr[k] = d->mask[k] + shift;
+      thr[k] -= thr[k] >= 1;
+    }
+    for (int i = 0; i < n; i++) {
+      float v = encode(gamma, lin[i], levels) + thr[i & (MASK_SIZE - 1)];
+
+      out[i] = clamp_code((int)v, levels);
+    }
+    break;
+  }
+  }
+  d->frame++;
+}
+
+/*                          BUILT-IN TEST                           */
+
+static double now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main() {
+  static const char *names[] = {"round", "temporal", "bayer", "blue"};
+  const int leds = 100000, n = 3 * leds, frames = 256;
+  struct colourSystem *cs = &SMPTEsystem;
+  float *lin = (float *)malloc(n * sizeof(float));
+  double *sum = (double *)malloc(n * sizeof(double));
+  unsigned char *out = (unsigned char *)malloc(n);
+
+  /* A dim ramp, the bottom 2% of linear light, on every channel. */
+  for (int i = 0; i < n; i++) {
+    lin[i] = 0.02f * (i / 3) / (leds - 1);
+  }
+
+  /* Errors are of the average over all frames, in code steps. */
+  printf("bits  mode      rms err  max err  ns/LED\n");
+  for (int bits = 8; bits >= 5; bits -= 3) {
+    double levels = (1 << bits) - 1;
+
+    for (int mode = DITHER_ROUND; mode <= DITHER_BLUE; mode++) {
+      struct dither d;
+      double rms = 0, worst = 0, t0, t = 0;
+
+      dither_init(&d, cs, (enum dither_mode)mode, bits, n);
+      memset(sum, 0, n * sizeof(double));
+      for (int f = 0; f < frames; f++) {
+        t0 = now_ns();
+        dither_frame(&d, lin, n, out);
+        t += now_ns() - t0;
+        for (int i = 0; i < n; i++) {
+          sum[i] += out[i];
+        }
+      }
+
+      /* Compare the average over all frames with the exact code. */
+      for (int i = 0; i < n; i++) {
+        double c = lin[i], e;
+
+        gamma_correct(cs, &c);
+        e = fabs(sum[i] / frames - c * levels);
+        rms += e * e;
+        worst = e > worst ? e : worst;
+      }
+      printf("%4d  %-8s  %7.4f  %7.4f  %6.2f\n", bits, names[mode],
+             sqrt(rms / n), worst, t / frames / leds);
+      free(d.err);
+    }
+  }
+
+  free(lin);
+  free(sum);
+  free(out);
+  return 0;
+}
@@ -0,0 +1,408 @@
+/*
+                  LED strip frame generator
+
+    Renders the rainbow from rainbow.c onto many LED strips at
+    once and publishes the result as packed binary frames, the
+    way the strip drivers want them: one byte per channel in the
+    strip's own colour order (RGB, GRB, BGR, RGBW or GRBW), strips
+    laid out back to back.
+
+    Frames are rendered into two cache-aligned buffers.  A
+    background thread renders frame N+1 while the main thread
+    hands frame N to the output, so transmission and rendering
+    overlap.
+
+    Build:  g++ -O3 -march=native -pthread led_frames.c -o led_frames
+
+    Usage:  led_frames [-n frames] [-s len,speed,shift,order,bright]...
+                       [file:PATH | fifo:PATH | shm:NAME | -]
+
+    Each -s adds one strip: LED count, spatial speed (radians per
+    LED, as in print_rainbow), shift advanced per frame (radians),
+    colour order and brightness 0..255.  Without -s a demo set of
+    64 strips of 4096 LEDs is used.  The output defaults to stdout.
+
+    For shm: the segment starts with a struct shm_header; readers
+    wait for an even seq, copy the frame and accept it if seq is
+    unchanged.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_LINE 64
+#define MAX_STRIPS 1024
+
+enum colour_order { ORDER_RGB, ORDER_GRB, ORDER_BGR, ORDER_RGBW, ORDER_GRBW };
+
+struct strip {
+  int length;              /* Number of LEDs */
+  float speed;             /* Radians per LED */
+  float shift;             /* Radians added every frame */
+  enum colour_order order; /* Byte order on the wire */
+  int brightness;          /* 0..255 */
+  size_t offset;           /* Byte offset of this strip in a frame */
+};
+
+struct shm_header {
+  uint64_t seq;         /* Odd while a frame is being copied in */
+  uint64_t frame_bytes; /* Size of the frame following the header */
+};
+
+static struct strip strips[MAX_STRIPS];
+static int nstrips;
+static size_t frame_bytes;
+
+static int order_channels(enum colour_order order) {
+  return (order == ORDER_RGBW || order == ORDER_GRBW) ? 4 : 3;
+}
+
+static int parse_order(const char *s, enum colour_order *order) {
+  static const char *names[] = {"RGB", "GRB", "BGR", "RGBW", "GRBW"};
+
+  for (int i = 0; i < 5; i++) {
+    if (strcmp(s, names[i]) == 0) {
+      *order = (enum colour_order)i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Lay the strips out back to back and work out the frame size. */
+
+static void layout_strips() {
+  frame_bytes = 0;
+  for (int i = 0; i < nstrips; i++) {
+    strips[i].offset = frame_bytes;
+    frame_bytes += (size_t)strips[i].length * order_channels(strips[i].order);
+  }
+}
+
+/*                          RENDER_STRIP
+
+    Same colours as print_rainbow(): each channel is
+    (sin(speed * i + phase + shift) + 1) * 127, with phases 0,
+    2pi/3 and 4pi/3.  Instead of three sin() calls per LED the
+    three phasors are rotated by speed radians per LED; they are
+    re-seeded from sin/cos every 256 LEDs so rounding error
+    cannot build up along long strips.
+
+*/
+
+static void render_strip(const struct strip *s, double shift,
+                         unsigned char *out) {
+  int nch = order_channels(s->order);
+  float scale = 127.0f * s->brightness / 255.0f;
+  float cs = cosf(s->speed), sn = sinf(s->speed);
+
+  for (int base = 0; base < s->length; base += 256) {
+    int end = base + 256 < s->length ? base + 256 : s->length;
+    float re[3], im[3];
+
+    for (int c = 0; c < 3; c++) {
+      double a = s->speed * (double)base + c * (2 * M_PI / 3) + shift;
+      re[c] = (float)cos(a);
+      im[c] = (float)sin(a);
+    }
+
+    for (int i = base; i < end; i++) {
+      int v[3], w = 0;
+      unsigned char *p = out + (size_t)i * nch;
+
+      for (int c = 0; c < 3; c++) {
+        float t = re[c] * sn + im[c] * cs;
+
+        v[c] = (int)((im[c] + 1) * scale);
+        re[c] = re[c] * cs - im[c] * sn;
+        im[c] = t;
+      }
+
+      if (nch == 4) {
+        /* Move the common part of r, g and b to the white LED. */
+        w = v[0] < v[1] ? v[0] : v[1];
+        w = w < v[2] ? w : v[2];
+        v[0] -= w;
+        v[1] -= w;
+        v[2] -= w;
+      }
+
+      switch (s->order) {
+      case ORDER_RGB:
+      case ORDER_RGBW:
+        p[0] = v[0];
+        p[1] = v[1];
+        p[2] = v[2];
+        break;
+      case ORDER_GRB:
+      case ORDER_GRBW:
+        p[0] = v[1];
+        p[1] = v[0];
+        p[2] = v[2];
+        break;
+      case ORDER_BGR:
+        p[0] = v[2];
+        p[1] = v[1];
+        p[2] = v[0];
+        break;
+      }
+      if (nch == 4) {
+        p[3] = w;
+      }
+    }
+  }
+}
+
+static void render_frame(long frame, unsigned char *buf) {
+  for (int i = 0; i < nstrips; i++) {
+    render_strip(&strips[i], fmod((double)strips[i].shift * frame, 2 * M_PI),
+                 buf + strips[i].offset);
+  }
+}
+
+/*                            OUTPUT
+
+    A frame is published either by write() to a file, FIFO or
+    stdout, or by copying it into a shared memory segment under a
+    sequence lock.
+
+*/
+
+struct output {
+  int fd;
+  struct shm_header *shm; /* Non-null for shm: outputs */
+  unsigned char *shm_frame;
+};
+
+static int open_output(const char *spec, struct output *o) {
+  o->fd = -1;
+  o->shm = NULL;
+
+  if (strcmp(spec, "-") == 0) {
+    o->fd = STDOUT_FILENO;
+  } else if (strncmp(spec, "file:", 5) == 0) {
+    o->fd = open(spec + 5, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  } else if (strncmp(spec, "fifo:", 5) == 0) {
+    if (mkfifo(spec + 5, 0644) < 0 && errno != EEXIST) {
+      return 0;
+    }
+    o->fd = open(spec + 5, O_WRONLY); /* Blocks until a reader opens it */
+  } else if (strncmp(spec, "shm:", 4) == 0) {
+    size_t size = sizeof(struct shm_header) + frame_bytes;
+    int fd = shm_open(spec + 4, O_RDWR | O_CREAT, 0644);
+    void *p;
+
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+      return 0;
+    }
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      return 0;
+    }
+    o->shm = (struct shm_header *)p;
+    o->shm_frame = (unsigned char *)p + sizeof(struct shm_header);
+    o->shm->frame_bytes = frame_bytes;
+    return 1;
+  }
+  return o->fd >= 0;
+}
+
+static int publish(struct output *o, const unsigned char *buf) {
+  if (o->shm) {
+    uint64_t seq = __atomic_load_n(&o->shm->seq, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&o->shm->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(o->shm_frame, buf, frame_bytes);
+    __atomic_store_n(&o->shm->seq, seq + 2, __ATOMIC_RELEASE);
+    return 1;
+  }
+
+  for (size_t done = 0; done < frame_bytes;) {
+    ssize_t n = write(o->fd, buf + done, frame_bytes - done);
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    }
+    done += n;
+  }
+  return 1;
+}
+
+/*                          DOUBLE BUFFER
+
+    ready[k] is set by the renderer once buffer k holds a frame and
+    cleared by the publisher once it has been sent.  The renderer
+    fills buffers alternately, so while one is being sent the next
+    frame is rendered into the other.
+
+*/
+
+static unsigned char *buffers[2];
+static int ready[2];
+static int stop;
+static long nframes = 1000;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+
+static void *render_thread(void *arg) {
+  for (long frame = 0; frame < nframes; frame++) {
+    int k = frame & 1, quit;
+
+    pthread_mutex_lock(&lock);
+    while (ready[k] && !stop) {
+      pthread_cond_wait(&changed, &lock);
+    }
+    quit = stop;
+    pthread_mutex_unlock(&lock);
+    if (quit) {
+      break;
+    }
+
+    render_frame(frame, buffers[k]);
+
+    pthread_mutex_lock(&lock);
+    ready[k] = 1;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+  }
+  return NULL;
+}
+
+static int usage() {
+  fprintf(stderr,
+          "Usage: led_frames [-n frames] [-s len,speed,shift,order,bright]...\n"
+          "                  [file:PATH | fifo:PATH | shm:NAME | -]\n");
+  return 2;
+}
+
+static double now_s() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+  const char *spec = "-";
+  struct output out;
+  pthread_t renderer;
+  long sent = 0;
+  size_t leds = 0;
+  double t0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0) {
+      char *end;
+
+      if (i + 1 == argc) {
+        return usage();
+      }
+      nframes = strtol(argv[++i], &end, 10);
+      if (end == argv[i] || *end || nframes <= 0) {
+        fprintf(stderr, "bad frame count: %s\n", argv[i]);
+        return usage();
+      }
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      struct strip *s = &strips[nstrips];
+      char order[8];
+
+      if (nstrips == MAX_STRIPS ||
+          sscanf(argv[++i], "%d,%f,%f,%7[A-Z],%d", &s->length, &s->speed,
+                 &s->shift, order, &s->brightness) != 5 ||
+          !parse_order(order, &s->order) || s->length <= 0 ||
+          s->brightness < 0 || s->brightness > 255) {
+        fprintf(stderr, "bad strip: %s\n", argv[i]);
+        return 1;
+      }
+      nstrips++;
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      return usage();
+    } else {
+      spec = argv[i];
+    }
+  }
+
+  if (nstrips == 0) {
+    for (; nstrips < 64; nstrips++) {
+      struct strip *s = &strips[nstrips];
+
+      s->length = 4096;
+      s->speed = 0.1f;
+      s->shift = 0.01f * (1 + nstrips % 4);
+      s->order = (nstrips & 1) ? ORDER_GRBW : ORDER_GRB;
+      s->brightness = 255 - 2 * nstrips;
+    }
+  }
+  layout_strips();
+  for (int i = 0; i < nstrips; i++) {
+    leds += strips[i].length;
+  }
+
+  if (!open_output(spec, &out)) {
+    perror(spec);
+    return 1;
+  }
+
+  /* Round up so aligned_alloc() accepts the size. */
+  for (int k = 0; k < 2; k++) {
+    buffers[k] = (unsigned char *)aligned_alloc(
+        CACHE_LINE, (frame_bytes + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1));
+    if (!buffers[k]) {
+      fprintf(stderr, "cannot allocate %zu byte frame buffers\n",
+              frame_bytes);
+      return 1;
+    }
+  }
+
+  t0 = now_s();
+  pthread_create(&renderer, NULL, render_thread, NULL);
+
+  for (long frame = 0; frame < nframes; frame++) {
+    int k = frame & 1, ok;
+
+    pthread_mutex_lock(&lock);
+    while (!ready[k]) {
+      pthread_cond_wait(&changed, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+
+    ok = publish(&out, buffers[k]);
+
+    pthread_mutex_lock(&lock);
+    ready[k] = 0;
+    stop = !ok;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    if (!ok) {
+      perror("publish");
+      break;
+    }
+    sent++;
+  }
+
+  pthread_join(renderer, NULL);
+  t0 = now_s() - t0;
+  fprintf(stderr, "%d strips, %zu LEDs, %zu bytes/frame: %ld frames in %.3f s"
+                  " (%.1f fps, %.1f MB/s)\n",
+          nstrips, leds, frame_bytes, sent, t0, sent / t0,
+          sent * frame_bytes / t0 / 1e6);
+
+  free(buffers[0]);
+  free(buffers[1]);
+  return 0;
+}
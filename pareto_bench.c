@@ -0,0 +1,1253 @@
+/*
+             Accuracy against speed for the fast paths
+
+    The programs here have grown faster versions of the original
+    colour code: float arithmetic, tables of black body colours and
+    gamma curves, an analytic fit of the colour matching functions,
+    exp() from bit tricks, and a model of fixed point arithmetic.
+    Each trades some accuracy
+    for its speed.  This harness measures both sides of the trade
+    against the original double precision spectrum_to_xyz(),
+    xyz_to_rgb() and gamma_correct() over three dense sweeps:
+
+        cct         black bodies, 1000 to 40000 K in 1 K steps
+        wavelength  spectral colours, 380 to 780 nm in 0.01 nm steps
+        xyz         100000 random X, Y, Z in [0, 1)
+
+    Every path ends in gamma corrected, constrained and normalised
+    R, G, B, as the original programs draw them.  To score a path,
+    both its output and the reference's are decoded back to linear
+    light and X, Y, Z, and compared as CIEDE2000 and as distance in
+    the CIE 1976 u', v' plane.  The report gives ns per colour next
+    to the max and mean of both errors, with the input where the
+    worst error happened, as a table and optionally as CSV.  A star
+    marks the paths on the Pareto front of a sweep: no other path
+    is both faster and has a smaller max Delta E.
+
+    Each path has an error budget, max Delta E 2000 and max Delta
+    u'v'.  A path over either budget on any sweep fails, and the
+    program then exits with status 1.  As shipped, cmf_fit fails
+    the wavelength sweep; see PATH TABLE.  A path can also claim a
+    part of a sweep where it is meant to be used, and is then scored
+    there as well, in a note after the table; the claim does not
+    change whether it passes.
+
+    Build:  g++ -O3 -march=native pareto_bench.c -o pareto_bench
+
+    Usage:  pareto_bench [-o CSV] [-b NAME=DE,DUV]...
+
+    -o writes the CSV to the file CSV ("-" for standard output).
+    -b replaces the budget of path NAME.
+
+    The colour code is copied from color_temp.c (John Walker,
+    public domain; see that file for the full credits).
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* A colour system is defined by the CIE x and y coordinates of
+   its three primary illuminants and the x and y coordinates of
+   the white point. */
+
+struct colourSystem {
+  char *name;         /* Colour system name */
+  double xRed, yRed,  /* Red x, y */
+      xGreen, yGreen, /* Green x, y */
+      xBlue, yBlue,   /* Blue x, y */
+      xWhite, yWhite, /* White point x, y */
+      gamma;          /* Gamma correction for system */
+};
+
+/* White point chromaticities. */
+
+#define IlluminantC 0.3101, 0.3162         /* For NTSC television */
+#define IlluminantD65 0.3127, 0.3291       /* For EBU and SMPTE */
+#define IlluminantE 0.33333333, 0.33333333 /* CIE equal-energy illuminant */
+
+/*  Gamma of nonlinear correction.
+
+    See Charles Poynton's ColorFAQ Item 45 and GammaFAQ Item 6 at:
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+
+*/
+
+#define GAMMA_REC709 0 /* Rec. 709 */
+
+static struct colourSystem
+    /* Name                  xRed    yRed    xGreen  yGreen  xBlue  yBlue White
+       point        Gamma   */
+    NTSCsystem = {"NTSC", 0.67, 0.33,        0.21,        0.71,
+                  0.14,   0.08, IlluminantC, GAMMA_REC709},
+    EBUsystem = {"EBU (PAL/SECAM)", 0.64,        0.33, 0.29, 0.60, 0.15, 0.06,
+                 IlluminantD65,     GAMMA_REC709},
+    SMPTEsystem = {"SMPTE", 0.630, 0.340,         0.310,       0.595,
+                   0.155,   0.070, IlluminantD65, GAMMA_REC709},
+    HDTVsystem = {"HDTV", 0.670, 0.330,         0.210,       0.710,
+                  0.150,  0.060, IlluminantD65, GAMMA_REC709},
+    CIEsystem = {"CIE",  0.7355, 0.2645,      0.2658,      0.7243,
+                 0.1669, 0.0085, IlluminantE, GAMMA_REC709},
+    Rec709system = {"CIE REC 709", 0.64, 0.33,          0.30,        0.60,
+                    0.15,          0.06, IlluminantD65, GAMMA_REC709};
+
+/*                          XY_TO_UPVP
+
+    Given 1931 chromaticities x, y, determine 1976 coordinates u', v'
+
+*/
+
+void xy_to_upvp(double xc, double yc, double *up, double *vp) {
+  *up = (4 * xc) / ((-2 * xc) + (12 * yc) + 3);
+  *vp = (9 * yc) / ((-2 * xc) + (12 * yc) + 3);
+}
+
+/*                             XYZ_TO_RGB
+
+    Given an additive tricolour system CS, defined by the CIE x
+    and y chromaticities of its three primaries (z is derived
+    trivially as 1-(x+y)), and a desired chromaticity (XC, YC,
+    ZC) in CIE space, determine the contribution of each
+    primary in a linear combination which sums to the desired
+    chromaticity.  If the  requested chromaticity falls outside
+    the Maxwell  triangle (colour gamut) formed by the three
+    primaries, one of the r, g, or b weights will be negative.
+
+    Caller can use constrain_rgb() to desaturate an
+    outside-gamut colour to the closest representation within
+    the available gamut and/or norm_rgb to normalise the RGB
+    components so the largest nonzero component has value 1.
+
+*/
+
+void xyz_to_rgb(struct colourSystem *cs, double xc, double yc, double zc,
+                double *r, double *g, double *b) {
+  double xr, yr, zr, xg, yg, zg, xb, yb, zb;
+  double xw, yw, zw;
+  double rx, ry, rz, gx, gy, gz, bx, by, bz;
+  double rw, gw, bw;
+
+  xr = cs->xRed;
+  yr = cs->yRed;
+  zr = 1 - (xr + yr);
+  xg = cs->xGreen;
+  yg = cs->yGreen;
+  zg = 1 - (xg + yg);
+  xb = cs->xBlue;
+  yb = cs->yBlue;
+  zb = 1 - (xb + yb);
+
+  xw = cs->xWhite;
+  yw = cs->yWhite;
+  zw = 1 - (xw + yw);
+
+  /* xyz -> rgb matrix, before scaling to white. */
+
+  rx = (yg * zb) - (yb * zg);
+  ry = (xb * zg) - (xg * zb);
+  rz = (xg * yb) - (xb * yg);
+  gx = (yb * zr) - (yr * zb);
+  gy = (xr * zb) - (xb * zr);
+  gz = (xb * yr) - (xr * yb);
+  bx = (yr * zg) - (yg * zr);
+  by = (xg * zr) - (xr * zg);
+  bz = (xr * yg) - (xg * yr);
+
+  /* White scaling factors.
+     Dividing by yw scales the white luminance to unity, as conventional. */
+
+  rw = ((rx * xw) + (ry * yw) + (rz * zw)) / yw;
+  gw = ((gx * xw) + (gy * yw) + (gz * zw)) / yw;
+  bw = ((bx * xw) + (by * yw) + (bz * zw)) / yw;
+
+  /* xyz -> rgb matrix, correctly scaled to white. */
+
+  rx = rx / rw;
+  ry = ry / rw;
+  rz = rz / rw;
+  gx = gx / gw;
+  gy = gy / gw;
+  gz = gz / gw;
+  bx = bx / bw;
+  by = by / bw;
+  bz = bz / bw;
+
+  /* rgb of the desired point */
+
+  *r = (rx * xc) + (ry * yc) + (rz * zc);
+  *g = (gx * xc) + (gy * yc) + (gz * zc);
+  *b = (bx * xc) + (by * yc) + (bz * zc);
+}
+
+/*                          CONSTRAIN_RGB
+
+    If the requested RGB shade contains a negative weight for
+    one of the primaries, it lies outside the colour gamut
+    accessible from the given triple of primaries.  Desaturate
+    it by adding white, equal quantities of R, G, and B, enough
+    to make RGB all positive.  The function returns 1 if the
+    components were modified, zero otherwise.
+
+*/
+
+int constrain_rgb(double *r, double *g, double *b) {
+  double w;
+
+  /* Amount of white needed is w = - min(0, *r, *g, *b) */
+
+  w = (0 < *r) ? 0 : *r;
+  w = (w < *g) ? w : *g;
+  w = (w < *b) ? w : *b;
+  w = -w;
+
+  /* Add just enough white to make r, g, b all positive. */
+
+  if (w > 0) {
+    *r += w;
+    *g += w;
+    *b += w;
+    return 1; /* Colour modified to fit RGB gamut */
+  }
+
+  return 0; /* Colour within RGB gamut */
+}
+
+/*                          GAMMA_CORRECT_RGB
+
+    Transform linear RGB values to nonlinear RGB values. Rec.
+    709 is ITU-R Recommendation BT. 709 (1990) ``Basic
+    Parameter Values for the HDTV Standard for the Studio and
+    for International Programme Exchange'', formerly CCIR Rec.
+    709. For details see
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+*/
+
+void gamma_correct(const struct colourSystem *cs, double *c) {
+  double gamma;
+
+  gamma = cs->gamma;
+
+  if (gamma == GAMMA_REC709) {
+    /* Rec. 709 gamma correction. */
+    double cc = 0.018;
+
+    if (*c < cc) {
+      *c *= ((1.099 * pow(cc, 0.45)) - 0.099) / cc;
+    } else {
+      *c = (1.099 * pow(*c, 0.45)) - 0.099;
+    }
+  } else {
+    /* Nonlinear colour = (Linear colour)^(1/gamma) */
+    *c = pow(*c, 1.0 / gamma);
+  }
+}
+
+void gamma_correct_rgb(const struct colourSystem *cs, double *r, double *g,
+                       double *b) {
+  gamma_correct(cs, r);
+  gamma_correct(cs, g);
+  gamma_correct(cs, b);
+}
+
+/*                          NORM_RGB
+
+    Normalise RGB components so the most intense (unless all
+    are zero) has a value of 1.
+
+*/
+
+void norm_rgb(double *r, double *g, double *b) {
+#define Max(a, b) (((a) > (b)) ? (a) : (b))
+  double greatest = Max(*r, Max(*g, *b));
+
+  if (greatest > 0) {
+    *r /= greatest;
+    *g /= greatest;
+    *b /= greatest;
+  }
+#undef Max
+}
+
+/* CIE colour matching functions xBar, yBar, and zBar for
+   wavelengths from 380 through 780 nanometers, every 5
+   nanometers.  For a wavelength lambda in this range:
+
+        cie_colour_match[(lambda - 380) / 5][0] = xBar
+        cie_colour_match[(lambda - 380) / 5][1] = yBar
+        cie_colour_match[(lambda - 380) / 5][2] = zBar
+
+    To save memory, this table can be declared as floats
+    rather than doubles; (IEEE) float has enough
+    significant bits to represent the values. It's declared
+    as a double here to avoid warnings about "conversion
+    between floating-point types" from certain persnickety
+    compilers. */
+
+static double cie_colour_match[81][3] = {
+    {0.0014, 0.0000, 0.0065}, {0.0022, 0.0001, 0.0105},
+    {0.0042, 0.0001, 0.0201}, {0.0076, 0.0002, 0.0362},
+    {0.0143, 0.0004, 0.0679}, {0.0232, 0.0006, 0.1102},
+    {0.0435, 0.0012, 0.2074}, {0.0776, 0.0022, 0.3713},
+    {0.1344, 0.0040, 0.6456}, {0.2148, 0.0073, 1.0391},
+    {0.2839, 0.0116, 1.3856}, {0.3285, 0.0168, 1.6230},
+    {0.3483, 0.0230, 1.7471}, {0.3481, 0.0298, 1.7826},
+    {0.3362, 0.0380, 1.7721}, {0.3187, 0.0480, 1.7441},
+    {0.2908, 0.0600, 1.6692}, {0.2511, 0.0739, 1.5281},
+    {0.1954, 0.0910, 1.2876}, {0.1421, 0.1126, 1.0419},
+    {0.0956, 0.1390, 0.8130}, {0.0580, 0.1693, 0.6162},
+    {0.0320, 0.2080, 0.4652}, {0.0147, 0.2586, 0.3533},
+    {0.0049, 0.3230, 0.2720}, {0.0024, 0.4073, 0.2123},
+    {0.0093, 0.5030, 0.1582}, {0.0291, 0.6082, 0.1117},
+    {0.0633, 0.7100, 0.0782}, {0.1096, 0.7932, 0.0573},
+    {0.1655, 0.8620, 0.0422}, {0.2257, 0.9149, 0.0298},
+    {0.2904, 0.9540, 0.0203}, {0.3597, 0.9803, 0.0134},
+    {0.4334, 0.9950, 0.0087}, {0.5121, 1.0000, 0.0057},
+    {0.5945, 0.9950, 0.0039}, {0.6784, 0.9786, 0.0027},
+    {0.7621, 0.9520, 0.0021}, {0.8425, 0.9154, 0.0018},
+    {0.9163, 0.8700, 0.0017}, {0.9786, 0.8163, 0.0014},
+    {1.0263, 0.7570, 0.0011}, {1.0567, 0.6949, 0.0010},
+    {1.0622, 0.6310, 0.0008}, {1.0456, 0.5668, 0.0006},
+    {1.0026, 0.5030, 0.0003}, {0.9384, 0.4412, 0.0002},
+    {0.8544, 0.3810, 0.0002}, {0.7514, 0.3210, 0.0001},
+    {0.6424, 0.2650, 0.0000}, {0.5419, 0.2170, 0.0000},
+    {0.4479, 0.1750, 0.0000}, {0.3608, 0.1382, 0.0000},
+    {0.2835, 0.1070, 0.0000}, {0.2187, 0.0816, 0.0000},
+    {0.1649, 0.0610, 0.0000}, {0.1212, 0.0446, 0.0000},
+    {0.0874, 0.0320, 0.0000}, {0.0636, 0.0232, 0.0000},
+    {0.0468, 0.0170, 0.0000}, {0.0329, 0.0119, 0.0000},
+    {0.0227, 0.0082, 0.0000}, {0.0158, 0.0057, 0.0000},
+    {0.0114, 0.0041, 0.0000}, {0.0081, 0.0029, 0.0000},
+    {0.0058, 0.0021, 0.0000}, {0.0041, 0.0015, 0.0000},
+    {0.0029, 0.0010, 0.0000}, {0.0020, 0.0007, 0.0000},
+    {0.0014, 0.0005, 0.0000}, {0.0010, 0.0004, 0.0000},
+    {0.0007, 0.0002, 0.0000}, {0.0005, 0.0002, 0.0000},
+    {0.0003, 0.0001, 0.0000}, {0.0002, 0.0001, 0.0000},
+    {0.0002, 0.0001, 0.0000}, {0.0001, 0.0000, 0.0000},
+    {0.0001, 0.0000, 0.0000}, {0.0001, 0.0000, 0.0000},
+    {0.0000, 0.0000, 0.0000}};
+
+/*                          SPECTRUM_TO_XYZ
+
+    Calculate the CIE X, Y, and Z coordinates corresponding to
+    a light source with spectral distribution given by  the
+    function SPEC_INTENS, which is called with a series of
+    wavelengths between 380 and 780 nm (the argument is
+    expressed in meters), which returns emittance at  that
+    wavelength in arbitrary units.  The chromaticity
+    coordinates of the spectrum are returned in the x, y, and z
+    arguments which respect the identity:
+
+            x + y + z = 1.
+*/
+
+void spectrum_to_xyz(double (*spec_intens)(double wavelength), double *x,
+                     double *y, double *z) {
+  int i;
+  double lambda, X = 0, Y = 0, Z = 0, XYZ;
+
+  for (i = 0, lambda = 380; lambda < 780.1; i++, lambda += 5) {
+    double Me;
+
+    Me = (*spec_intens)(lambda);
+    X += Me * cie_colour_match[i][0];
+    Y += Me * cie_colour_match[i][1];
+    Z += Me * cie_colour_match[i][2];
+  }
+  XYZ = (X + Y + Z);
+  *x = X / XYZ;
+  *y = Y / XYZ;
+  *z = Z / XYZ;
+}
+
+/*                            BB_SPECTRUM
+
+    Calculate, by Planck's radiation law, the emittance of a black body
+    of temperature bbTemp at the given wavelength (in metres).  */
+
+double bbTemp = 5000; /* Hidden temperature argument
+                         to BB_SPECTRUM. */
+double bb_spectrum(double wavelength) {
+  double wlm = wavelength * 1e-9; /* Wavelength in meters */
+
+  return (3.74183e-16 * pow(wlm, -5.0)) /
+         (exp(1.4388e-2 / (wlm * bbTemp)) - 1.0);
+}
+double white(double wavelength) { return 1; }
+
+/*                          RGB_TO_XYZ_MATRIX
+
+    The inverse of what xyz_to_rgb() does: the matrix taking linear
+    R, G, B of colour system CS to X, Y, Z, scaled so that
+    R = G = B = 1 is the white point with Y = 1.
+
+*/
+
+void rgb_to_xyz_matrix(struct colourSystem *cs, double m[3][3]) {
+  double p[3][3] = {
+      {cs->xRed, cs->xGreen, cs->xBlue},
+      {cs->yRed, cs->yGreen, cs->yBlue},
+      {1 - cs->xRed - cs->yRed, 1 - cs->xGreen - cs->yGreen,
+       1 - cs->xBlue - cs->yBlue}};
+  double w[3] = {cs->xWhite / cs->yWhite, 1,
+                 (1 - cs->xWhite - cs->yWhite) / cs->yWhite};
+  double inv[3][3], det, s[3];
+
+  /* Cofactor inverse of the primaries' chromaticities. */
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      int i1 = (j + 1) % 3, i2 = (j + 2) % 3, j1 = (i + 1) % 3,
+          j2 = (i + 2) % 3;
+      inv[i][j] = p[i1][j1] * p[i2][j2] - p[i1][j2] * p[i2][j1];
+    }
+  }
+  det = p[0][0] * inv[0][0] + p[0][1] * inv[1][0] + p[0][2] * inv[2][0];
+
+  /* Primary intensities that add up to the white point. */
+  for (int i = 0; i < 3; i++) {
+    s[i] = (inv[i][0] * w[0] + inv[i][1] * w[1] + inv[i][2] * w[2]) / det;
+  }
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      m[i][j] = p[i][j] * s[j];
+    }
+  }
+}
+
+/*                          SCORING
+
+    Both outputs are decoded with the exact inverse of
+    gamma_correct() and taken to X, Y, Z with the system's matrix.
+    L*a*b* is relative to the system's white with Y = 1.
+
+*/
+
+static struct colourSystem *cs = &SMPTEsystem;
+static double rgb_xyz[3][3], white_xyz[3], white_upvp[2];
+
+static double gamma_decode(double c) {
+  double cc = 0.018, slope = (1.099 * pow(cc, 0.45) - 0.099) / cc;
+
+  if (cs->gamma != GAMMA_REC709) {
+    return pow(c, cs->gamma);
+  }
+  return c < cc * slope ? c / slope : pow((c + 0.099) / 1.099, 1 / 0.45);
+}
+
+static double lab_f(double t) {
+  return t > 216.0 / 24389 ? cbrt(t) : t * (24389.0 / 27 / 116) + 16.0 / 116;
+}
+
+/* Decode display R, G, B to X, Y, Z, L*a*b* and u', v'.  Black has
+   no chromaticity; it is taken to be the white's. */
+
+static void decode(const double *rgb, double *lab, double *upvp) {
+  double lin[3], xyz[3], sum;
+
+  for (int i = 0; i < 3; i++) {
+    lin[i] = gamma_decode(rgb[i]);
+  }
+  for (int i = 0; i < 3; i++) {
+    xyz[i] = rgb_xyz[i][0] * lin[0] + rgb_xyz[i][1] * lin[1] +
+             rgb_xyz[i][2] * lin[2];
+  }
+
+  double fx = lab_f(xyz[0] / white_xyz[0]), fy = lab_f(xyz[1]),
+         fz = lab_f(xyz[2] / white_xyz[2]);
+
+  lab[0] = 116 * fy - 16;
+  lab[1] = 500 * (fx - fy);
+  lab[2] = 200 * (fy - fz);
+
+  sum = xyz[0] + xyz[1] + xyz[2];
+  if (sum > 0) {
+    xy_to_upvp(xyz[0] / sum, xyz[1] / sum, &upvp[0], &upvp[1]);
+  } else {
+    upvp[0] = white_upvp[0];
+    upvp[1] = white_upvp[1];
+  }
+}
+
+/* CIEDE2000 as in colour_diff.c (Sharma, Wu and Dalal). */
+
+double de2000(const double *lab1, const double *lab2) {
+  const double deg = M_PI / 180, pow25_7 = 6103515625.0;
+  double L1 = lab1[0], a1 = lab1[1], b1 = lab1[2];
+  double L2 = lab2[0], a2 = lab2[1], b2 = lab2[2];
+  double Cb = (hypot(a1, b1) + hypot(a2, b2)) / 2, Cb7 = pow(Cb, 7);
+  double G = 0.5 * (1 - sqrt(Cb7 / (Cb7 + pow25_7)));
+  double a1p = (1 + G) * a1, a2p = (1 + G) * a2;
+  double C1p = hypot(a1p, b1), C2p = hypot(a2p, b2);
+  double h1p = C1p == 0 ? 0 : atan2(b1, a1p) / deg;
+  double h2p = C2p == 0 ? 0 : atan2(b2, a2p) / deg;
+  double dhp, hbp;
+
+  h1p += h1p < 0 ? 360 : 0;
+  h2p += h2p < 0 ? 360 : 0;
+
+  if (C1p * C2p == 0) {
+    dhp = 0;
+    hbp = h1p + h2p;
+  } else {
+    dhp = h2p - h1p;
+    dhp += dhp > 180 ? -360 : dhp < -180 ? 360 : 0;
+    if (fabs(h1p - h2p) <= 180) {
+      hbp = (h1p + h2p) / 2;
+    } else {
+      hbp = (h1p + h2p + (h1p + h2p < 360 ? 360 : -360)) / 2;
+    }
+  }
+
+  double dLp = L2 - L1, dCp = C2p - C1p;
+  double dHp = 2 * sqrt(C1p * C2p) * sin(dhp / 2 * deg);
+  double Lbp = (L1 + L2) / 2, Cbp = (C1p + C2p) / 2, Cbp7 = pow(Cbp, 7);
+  double T = 1 - 0.17 * cos((hbp - 30) * deg) + 0.24 * cos(2 * hbp * deg) +
+             0.32 * cos((3 * hbp + 6) * deg) - 0.20 * cos((4 * hbp - 63) * deg);
+  double dtheta = 30 * exp(-((hbp - 275) / 25) * ((hbp - 275) / 25));
+  double RC = 2 * sqrt(Cbp7 / (Cbp7 + pow25_7));
+  double SL = 1 + 0.015 * (Lbp - 50) * (Lbp - 50) /
+                      sqrt(20 + (Lbp - 50) * (Lbp - 50));
+  double SC = 1 + 0.045 * Cbp, SH = 1 + 0.015 * Cbp * T;
+  double RT = -sin(2 * dtheta * deg) * RC;
+  double l = dLp / SL, c = dCp / SC, h = dHp / SH;
+
+  return sqrt(l * l + c * c + h * h + RT * c * h);
+}
+
+/*                          REFERENCE PATH
+
+    What color_temp.c does, one colour at a time.  Every kernel
+    takes N inputs (temperatures, wavelengths, or X, Y, Z triples)
+    and writes N linear R, G, B triples, constrained and
+    normalised; the gamma kernels then encode them in place.
+
+*/
+
+typedef void (*linear_fn)(const double *in, int n, double *rgb);
+typedef void (*gamma_fn)(double *c, int n);
+
+static void ref_finish(double x, double y, double z, double *rgb) {
+  xyz_to_rgb(cs, x, y, z, &rgb[0], &rgb[1], &rgb[2]);
+  constrain_rgb(&rgb[0], &rgb[1], &rgb[2]);
+  norm_rgb(&rgb[0], &rgb[1], &rgb[2]);
+}
+
+static void ref_cct(const double *in, int n, double *rgb) {
+  for (int i = 0; i < n; i++) {
+    double x, y, z;
+
+    bbTemp = in[i];
+    spectrum_to_xyz(bb_spectrum, &x, &y, &z);
+    ref_finish(x, y, z, rgb + 3 * i);
+  }
+}
+
+/* Monochromatic light: the colour matching functions themselves,
+   linearly interpolated between the 5 nm rows.  At 780 nm all three
+   are zero in the table, and the colour is black. */
+
+static void ref_wavelength(const double *in, int n, double *rgb) {
+  for (int i = 0; i < n; i++) {
+    double p = (in[i] - 380) / 5, f, xyz[3], sum;
+    int k = (int)p;
+
+    k = k < 0 ? 0 : k > 79 ? 79 : k;
+    f = p - k;
+    for (int c = 0; c < 3; c++) {
+      xyz[c] =
+          cie_colour_match[k][c] * (1 - f) + cie_colour_match[k + 1][c] * f;
+    }
+    sum = xyz[0] + xyz[1] + xyz[2];
+    if (sum > 0) {
+      ref_finish(xyz[0] / sum, xyz[1] / sum, xyz[2] / sum, rgb + 3 * i);
+    } else {
+      rgb[3 * i] = rgb[3 * i + 1] = rgb[3 * i + 2] = 0;
+    }
+  }
+}
+
+static void ref_xyz(const double *in, int n, double *rgb) {
+  for (int i = 0; i < n; i++) {
+    const double *v = in + 3 * i;
+    double sum = v[0] + v[1] + v[2];
+
+    ref_finish(v[0] / sum, v[1] / sum, v[2] / sum, rgb + 3 * i);
+  }
+}
+
+static void ref_gamma(double *c, int n) {
+  for (int i = 0; i < n; i++) {
+    gamma_correct(cs, &c[i]);
+  }
+}
+
+/*                          FLOAT PATH
+
+    The same arithmetic in float, with expf() and powf().  The
+    matrix is xyz_to_rgb() of the unit vectors, and the colour is
+    not reduced to chromaticities first: constrain_rgb() followed
+    by norm_rgb() gives the same result at any scale.
+
+*/
+
+static float xyz_rgb[3][3];
+static float cmf[81][3], planck_c1[81], planck_c2[81];
+
+static void f_finish(float X, float Y, float Z, double *rgb) {
+  float r = xyz_rgb[0][0] * X + xyz_rgb[0][1] * Y + xyz_rgb[0][2] * Z;
+  float g = xyz_rgb[1][0] * X + xyz_rgb[1][1] * Y + xyz_rgb[1][2] * Z;
+  float b = xyz_rgb[2][0] * X + xyz_rgb[2][1] * Y + xyz_rgb[2][2] * Z;
+  float w = fminf(0, fminf(r, fminf(g, b))), max;
+
+  r -= w;
+  g -= w;
+  b -= w;
+  max = fmaxf(r, fmaxf(g, b));
+  if (max > 0) {
+    r /= max;
+    g /= max;
+    b /= max;
+  }
+  rgb[0] = r;
+  rgb[1] = g;
+  rgb[2] = b;
+}
+
+static void f_cct(const double *in, int n, double *rgb) {
+  for (int i = 0; i < n; i++) {
+    float inv_t = 1.0f / (float)in[i], X = 0, Y = 0, Z = 0;
+
+    for (int k = 0; k < 81; k++) {
+      float me = planck_c1[k] / (expf(planck_c2[k] * inv_t) - 1);
+
+      X += me * cmf[k][0];
+      Y += me * cmf[k][1];
+      Z += me * cmf[k][2];
+    }
+    f_finish(X, Y, Z, rgb + 3 * i);
+  }
+}
+
+static void f_wavelength(const double *in, int n, double *rgb) {
+  for (int i = 0; i < n; i++) {
+    float p = ((float)in[i] - 380) / 5, f;
+    int k = (int)p;
+
+    k = k < 0 ? 0 : k > 79 ? 79 : k;
+    f = p - k;
+    f_finish(cmf[k][0] + (cmf[k + 1][0] - cmf[k][0]) * f,
+             cmf[k][1] + (cmf[k + 1][1] - cmf[k][1]) * f,
+             cmf[k][2] + (cmf[k + 1][2] - cmf[k][2]) * f, rgb + 3 * i);
+  }
+}
+
+static void f_xyz(const double *in, int n, double *rgb) {
+  for (int i = 0; i < n; i++) {
+    f_finish(in[3 * i], in[3 * i + 1], in[3 * i + 2], rgb + 3 * i);
+  }
+}
+
+static void f_gamma(double *c, int n) {
+  const float cc = 0.018f, slope = (1.099 * pow(0.018, 0.45) - 0.099) / 0.018;
+  const float inv = 1 / (float)cs->gamma;
+
+  for (int i = 0; i < n; i++) {
+    float v = c[i];
+
+    if (cs->gamma != GAMMA_REC709) {
+      c[i] = powf(v, inv);
+    } else {
+      c[i] = v < cc ? v * slope : 1.099f * powf(v, 0.45f) - 0.099f;
+    }
+  }
+}
+
+/*                          FAST EXP PATH
+
+    Planck's law with exp() from exp2_neg(), as in real_rainbow.c,
+    and the loops turned inside out so each wavelength is applied
+    to a block of temperatures at once, which vectorizes.
+    1 / (e^a - 1) is rewritten as e^-a / (1 - e^-a), which only
+    needs e^-a; a stays below 38 (380 nm at 1000 K).
+
+*/
+
+static inline __attribute__((always_inline)) float exp2_neg(float x) {
+  float r = x + 12582912.0f;
+  float f = x - (r - 12582912.0f);
+  float p =
+      1.0f +
+      f * (0.6931472f +
+           f * (0.2402265f +
+                f * (0.05550411f + f * (0.009618129f + f * 0.001333355f))));
+  int bits;
+  float scale;
+
+  memcpy(&bits, &r, sizeof bits);
+  bits = (bits - 0x4B400000 + 127) << 23;
+  memcpy(&scale, &bits, sizeof scale);
+  return p * scale;
+}
+
+#define BLOCK 256
+
+static void fe_cct(const double *in, int n, double *rgb) {
+  for (int base = 0; base < n; base += BLOCK) {
+    int m = n - base < BLOCK ? n - base : BLOCK;
+    float nlog2_t[BLOCK], X[BLOCK] = {0}, Y[BLOCK] = {0}, Z[BLOCK] = {0};
+
+    for (int i = 0; i < m; i++) {
+      nlog2_t[i] = -1.442695f / (float)in[base + i];
+    }
+    for (int k = 0; k < 81; k++) {
+      float c1 = planck_c1[k], c2 = planck_c2[k];
+      float xb = cmf[k][0], yb = cmf[k][1], zb = cmf[k][2];
+
+      for (int i = 0; i < m; i++) {
+        float e = exp2_neg(c2 * nlog2_t[i]);
+        float me = c1 * e / (1 - e);
+
+        X[i] += me * xb;
+        Y[i] += me * yb;
+        Z[i] += me * zb;
+      }
+    }
+    for (int i = 0; i < m; i++) {
+      f_finish(X[i], Y[i], Z[i], rgb + 3 * (base + i));
+    }
+  }
+}
+
+/*                          BLACK BODY TABLE PATH
+
+    colour_lut.c's table: linear R, G, B every 10 K from 1000 to
+    40000 K, stored as float and interpolated linearly.
+
+*/
+
+#define BB_FIRST 1000.0
+#define BB_STEP 10.0
+#define BB_COUNT 3901
+
+static float bb_table[BB_COUNT][3];
+
+static void lut_cct(const double *in, int n, double *rgb) {
+  for (int i = 0; i < n; i++) {
+    double p = (in[i] - BB_FIRST) / BB_STEP, f;
+    int k;
+
+    p = p < 0 ? 0 : p > BB_COUNT - 1 ? BB_COUNT - 1 : p;
+    k = (int)p;
+    k = k > BB_COUNT - 2 ? BB_COUNT - 2 : k;
+    f = p - k;
+    for (int c = 0; c < 3; c++) {
+      rgb[3 * i + c] =
+          bb_table[k][c] + (bb_table[k + 1][c] - bb_table[k][c]) * f;
+    }
+  }
+}
+
+/*                          CMF FIT PATH
+
+    The Wyman, Sloan and Shirley multi-lobe fit of the colour
+    matching functions from real_rainbow.c instead of the table.
+
+*/
+
+static inline __attribute__((always_inline)) float
+cmf_lobe(float lambda, float mu, float inv_lo, float inv_hi) {
+  float t = fabsf(lambda - mu) * (lambda < mu ? inv_lo : inv_hi);
+
+  t = t < 10.5f ? t : 10.5f;
+  return exp2_neg(-0.7213475f * t * t); /* exp(-t^2 / 2) */
+}
+
+static void fit_wavelength(const double *in, int n, double *rgb) {
+  for (int i = 0; i < n; i++) {
+    float lambda = in[i];
+
+    f_finish(1.056f * cmf_lobe(lambda, 599.8f, 1 / 37.9f, 1 / 31.0f) +
+                 0.362f * cmf_lobe(lambda, 442.0f, 1 / 16.0f, 1 / 26.7f) -
+                 0.065f * cmf_lobe(lambda, 501.1f, 1 / 20.4f, 1 / 26.2f),
+             0.821f * cmf_lobe(lambda, 568.8f, 1 / 46.9f, 1 / 40.5f) +
+                 0.286f * cmf_lobe(lambda, 530.9f, 1 / 16.3f, 1 / 31.1f),
+             1.217f * cmf_lobe(lambda, 437.0f, 1 / 11.8f, 1 / 36.0f) +
+                 0.681f * cmf_lobe(lambda, 459.0f, 1 / 26.0f, 1 / 13.8f),
+             rgb + 3 * i);
+  }
+}
+
+/*                          GAMMA TABLE PATH
+
+    colour_lut.c's gamma table: 4096 float samples of
+    gamma_correct() over 0..1, interpolated linearly.
+
+*/
+
+#define GAMMA_SAMPLES 4096
+
+static float gamma_table[GAMMA_SAMPLES];
+
+static void lut_gamma(double *c, int n) {
+  for (int i = 0; i < n; i++) {
+    double p = c[i] * (GAMMA_SAMPLES - 1);
+    int k;
+
+    p = p < 0 ? 0 : p > GAMMA_SAMPLES - 1 ? GAMMA_SAMPLES - 1 : p;
+    k = (int)p;
+    k = k > GAMMA_SAMPLES - 2 ? GAMMA_SAMPLES - 2 : k;
+    c[i] = gamma_table[k] + (gamma_table[k + 1] - gamma_table[k]) * (p - k);
+  }
+}
+
+/*                          FIXED POINT PATH
+
+    A model, not a copy: no program here has a fixed point path
+    yet.  Integer arithmetic as on a microcontroller driving LEDs:
+    X, Y, Z in Q16, the matrix in Q14, the result constrained and
+    normalised to 12 bits with rounding, and gamma corrected by a
+    4096 entry 16 bit table without interpolation.
+
+*/
+
+static int32_t q_matrix[3][3];
+static uint16_t q_gamma_table[4096];
+
+static void q_xyz(const double *in, int n, double *rgb) {
+  for (int i = 0; i < n; i++) {
+    int64_t v[3], w, max;
+
+    for (int c = 0; c < 3; c++) {
+      v[c] = 0;
+      for (int j = 0; j < 3; j++) {
+        v[c] += (int64_t)q_matrix[c][j] *
+                (int32_t)lround(in[3 * i + j] * 65536);
+      }
+    }
+    /* constrain_rgb(): add white until no component is negative. */
+    w = v[0] < v[1] ? v[0] : v[1];
+    w = w < v[2] ? w : v[2];
+    w = w < 0 ? w : 0;
+    max = 0;
+    for (int c = 0; c < 3; c++) {
+      v[c] -= w;
+      max = v[c] > max ? v[c] : max;
+    }
+    for (int c = 0; c < 3; c++) {
+      rgb[3 * i + c] =
+          max > 0 ? (double)((v[c] * 4095 + max / 2) / max) / 4095 : 0;
+    }
+  }
+}
+
+static void q_gamma(double *c, int n) {
+  for (int i = 0; i < n; i++) {
+    c[i] = q_gamma_table[(int)(c[i] * 4095 + 0.5)] / 65535.0;
+  }
+}
+
+/*                          PATH TABLE
+
+    A path is a linear kernel per sweep (NULL where it has
+    nothing of its own to offer, and is not run) and a gamma
+    kernel, with its error budget and the input range it claims,
+    or 0, 0 for the whole sweep.  The budgets are what each path
+    promises its users: float arithmetic well below anything
+    visible, tables below 0.05 Delta E, and fixed point within a
+    quarter of an 8 bit step.  cmf_fit is held to 1 Delta E and
+    does not make it: its tails are far off the table's, up to 90
+    Delta E at 740 nm, and as Wyman et al. fit the 1 nm functions,
+    not this 5 nm table, it is about 4 Delta E off even in the 410
+    to 650 nm it claims.
+
+*/
+
+enum sweep { SWEEP_CCT, SWEEP_WAVELENGTH, SWEEP_XYZ, NSWEEPS };
+
+static const char *sweep_name[NSWEEPS] = {"cct", "wavelength", "xyz"};
+
+struct path {
+  const char *name;
+  linear_fn linear[NSWEEPS];
+  gamma_fn gamma;
+  double max_de, max_duv; /* Budget */
+  double lo, hi;          /* Claimed cct or wavelength range, or 0, 0 */
+};
+
+static struct path paths[] = {
+    {"reference",
+     {ref_cct, ref_wavelength, ref_xyz},
+     ref_gamma,
+     1e-9,
+     1e-12,
+     0,
+     0},
+    {"float", {f_cct, f_wavelength, f_xyz}, f_gamma, 0.001, 2e-6, 0, 0},
+    {"fast_exp", {fe_cct, NULL, NULL}, ref_gamma, 0.001, 2e-6, 0, 0},
+    {"bb_table", {lut_cct, NULL, NULL}, ref_gamma, 0.05, 1e-4, 0, 0},
+    {"cmf_fit", {NULL, fit_wavelength, NULL}, ref_gamma, 1, 2e-3, 410, 650},
+    {"gamma_table",
+     {ref_cct, ref_wavelength, ref_xyz},
+     lut_gamma,
+     0.001,
+     1e-6,
+     0,
+     0},
+    {"fixed_q12", {NULL, NULL, q_xyz}, q_gamma, 0.25, 1e-3, 0, 0},
+};
+
+#define NPATHS (int)(sizeof paths / sizeof paths[0])
+
+static void init_paths() {
+  double m[3][3];
+  double one[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+
+  rgb_to_xyz_matrix(cs, rgb_xyz);
+  white_xyz[0] = cs->xWhite / cs->yWhite;
+  white_xyz[1] = 1;
+  white_xyz[2] = (1 - cs->xWhite - cs->yWhite) / cs->yWhite;
+  xy_to_upvp(cs->xWhite, cs->yWhite, &white_upvp[0], &white_upvp[1]);
+
+  for (int j = 0; j < 3; j++) {
+    xyz_to_rgb(cs, one[j][0], one[j][1], one[j][2], &m[0][j], &m[1][j],
+               &m[2][j]);
+  }
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      xyz_rgb[i][j] = m[i][j];
+      q_matrix[i][j] = (int32_t)lround(m[i][j] * 16384);
+    }
+  }
+
+  /* Planck's law as c1 / (exp(c2 / T) - 1), per 5 nm sample. */
+  for (int k = 0; k < 81; k++) {
+    double wlm = (380 + 5 * k) * 1e-9;
+
+    planck_c1[k] = 3.74183e-16 * pow(wlm, -5.0);
+    planck_c2[k] = 1.4388e-2 / wlm;
+    for (int c = 0; c < 3; c++) {
+      cmf[k][c] = cie_colour_match[k][c];
+    }
+  }
+
+  for (int k = 0; k < BB_COUNT; k++) {
+    double t = BB_FIRST + k * BB_STEP, rgb[3];
+
+    ref_cct(&t, 1, rgb);
+    for (int c = 0; c < 3; c++) {
+      bb_table[k][c] = rgb[c];
+    }
+  }
+
+  for (int k = 0; k < GAMMA_SAMPLES; k++) {
+    double c = (double)k / (GAMMA_SAMPLES - 1);
+
+    gamma_correct(cs, &c);
+    gamma_table[k] = c;
+  }
+  for (int k = 0; k < 4096; k++) {
+    double c = k / 4095.0;
+
+    gamma_correct(cs, &c);
+    q_gamma_table[k] = (uint16_t)lround(c * 65535);
+  }
+}
+
+/*                            SWEEPS                                */
+
+struct sweep_data {
+  int n, stride; /* Colours, input values per colour */
+  double *in;
+  double *ref; /* Reference display R, G, B */
+  double *lab, *upvp; /* The reference decoded */
+};
+
+static void make_sweep(enum sweep s, struct sweep_data *d) {
+  unsigned rng = 12345;
+
+  d->stride = s == SWEEP_XYZ ? 3 : 1;
+  d->n = s == SWEEP_CCT ? 39001 : s == SWEEP_WAVELENGTH ? 40001 : 100000;
+  d->in = (double *)malloc(sizeof(double) * d->stride * d->n);
+  for (int i = 0; i < d->n; i++) {
+    if (s == SWEEP_CCT) {
+      d->in[i] = 1000 + i;
+    } else if (s == SWEEP_WAVELENGTH) {
+      d->in[i] = 380 + 0.01 * i;
+    } else {
+      for (int c = 0; c < 3; c++) {
+        rng = rng * 1103515245 + 12345;
+        d->in[3 * i + c] = (rng >> 8) / 16777216.0;
+      }
+    }
+  }
+
+  d->ref = (double *)malloc(sizeof(double) * 3 * d->n);
+  d->lab = (double *)malloc(sizeof(double) * 3 * d->n);
+  d->upvp = (double *)malloc(sizeof(double) * 2 * d->n);
+  paths[0].linear[s](d->in, d->n, d->ref);
+  paths[0].gamma(d->ref, 3 * d->n);
+  for (int i = 0; i < d->n; i++) {
+    decode(d->ref + 3 * i, d->lab + 3 * i, d->upvp + 2 * i);
+  }
+}
+
+/*                          MEASUREMENT                             */
+
+struct result {
+  int ran;
+  int colours; /* Scored */
+  double ns;              /* Per colour */
+  double max_de, mean_de; /* CIEDE2000 */
+  double max_duv, mean_duv;
+  int worst;  /* Colour with the largest Delta E */
+  int pareto; /* On the front for its sweep */
+  int pass;
+};
+
+static double now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Best of several runs, at least 3 and 0.2 s. */
+
+static double time_path(const struct path *p, enum sweep s,
+                        const struct sweep_data *d, int first, int n,
+                        double *out) {
+  double best = 1e300, start = now_ns();
+
+  for (int rep = 0; rep < 3 || now_ns() - start < 2e8; rep++) {
+    double t0 = now_ns();
+
+    for (int base = first; base < first + n; base += 1024) {
+      int m = first + n - base < 1024 ? first + n - base : 1024;
+
+      p->linear[s](d->in + (size_t)d->stride * base, m, out + 3 * base);
+      p->gamma(out + 3 * base, 3 * m);
+    }
+    t0 = now_ns() - t0;
+    best = t0 < best ? t0 : best;
+  }
+  return best / n;
+}
+
+/* The part of the sweep path P claims: colours FIRST to FIRST + N,
+   the whole sweep if it claims none. */
+
+static void path_span(const struct path *p, const struct sweep_data *d,
+                      int *first, int *n) {
+  int a = 0, b = d->n;
+
+  if (d->stride == 1 && p->hi > p->lo) {
+    while (a < b && d->in[a] < p->lo) {
+      a++;
+    }
+    while (b > a && d->in[b - 1] > p->hi) {
+      b--;
+    }
+  }
+  *first = a;
+  *n = b - a;
+}
+
+/* Time and score path P on colours FIRST to FIRST + N of sweep S. */
+
+static void measure(const struct path *p, enum sweep s,
+                    const struct sweep_data *d, int first, int n,
+                    double *out, struct result *r) {
+  double sum_de = 0, sum_duv = 0;
+
+  r->ran = 1;
+  r->colours = n;
+  r->ns = time_path(p, s, d, first, n, out);
+  r->max_de = r->max_duv = 0;
+  r->worst = first;
+  for (int i = first; i < first + n; i++) {
+    double lab[3], upvp[2], de, duv;
+
+    decode(out + 3 * i, lab, upvp);
+    de = de2000(d->lab + 3 * i, lab);
+    duv = hypot(upvp[0] - d->upvp[2 * i], upvp[1] - d->upvp[2 * i + 1]);
+    sum_de += de;
+    sum_duv += duv;
+    if (de > r->max_de) {
+      r->max_de = de;
+      r->worst = i;
+    }
+    r->max_duv = duv > r->max_duv ? duv : r->max_duv;
+  }
+  r->mean_de = sum_de / n;
+  r->mean_duv = sum_duv / n;
+  r->pass = r->max_de <= p->max_de && r->max_duv <= p->max_duv;
+}
+
+/* A path is on the front unless another is at least as fast and at
+   least as accurate, and strictly better in one of the two. */
+
+static void mark_pareto(struct result *r) {
+  for (int i = 0; i < NPATHS; i++) {
+    r[i].pareto = r[i].ran;
+    for (int j = 0; j < NPATHS && r[i].pareto; j++) {
+      if (j != i && r[j].ran && r[j].ns <= r[i].ns &&
+          r[j].max_de <= r[i].max_de &&
+          (r[j].ns < r[i].ns || r[j].max_de < r[i].max_de)) {
+        r[i].pareto = 0;
+      }
+    }
+  }
+}
+
+static void worst_input(enum sweep s, const struct sweep_data *d, int i,
+                        char *buf, size_t size) {
+  const double *v = d->in + (size_t)d->stride * i;
+
+  if (s == SWEEP_CCT) {
+    snprintf(buf, size, "%.0f K", v[0]);
+  } else if (s == SWEEP_WAVELENGTH) {
+    snprintf(buf, size, "%.2f nm", v[0]);
+  } else {
+    snprintf(buf, size, "%.3f %.3f %.3f", v[0], v[1], v[2]);
+  }
+}
+
+int main(int argc, char **argv) {
+  static struct result results[NSWEEPS][NPATHS], claimed[NSWEEPS][NPATHS];
+  const char *csv_path = NULL;
+  FILE *csv = NULL;
+  int failed = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      csv_path = argv[++i];
+    } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      char name[32];
+      double de, duv;
+      int k = NPATHS;
+
+      if (sscanf(argv[++i], "%31[^=]=%lf,%lf", name, &de, &duv) == 3) {
+        for (k = 0; k < NPATHS && strcmp(paths[k].name, name) != 0; k++) {
+        }
+      }
+      if (k == NPATHS) {
+        fprintf(stderr, "bad budget: %s\n", argv[i]);
+        return 2;
+      }
+      paths[k].max_de = de;
+      paths[k].max_duv = duv;
+    } else {
+      fprintf(stderr, "Usage: pareto_bench [-o CSV] [-b NAME=DE,DUV]...\n");
+      return 2;
+    }
+  }
+
+  if (csv_path) {
+    csv = strcmp(csv_path, "-") == 0 ? stdout : fopen(csv_path, "w");
+    if (!csv) {
+      perror(csv_path);
+      return 1;
+    }
+  }
+
+  init_paths();
+  printf("Colour system %s; Delta E is CIEDE2000, * marks the Pareto "
+         "front\n",
+         cs->name);
+
+  for (int s = 0; s < NSWEEPS; s++) {
+    struct sweep_data d;
+    double *out;
+
+    make_sweep((enum sweep)s, &d);
+    out = (double *)malloc(sizeof(double) * 3 * d.n);
+    for (int k = 0; k < NPATHS; k++) {
+      int first, n;
+
+      if (!paths[k].linear[s]) {
+        continue;
+      }
+      measure(&paths[k], (enum sweep)s, &d, 0, d.n, out, &results[s][k]);
+      path_span(&paths[k], &d, &first, &n);
+      if (n != d.n) {
+        measure(&paths[k], (enum sweep)s, &d, first, n, out, &claimed[s][k]);
+      }
+    }
+    mark_pareto(results[s]);
+
+    printf("\n%s, %d colours\n", sweep_name[s], d.n);
+    printf("  %-12s %9s %7s %9s %9s %9s %9s  %-19s %s\n", "path",
+           "ns/colour", "speedup", "max dE", "mean dE", "max du'v'",
+           "mean", "worst at", "budget");
+    for (int k = 0; k < NPATHS; k++) {
+      struct result *r = &results[s][k];
+      char worst[64];
+
+      if (!r->ran) {
+        continue;
+      }
+      worst_input((enum sweep)s, &d, r->worst, worst, sizeof worst);
+      printf("%c %-12s %9.1f %7.1f %9.2e %9.2e %9.2e %9.2e  %-19s %s\n",
+             r->pareto ? '*' : ' ', paths[k].name, r->ns,
+             results[s][0].ns / r->ns, r->max_de, r->mean_de, r->max_duv,
+             r->mean_duv, worst, r->pass ? "ok" : "FAIL");
+      failed |= !r->pass;
+    }
+    for (int k = 0; k < NPATHS; k++) {
+      struct result *r = &claimed[s][k];
+      char worst[64];
+
+      if (!r->ran) {
+        continue;
+      }
+      worst_input((enum sweep)s, &d, r->worst, worst, sizeof worst);
+      printf("  %s in its claimed %g to %g, %d colours: max dE %.2e, mean "
+             "%.2e,\n    max du'v' %.2e, mean %.2e, worst at %s: %s\n",
+             paths[k].name, paths[k].lo, paths[k].hi, r->colours, r->max_de,
+             r->mean_de, r->max_duv, r->mean_duv, worst,
+             r->pass ? "within budget" : "over budget");
+    }
+
+    free(d.in);
+    free(d.ref);
+    free(d.lab);
+    free(d.upvp);
+    free(out);
+  }
+
+  if (csv) {
+    /* Rows for claimed ranges have claimed set, and are never on
+       the front. */
+    fprintf(csv, "sweep,path,claimed,colours,ns_per_colour,max_de2000,"
+                 "mean_de2000,max_duv,mean_duv,budget_de2000,budget_duv,"
+                 "pareto,pass\n");
+    for (int s = 0; s < NSWEEPS; s++) {
+      for (int k = 0; k < 2 * NPATHS; k++) {
+        struct result *r =
+            k < NPATHS ? &results[s][k] : &claimed[s][k - NPATHS];
+        const struct path *p = &paths[k % NPATHS];
+
+        if (r->ran) {
+          fprintf(csv, "%s,%s,%d,%d,%.3f,%.6g,%.6g,%.6g,%.6g,%g,%g,%d,%d\n",
+                  sweep_name[s], p->name, k >= NPATHS, r->colours, r->ns,
+                  r->max_de, r->mean_de, r->max_duv, r->mean_duv, p->max_de,
+                  p->max_duv, r->pareto, r->pass);
+        }
+      }
+    }
+    if (csv != stdout) {
+      fclose(csv);
+    }
+  }
+
+  if (failed) {
+    printf("\nSome paths are over their error budget.\n");
+  }
+  return failed;
+}
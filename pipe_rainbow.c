@@ -0,0 +1,663 @@
+/*
+               Pipelined colour generation and output
+
+    rainbow.c, real_rainbow.c and color_temp.c all compute a
+    colour and printf() it on the same thread, so a slow terminal
+    or a full pipe stalls the computation.  Here a generator
+    thread renders whole frames of text (any of the three
+    programs' output) into buffers and an output thread write()s
+    them, the two connected by a lock-free ring.
+
+    Build:  g++ -O2 -pthread pipe_rainbow.c -o pipe_rainbow
+
+    Usage:  pipe_rainbow [-g rainbow|spectrum|blackbody]
+                         [-p block|drop] [-n frames] [-q slots]
+
+    With -p block (the default) the generator waits when the ring
+    is full, so every frame is written.  With -p drop it never
+    waits: the oldest queued frame is discarded to make room.
+    Queue-to-write latency and drop counts go to stderr at exit.
+
+    The colour code is copied from color_temp.c (John Walker,
+    public domain; see that file for the full credits).
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A colour system is defined by the CIE x and y coordinates of
+   its three primary illuminants and the x and y coordinates of
+   the white point. */
+
+struct colourSystem {
+  char *name;         /* Colour system name */
+  double xRed, yRed,  /* Red x, y */
+      xGreen, yGreen, /* Green x, y */
+      xBlue, yBlue,   /* Blue x, y */
+      xWhite, yWhite, /* White point x, y */
+      gamma;          /* Gamma correction for system */
+};
+
+/* White point chromaticities. */
+
+#define IlluminantC 0.3101, 0.3162         /* For NTSC television */
+#define IlluminantD65 0.3127, 0.3291       /* For EBU and SMPTE */
+#define IlluminantE 0.33333333, 0.33333333 /* CIE equal-energy illuminant */
+
+/*  Gamma of nonlinear correction.
+
+    See Charles Poynton's ColorFAQ Item 45 and GammaFAQ Item 6 at:
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+
+*/
+
+#define GAMMA_REC709 0 /* Rec. 709 */
+
+static struct colourSystem
+    /* Name                  xRed    yRed    xGreen  yGreen  xBlue  yBlue White
+       point        Gamma   */
+    NTSCsystem = {"NTSC", 0.67, 0.33,        0.21,        0.71,
+                  0.14,   0.08, IlluminantC, GAMMA_REC709},
+    EBUsystem = {"EBU (PAL/SECAM)", 0.64,        0.33, 0.29, 0.60, 0.15, 0.06,
+                 IlluminantD65,     GAMMA_REC709},
+    SMPTEsystem = {"SMPTE", 0.630, 0.340,         0.310,       0.595,
+                   0.155,   0.070, IlluminantD65, GAMMA_REC709},
+    HDTVsystem = {"HDTV", 0.670, 0.330,         0.210,       0.710,
+                  0.150,  0.060, IlluminantD65, GAMMA_REC709},
+    CIEsystem = {"CIE",  0.7355, 0.2645,      0.2658,      0.7243,
+                 0.1669, 0.0085, IlluminantE, GAMMA_REC709},
+    Rec709system = {"CIE REC 709", 0.64, 0.33,          0.30,        0.60,
+                    0.15,          0.06, IlluminantD65, GAMMA_REC709};
+
+/*                             XYZ_TO_RGB
+
+    Given an additive tricolour system CS, defined by the CIE x
+    and y chromaticities of its three primaries (z is derived
+    trivially as 1-(x+y)), and a desired chromaticity (XC, YC,
+    ZC) in CIE space, determine the contribution of each
+    primary in a linear combination which sums to the desired
+    chromaticity.  If the  requested chromaticity falls outside
+    the Maxwell  triangle (colour gamut) formed by the three
+    primaries, one of the r, g, or b weights will be negative.
+
+    Caller can use constrain_rgb() to desaturate an
+    outside-gamut colour to the closest representation within
+    the available gamut and/or norm_rgb to normalise the RGB
+    components so the largest nonzero component has value 1.
+
+*/
+
+void xyz_to_rgb(struct colourSystem *cs, double xc, double yc, double zc,
+                double *r, double *g, double *b) {
+  double xr, yr, zr, xg, yg, zg, xb, yb, zb;
+  double xw, yw, zw;
+  double rx, ry, rz, gx, gy, gz, bx, by, bz;
+  double rw, gw, bw;
+
+  xr = cs->xRed;
+  yr = cs->yRed;
+  zr = 1 - (xr + yr);
+  xg = cs->xGreen;
+  yg = cs->yGreen;
+  zg = 1 - (xg + yg);
+  xb = cs->xBlue;
+  yb = cs->yBlue;
+  zb = 1 - (xb + yb);
+
+  xw = cs->xWhite;
+  yw = cs->yWhite;
+  zw = 1 - (xw + yw);
+
+  /* xyz -> rgb matrix, before scaling to white. */
+
+  rx = (yg * zb) - (yb * zg);
+  ry = (xb * zg) - (xg * zb);
+  rz = (xg * yb) - (xb * yg);
+  gx = (yb * zr) - (yr * zb);
+  gy = (xr * zb) - (xb * zr);
+  gz = (xb * yr) - (xr * yb);
+  bx = (yr * zg) - (yg * zr);
+  by = (xg * zr) - (xr * zg);
+  bz = (xr * yg) - (xg * yr);
+
+  /* White scaling factors.
+     Dividing by yw scales the white luminance to unity, as conventional. */
+
+  rw = ((rx * xw) + (ry * yw) + (rz * zw)) / yw;
+  gw = ((gx * xw) + (gy * yw) + (gz * zw)) / yw;
+  bw = ((bx * xw) + (by * yw) + (bz * zw)) / yw;
+
+  /* xyz -> rgb matrix, correctly scaled to white. */
+
+  rx = rx / rw;
+  ry = ry / rw;
+  rz = rz / rw;
+  gx = gx / gw;
+  gy = gy / gw;
+  gz = gz / gw;
+  bx = bx / bw;
+  by = by / bw;
+  bz = bz / bw;
+
+  /* rgb of the desired point */
+
+  *r = (rx * xc) + (ry * yc) + (rz * zc);
+  *g = (gx * xc) + (gy * yc) + (gz * zc);
+  *b = (bx * xc) + (by * yc) + (bz * zc);
+}
+
+/*                          CONSTRAIN_RGB
+
+    If the requested RGB shade contains a negative weight for
+    one of the primaries, it lies outside the colour gamut
+    accessible from the given triple of primaries.  Desaturate
+    it by adding white, equal quantities of R, G, and B, enough
+    to make RGB all positive.  The function returns 1 if the
+    components were modified, zero otherwise.
+
+*/
+
+int constrain_rgb(double *r, double *g, double *b) {
+  double w;
+
+  /* Amount of white needed is w = - min(0, *r, *g, *b) */
+
+  w = (0 < *r) ? 0 : *r;
+  w = (w < *g) ? w : *g;
+  w = (w < *b) ? w : *b;
+  w = -w;
+
+  /* Add just enough white to make r, g, b all positive. */
+
+  if (w > 0) {
+    *r += w;
+    *g += w;
+    *b += w;
+    return 1; /* Colour modified to fit RGB gamut */
+  }
+
+  return 0; /* Colour within RGB gamut */
+}
+
+/*                          NORM_RGB
+
+    Normalise RGB components so the most intense (unless all
+    are zero) has a value of 1.
+
+*/
+
+void norm_rgb(double *r, double *g, double *b) {
+#define Max(a, b) (((a) > (b)) ? (a) : (b))
+  double greatest = Max(*r, Max(*g, *b));
+
+  if (greatest > 0) {
+    *r /= greatest;
+    *g /= greatest;
+    *b /= greatest;
+  }
+#undef Max
+}
+
+/*                          SPECTRUM_TO_XYZ
+
+    Calculate the CIE X, Y, and Z coordinates corresponding to
+    a light source with spectral distribution given by  the
+    function SPEC_INTENS, which is called with a series of
+    wavelengths between 380 and 780 nm (the argument is
+    expressed in meters), which returns emittance at  that
+    wavelength in arbitrary units.  The chromaticity
+    coordinates of the spectrum are returned in the x, y, and z
+    arguments which respect the identity:
+
+            x + y + z = 1.
+*/
+
+void spectrum_to_xyz(double (*spec_intens)(double wavelength), double *x,
+                     double *y, double *z) {
+  int i;
+  double lambda, X = 0, Y = 0, Z = 0, XYZ;
+
+  /* CIE colour matching functions xBar, yBar, and zBar for
+     wavelengths from 380 through 780 nanometers, every 5
+     nanometers.  For a wavelength lambda in this range:
+
+          cie_colour_match[(lambda - 380) / 5][0] = xBar
+          cie_colour_match[(lambda - 380) / 5][1] = yBar
+          cie_colour_match[(lambda - 380) / 5][2] = zBar
+
+      To save memory, this table can be declared as floats
+      rather than doubles; (IEEE) float has enough
+      significant bits to represent the values. It's declared
+      as a double here to avoid warnings about "conversion
+      between floating-point types" from certain persnickety
+      compilers. */
+
+  static double cie_colour_match[81][3] = {
+      {0.0014, 0.0000, 0.0065}, {0.0022, 0.0001, 0.0105},
+      {0.0042, 0.0001, 0.0201}, {0.0076, 0.0002, 0.0362},
+      {0.0143, 0.0004, 0.0679}, {0.0232, 0.0006, 0.1102},
+      {0.0435, 0.0012, 0.2074}, {0.0776, 0.0022, 0.3713},
+      {0.1344, 0.0040, 0.6456}, {0.2148, 0.0073, 1.0391},
+      {0.2839, 0.0116, 1.3856}, {0.3285, 0.0168, 1.6230},
+      {0.3483, 0.0230, 1.7471}, {0.3481, 0.0298, 1.7826},
+      {0.3362, 0.0380, 1.7721}, {0.3187, 0.0480, 1.7441},
+      {0.2908, 0.0600, 1.6692}, {0.2511, 0.0739, 1.5281},
+      {0.1954, 0.0910, 1.2876}, {0.1421, 0.1126, 1.0419},
+      {0.0956, 0.1390, 0.8130}, {0.0580, 0.1693, 0.6162},
+      {0.0320, 0.2080, 0.4652}, {0.0147, 0.2586, 0.3533},
+      {0.0049, 0.3230, 0.2720}, {0.0024, 0.4073, 0.2123},
+      {0.0093, 0.5030, 0.1582}, {0.0291, 0.6082, 0.1117},
+      {0.0633, 0.7100, 0.0782}, {0.1096, 0.7932, 0.0573},
+      {0.1655, 0.8620, 0.0422}, {0.2257, 0.9149, 0.0298},
+      {0.2904, 0.9540, 0.0203}, {0.3597, 0.9803, 0.0134},
+      {0.4334, 0.9950, 0.0087}, {0.5121, 1.0000, 0.0057},
+      {0.5945, 0.9950, 0.0039}, {0.6784, 0.9786, 0.0027},
+      {0.7621, 0.9520, 0.0021}, {0.8425, 0.9154, 0.0018},
+      {0.9163, 0.8700, 0.0017}, {0.9786, 0.8163, 0.0014},
+      {1.0263, 0.7570, 0.0011}, {1.0567, 0.6949, 0.0010},
+      {1.0622, 0.6310, 0.0008}, {1.0456, 0.5668, 0.0006},
+      {1.0026, 0.5030, 0.0003}, {0.9384, 0.4412, 0.0002},
+      {0.8544, 0.3810, 0.0002}, {0.7514, 0.3210, 0.0001},
+      {0.6424, 0.2650, 0.0000}, {0.5419, 0.2170, 0.0000},
+      {0.4479, 0.1750, 0.0000}, {0.3608, 0.1382, 0.0000},
+      {0.2835, 0.1070, 0.0000}, {0.2187, 0.0816, 0.0000},
+      {0.1649, 0.0610, 0.0000}, {0.1212, 0.0446, 0.0000},
+      {0.0874, 0.0320, 0.0000}, {0.0636, 0.0232, 0.0000},
+      {0.0468, 0.0170, 0.0000}, {0.0329, 0.0119, 0.0000},
+      {0.0227, 0.0082, 0.0000}, {0.0158, 0.0057, 0.0000},
+      {0.0114, 0.0041, 0.0000}, {0.0081, 0.0029, 0.0000},
+      {0.0058, 0.0021, 0.0000}, {0.0041, 0.0015, 0.0000},
+      {0.0029, 0.0010, 0.0000}, {0.0020, 0.0007, 0.0000},
+      {0.0014, 0.0005, 0.0000}, {0.0010, 0.0004, 0.0000},
+      {0.0007, 0.0002, 0.0000}, {0.0005, 0.0002, 0.0000},
+      {0.0003, 0.0001, 0.0000}, {0.0002, 0.0001, 0.0000},
+      {0.0002, 0.0001, 0.0000}, {0.0001, 0.0000, 0.0000},
+      {0.0001, 0.0000, 0.0000}, {0.0001, 0.0000, 0.0000},
+      {0.0000, 0.0000, 0.0000}};
+
+  for (i = 0, lambda = 380; lambda < 780.1; i++, lambda += 5) {
+    double Me;
+
+    Me = (*spec_intens)(lambda);
+    X += Me * cie_colour_match[i][0];
+    Y += Me * cie_colour_match[i][1];
+    Z += Me * cie_colour_match[i][2];
+  }
+  XYZ = (X + Y + Z);
+  *x = X / XYZ;
+  *y = Y / XYZ;
+  *z = Z / XYZ;
+}
+
+/*                            BB_SPECTRUM
+
+    Calculate, by Planck's radiation law, the emittance of a black body
+    of temperature bbTemp at the given wavelength (in metres).  */
+
+double bbTemp = 5000; /* Hidden temperature argument
+                         to BB_SPECTRUM. */
+double bb_spectrum(double wavelength) {
+  double wlm = wavelength * 1e-9; /* Wavelength in meters */
+
+  return (3.74183e-16 * pow(wlm, -5.0)) /
+         (exp(1.4388e-2 / (wlm * bbTemp)) - 1.0);
+}
+double white(double wavelength) { return 1; }
+
+/*                          MONO_SPECTRUM
+
+    Unit emittance within 2.5 nm of monoLambda and none elsewhere,
+    so spectrum_to_xyz() returns the chromaticity of the one 5 nm
+    table row at that wavelength.  */
+
+double monoLambda = 550; /* Hidden wavelength argument
+                            to MONO_SPECTRUM. */
+double mono_spectrum(double wavelength) {
+  return fabs(wavelength - monoLambda) < 2.5 ? 1 : 0;
+}
+
+/*                            GENERATORS
+
+    Each renders frame number FRAME as the text its original
+    program would print and returns the number of bytes used.
+
+*/
+
+#define FRAME_BYTES 16384
+
+struct frame {
+  uint64_t seq;           /* Frame number */
+  int64_t queued_ns;      /* When the generator finished it */
+  size_t len;             /* Bytes of text in data */
+  char data[FRAME_BYTES];
+} __attribute__((aligned(64))); /* Frames never share a cache line */
+
+typedef size_t (*generator)(long frame, char *out);
+
+/* rainbow.c: 100 lines of r, g, b, moving with the frame number. */
+
+static size_t gen_rainbow(long frame, char *out) {
+  float shift = frame * 0.01f, speed = 0.1f;
+  size_t n = 0;
+
+  for (int i = 0; i < 100; i++) {
+    int r, g, b;
+    r = (sin(speed * i + 0 + shift) + 1) * 127;
+    g = (sin(speed * i + ((2 * M_PI) / 3) + shift) + 1) * 127;
+    b = (sin(speed * i + ((4 * M_PI) / 3) + shift) + 1) * 127;
+    n += snprintf(out + n, FRAME_BYTES - n, "r:%4d, g:%4d, b:%4d \n", r, g, b);
+  }
+  return n;
+}
+
+/* real_rainbow.c: the visible spectrum as a strip of coloured cells,
+   scrolling one cell per frame. */
+
+static size_t gen_spectrum(long frame, char *out) {
+  struct colourSystem *cs = &SMPTEsystem;
+  size_t n = 0;
+
+  for (int i = 0; i < 75; i++) {
+    double x, y, z, r, g, b;
+
+    monoLambda = 380 + 5 * ((i + frame) % 75);
+    spectrum_to_xyz(mono_spectrum, &x, &y, &z);
+    xyz_to_rgb(cs, x, y, z, &r, &g, &b);
+    constrain_rgb(&r, &g, &b);
+    norm_rgb(&r, &g, &b);
+    n += snprintf(out + n, FRAME_BYTES - n, "\033[48;2;%d;%d;%d m  \033[0m",
+                  (int)(r * 255), (int)(g * 255), (int)(b * 255));
+  }
+  n += snprintf(out + n, FRAME_BYTES - n, "\n");
+  return n;
+}
+
+/* color_temp.c: the black body table from 1000 to 10000 K. */
+
+static size_t gen_blackbody(long frame, char *out) {
+  struct colourSystem *cs = &SMPTEsystem;
+  size_t n = 0;
+
+  for (double t = 1000; t <= 10000; t += 100) {
+    double x, y, z, r, g, b;
+
+    bbTemp = t;
+    spectrum_to_xyz(bb_spectrum, &x, &y, &z);
+    xyz_to_rgb(cs, x, y, z, &r, &g, &b);
+    constrain_rgb(&r, &g, &b);
+    norm_rgb(&r, &g, &b);
+    n += snprintf(out + n, FRAME_BYTES - n,
+                  "  %5.0f K      %.4f %.4f %.4f   %.3f %.3f %.3f"
+                  "\033[48;2;%d;%d;%d m  \033[0m\n",
+                  t, x, y, z, r, g, b, (int)(r * 255), (int)(g * 255),
+                  (int)(b * 255));
+  }
+  return n;
+}
+
+/*                              RING
+
+    Frames live in a fixed pool and move between the threads as
+    pool indices through two single-producer/single-consumer
+    rings:
+
+        full:  generator -> output, frames ready to write
+        empty: output -> generator, frames written and reusable
+
+    The pool holds QUEUE + 1 frames: the one the generator is
+    filling plus up to QUEUE queued or being written.  Both rings
+    can hold the whole pool, so a push never finds them full.
+
+    Indices are free-running 64-bit counters; a ring is empty when
+    head == tail and full when tail - head == capacity.  The only
+    exception to single-consumer is drop-oldest: when no frame is
+    free the generator itself pops the oldest entry from the full
+    ring.  Both consumers therefore advance its head with a
+    compare-and-swap, and a consumer only trusts the index it read
+    if its own CAS from that head succeeded.
+
+*/
+
+#define MAX_QUEUE 256
+
+struct ring {
+  uint64_t head __attribute__((aligned(64))); /* Next to pop */
+  uint64_t tail __attribute__((aligned(64))); /* Next to push */
+  int capacity;
+  int slot[MAX_QUEUE + 1];
+};
+
+static void ring_init(struct ring *r, int capacity) {
+  r->head = r->tail = 0;
+  r->capacity = capacity;
+}
+
+/* Producer side.  Returns 0 when the ring is full. */
+
+static int ring_push(struct ring *r, int v) {
+  uint64_t t = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+  if (t - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) >=
+      (uint64_t)r->capacity) {
+    return 0;
+  }
+  r->slot[t % r->capacity] = v;
+  __atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/* Consumer side.  Returns -1 when the ring is empty. */
+
+static int ring_pop(struct ring *r) {
+  uint64_t h = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+  while (h != __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) {
+    int v = r->slot[h % r->capacity];
+
+    if (__atomic_compare_exchange_n(&r->head, &h, h + 1, 0, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE)) {
+      return v;
+    }
+    /* Lost the race to a drop; h now holds the new head. */
+  }
+  return -1;
+}
+
+/* Back off while the other side catches up. */
+
+static void ring_wait(int *spins) {
+  if (++*spins < 64) {
+    sched_yield();
+  } else {
+    struct timespec ts = {0, 50000};
+    nanosleep(&ts, NULL);
+  }
+}
+
+/*                            PIPELINE                              */
+
+enum policy { BLOCK, DROP_OLDEST };
+
+static struct frame *pool;
+static struct ring full_ring, empty_ring;
+static generator gen = gen_rainbow;
+static enum policy policy = BLOCK;
+static long nframes = 1000;
+static int done; /* Set by the generator after its last push */
+
+/* Statistics, each written by one thread only and read after join. */
+static long stalls, dropped, written;
+static double lat_sum_ns, lat_max_ns;
+static long lat_hist[64]; /* Latencies bucketed by power of two ns */
+
+static int64_t now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *generator_thread(void *arg) {
+  for (long f = 0; f < nframes; f++) {
+    int idx, spins = 0;
+
+    while ((idx = ring_pop(&empty_ring)) < 0) {
+      if (policy == DROP_OLDEST && (idx = ring_pop(&full_ring)) >= 0) {
+        dropped++;
+        break;
+      }
+      if (spins == 0) {
+        stalls++;
+      }
+      ring_wait(&spins);
+    }
+
+    struct frame *fr = &pool[idx];
+    fr->seq = f;
+    fr->len = gen(f, fr->data);
+    fr->queued_ns = now_ns();
+
+    ring_push(&full_ring, idx);
+  }
+  __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void *output_thread(void *arg) {
+  int spins = 0;
+
+  for (;;) {
+    int idx = ring_pop(&full_ring);
+
+    if (idx < 0) {
+      if (__atomic_load_n(&done, __ATOMIC_ACQUIRE) &&
+          (idx = ring_pop(&full_ring)) < 0) {
+        break;
+      }
+      if (idx < 0) {
+        ring_wait(&spins);
+        continue;
+      }
+    }
+    spins = 0;
+
+    struct frame *fr = &pool[idx];
+    for (size_t off = 0; off < fr->len;) {
+      ssize_t n = write(STDOUT_FILENO, fr->data + off, fr->len - off);
+
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        perror("write");
+        exit(1);
+      }
+      off += n;
+    }
+
+    double lat = now_ns() - fr->queued_ns;
+    int bucket = 0;
+    lat_sum_ns += lat;
+    lat_max_ns = lat > lat_max_ns ? lat : lat_max_ns;
+    while (bucket < 63 && (1LL << (bucket + 1)) <= lat) {
+      bucket++;
+    }
+    lat_hist[bucket]++;
+    written++;
+
+    ring_push(&empty_ring, idx);
+  }
+  return NULL;
+}
+
+/* Upper bound of the bucket holding quantile Q of the latencies,
+   capped at the largest latency seen. */
+
+static double lat_quantile(double q) {
+  long want = (long)ceil(q * written), seen = 0;
+
+  for (int i = 0; i < 64; i++) {
+    seen += lat_hist[i];
+    if (seen >= want && seen > 0) {
+      double bound = (double)(1LL << (i + 1));
+      return bound < lat_max_ns ? bound : lat_max_ns;
+    }
+  }
+  return 0;
+}
+
+static int usage() {
+  fprintf(stderr, "Usage: pipe_rainbow [-g rainbow|spectrum|blackbody]\n"
+                  "                    [-p block|drop] [-n frames] "
+                  "[-q slots]\n");
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  int queue = 8;
+  pthread_t gt, ot;
+
+  for (int i = 1; i < argc; i += 2) {
+    const char *v = argv[i + 1];
+
+    if (i + 1 == argc) {
+      return usage();
+    } else if (strcmp(argv[i], "-g") == 0) {
+      if (strcmp(v, "rainbow") == 0) {
+        gen = gen_rainbow;
+      } else if (strcmp(v, "spectrum") == 0) {
+        gen = gen_spectrum;
+      } else if (strcmp(v, "blackbody") == 0) {
+        gen = gen_blackbody;
+      } else {
+        return usage();
+      }
+    } else if (strcmp(argv[i], "-p") == 0) {
+      if (strcmp(v, "block") != 0 && strcmp(v, "drop") != 0) {
+        return usage();
+      }
+      policy = strcmp(v, "drop") == 0 ? DROP_OLDEST : BLOCK;
+    } else if (strcmp(argv[i], "-n") == 0) {
+      nframes = atol(v);
+    } else if (strcmp(argv[i], "-q") == 0) {
+      queue = atoi(v);
+    } else {
+      return usage();
+    }
+  }
+  if (queue < 1 || queue > MAX_QUEUE) {
+    fprintf(stderr, "queue must be 1..%d\n", MAX_QUEUE);
+    return 1;
+  }
+
+  pool = (struct frame *)aligned_alloc(64, (queue + 1) * sizeof(struct frame));
+  ring_init(&full_ring, queue + 1);
+  ring_init(&empty_ring, queue + 1);
+  for (int i = 0; i < queue + 1; i++) {
+    ring_push(&empty_ring, i);
+  }
+
+  pthread_create(&ot, NULL, output_thread, NULL);
+  pthread_create(&gt, NULL, generator_thread, NULL);
+  pthread_join(gt, NULL);
+  pthread_join(ot, NULL);
+
+  fprintf(stderr,
+          "%ld frames written, %ld dropped, %ld generator stalls\n"
+          "latency mean %.1f us, p50 < %.1f us, p99 < %.1f us, max %.1f us\n",
+          written, dropped, stalls, written ? lat_sum_ns / written / 1e3 : 0,
+          lat_quantile(0.5) / 1e3, lat_quantile(0.99) / 1e3, lat_max_ns / 1e3);
+
+  free(pool);
+  return 0;
+}
@@ -1,5 +1,13 @@
+#include <errno.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define FPS 60                 /* Default frame rate */
+#define MAX_FPS 1000           /* Above this the period is under 1 ms */
+#define SHIFT_PER_SECOND 0.6   /* Animation speed, radians per second */
+#define REPORT_EVERY_SECONDS 5 /* How often timing stats go to stderr */
 
 void print_rainbow(float shift, float speed) {
   for (int i = 0; i < 100; i++) {
@@ -12,13 +20,118 @@ void print_rainbow(float shift, float speed) {
    // printf("\033[48;2;%d;%d;%d m  \033[0m", (int)(r), (int)(g), (int)(b));
   }
 }
-int main() {
+
+/* Fixed-timestep frame clock.  Frame n is due at start + n * period;
+   we sleep until that absolute deadline, so oversleeping on one frame
+   does not push back all the following ones.  If deadlines have
+   already passed when we get to them (after a stall), those frames
+   are skipped and counted as missed, and we wait for the next
+   deadline still ahead instead of running the late frames back to
+   back.  Lateness is how long after its deadline a frame wakes. */
+
+struct frame_clock {
+  struct timespec start;
+  long long period_ns;
+  long long frame;
+  long long missed;
+  long long woken;       /* Frames waited for since the last report */
+  long long late_max_ns; /* Worst wake-up lateness since the last report */
+  double late_sum_ns;
+};
+
+static long long ts_ns(const struct timespec *ts) {
+  return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+void clock_start(struct frame_clock *fc, int fps) {
+  clock_gettime(CLOCK_MONOTONIC, &fc->start);
+  fc->period_ns = 1000000000LL / fps;
+  fc->frame = 0;
+  fc->missed = 0;
+  fc->woken = 0;
+  fc->late_max_ns = 0;
+  fc->late_sum_ns = 0;
+}
+
+/* Wait for the next frame and return seconds since clock_start(). */
+
+double clock_next_frame(struct frame_clock *fc) {
+  long long due = ts_ns(&fc->start) + ++fc->frame * fc->period_ns;
+  struct timespec ts, now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (ts_ns(&now) > due) {
+    long long skip = (ts_ns(&now) - due) / fc->period_ns + 1;
+
+    fc->missed += skip;
+    fc->frame += skip;
+    due += skip * fc->period_ns;
+  }
+
+  ts.tv_sec = due / 1000000000LL;
+  ts.tv_nsec = due % 1000000000LL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    /* Interrupted by a signal, sleep the rest. */
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  long long late = ts_ns(&now) - due;
+  fc->woken++;
+  fc->late_sum_ns += late;
+  fc->late_max_ns = late > fc->late_max_ns ? late : fc->late_max_ns;
+
+  return (ts_ns(&now) - ts_ns(&fc->start)) * 1e-9;
+}
+
+void clock_report(struct frame_clock *fc) {
+  fprintf(stderr,
+          "frame %lld: wake-up lateness mean %.1f us, max %.1f us, missed "
+          "%lld deadlines\n",
+          fc->frame, fc->late_sum_ns / (fc->woken ? fc->woken : 1) / 1e3,
+          fc->late_max_ns / 1e3, fc->missed);
+  fc->woken = 0;
+  fc->late_sum_ns = 0;
+  fc->late_max_ns = 0;
+}
+
+/*  Usage: rainbow [fps] */
+
+int main(int argc, char **argv) {
+  int fps = FPS;
+  struct frame_clock fc;
   float shift = 0;
+  long long interval, next_report;
+
+  if (argc > 1) {
+    char *end;
+    long v = strtol(argv[1], &end, 10);
+
+    if (argc > 2 || end == argv[1] || *end || v < 1 || v > MAX_FPS) {
+      fprintf(stderr, "Usage: rainbow [fps], fps 1..%d\n", MAX_FPS);
+      return 2;
+    }
+    fps = (int)v;
+  }
+  clock_start(&fc, fps);
+  interval = (long long)fps * REPORT_EVERY_SECONDS;
+  next_report = interval;
 
   while (1) {
     print_rainbow(shift, 0.1);
+    fflush(stdout);
   //  printf("\n");
-    shift += 0.0001;
+
+    /* Derive the shift from time, not from the frame count, so the
+       animation speed does not depend on the frame rate. */
+    double t = clock_next_frame(&fc);
+    shift = fmod(SHIFT_PER_SECOND * t, 2 * M_PI);
+
+    /* Skipped frames can step over the report frame, possibly
+       several; report once and move to the next one still ahead. */
+    if (fc.frame >= next_report) {
+      clock_report(&fc);
+      next_report += (fc.frame - next_report) / interval * interval + interval;
+    }
   }
 
   print_rainbow(2, 0.1);
@@ -0,0 +1,727 @@
+/*
+          RGB to reflectance spectrum by coefficient table
+
+    The inverse of the rest of this repository: given linear RGB
+    in one of the built-in colour systems, produce a smooth
+    reflectance spectrum whose colour is that RGB.  Following
+
+        W. Jakob, J. Hanika, "A Low-Dimensional Function Space
+        for Efficient Spectral Upsampling", Computer Graphics
+        Forum 38(2), 2019.
+
+    the spectrum is a sigmoid of a quadratic in wavelength,
+
+        s(lambda) = S(c0 t^2 + c1 t + c2),  t = (lambda - 380) / 400
+        S(x) = 1/2 + x / (2 sqrt(1 + x^2))
+
+    so it is smooth and always inside [0, 1].  The three
+    coefficients are found offline for a grid of RGB values by
+    Gauss-Newton with Levenberg-Marquardt damping, using the 5 nm
+    CMF table from spectrum_to_xyz() and the xyz_to_rgb() matrix.
+    At run time a lookup is a trilinear fetch from the table plus
+    the closed form above.
+
+    The table is indexed like the paper's: by which component is
+    largest, that component z on a grid of squares (finer in the
+    dark), and the other two divided by z.  Reflectances are
+    judged under an equal-energy illuminant (white() in
+    color_temp.c), white balanced so that s = 1 maps to RGB 1,1,1.
+
+    Saturated colours of a wide system such as CIE have no
+    reflectance in [0, 1]; there the fit is only the closest one
+    and build reports the worst residual.
+
+    Build:  g++ -O3 -march=native -fno-math-errno rgb2spec.c -o rgb2spec
+
+    (-fno-math-errno lets sqrtf() inline, which the vectorized
+    lookup needs.)
+
+    Usage:  rgb2spec build FILE [SYSTEM [RES]]
+            rgb2spec bench FILE
+
+    SYSTEM is one of the built-in colour systems (default SMPTE),
+    RES the table resolution per axis (default 32).
+
+    The colour code is copied from color_temp.c (John Walker,
+    public domain; see that file for the full credits).
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* A colour system is defined by the CIE x and y coordinates of
+   its three primary illuminants and the x and y coordinates of
+   the white point. */
+
+struct colourSystem {
+  char *name;         /* Colour system name */
+  double xRed, yRed,  /* Red x, y */
+      xGreen, yGreen, /* Green x, y */
+      xBlue, yBlue,   /* Blue x, y */
+      xWhite, yWhite, /* White point x, y */
+      gamma;          /* Gamma correction for system */
+};
+
+/* White point chromaticities. */
+
+#define IlluminantC 0.3101, 0.3162         /* For NTSC television */
+#define IlluminantD65 0.3127, 0.3291       /* For EBU and SMPTE */
+#define IlluminantE 0.33333333, 0.33333333 /* CIE equal-energy illuminant */
+
+/*  Gamma of nonlinear correction.
+
+    See Charles Poynton's ColorFAQ Item 45 and GammaFAQ Item 6 at:
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+
+*/
+
+#define GAMMA_REC709 0 /* Rec. 709 */
+
+static struct colourSystem
+    /* Name                  xRed    yRed    xGreen  yGreen  xBlue  yBlue White
+       point        Gamma   */
+    NTSCsystem = {"NTSC", 0.67, 0.33,        0.21,        0.71,
+                  0.14,   0.08, IlluminantC, GAMMA_REC709},
+    EBUsystem = {"EBU (PAL/SECAM)", 0.64,        0.33, 0.29, 0.60, 0.15, 0.06,
+                 IlluminantD65,     GAMMA_REC709},
+    SMPTEsystem = {"SMPTE", 0.630, 0.340,         0.310,       0.595,
+                   0.155,   0.070, IlluminantD65, GAMMA_REC709},
+    HDTVsystem = {"HDTV", 0.670, 0.330,         0.210,       0.710,
+                  0.150,  0.060, IlluminantD65, GAMMA_REC709},
+    CIEsystem = {"CIE",  0.7355, 0.2645,      0.2658,      0.7243,
+                 0.1669, 0.0085, IlluminantE, GAMMA_REC709},
+    Rec709system = {"CIE REC 709", 0.64, 0.33,          0.30,        0.60,
+                    0.15,          0.06, IlluminantD65, GAMMA_REC709};
+
+/*                             XYZ_TO_RGB
+
+    Given an additive tricolour system CS, defined by the CIE x
+    and y chromaticities of its three primaries (z is derived
+    trivially as 1-(x+y)), and a desired chromaticity (XC, YC,
+    ZC) in CIE space, determine the contribution of each
+    primary in a linear combination which sums to the desired
+    chromaticity.  If the  requested chromaticity falls outside
+    the Maxwell  triangle (colour gamut) formed by the three
+    primaries, one of the r, g, or b weights will be negative.
+
+    Caller can use constrain_rgb() to desaturate an
+    outside-gamut colour to the closest representation within
+    the available gamut and/or norm_rgb to normalise the RGB
+    components so the largest nonzero component has value 1.
+
+*/
+
+void xyz_to_rgb(struct colourSystem *cs, double xc, double yc, double zc,
+                double *r, double *g, double *b) {
+  double xr, yr, zr, xg, yg, zg, xb, yb, zb;
+  double xw, yw, zw;
+  double rx, ry, rz, gx, gy, gz, bx, by, bz;
+  double rw, gw, bw;
+
+  xr = cs->xRed;
+  yr = cs->yRed;
+  zr = 1 - (xr + yr);
+  xg = cs->xGreen;
+  yg = cs->yGreen;
+  zg = 1 - (xg + yg);
+  xb = cs->xBlue;
+  yb = cs->yBlue;
+  zb = 1 - (xb + yb);
+
+  xw = cs->xWhite;
+  yw = cs->yWhite;
+  zw = 1 - (xw + yw);
+
+  /* xyz -> rgb matrix, before scaling to white. */
+
+  rx = (yg * zb) - (yb * zg);
+  ry = (xb * zg) - (xg * zb);
+  rz = (xg * yb) - (xb * yg);
+  gx = (yb * zr) - (yr * zb);
+  gy = (xr * zb) - (xb * zr);
+  gz = (xb * yr) - (xr * yb);
+  bx = (yr * zg) - (yg * zr);
+  by = (xg * zr) - (xr * zg);
+  bz = (xr * yg) - (xg * yr);
+
+  /* White scaling factors.
+     Dividing by yw scales the white luminance to unity, as conventional. */
+
+  rw = ((rx * xw) + (ry * yw) + (rz * zw)) / yw;
+  gw = ((gx * xw) + (gy * yw) + (gz * zw)) / yw;
+  bw = ((bx * xw) + (by * yw) + (bz * zw)) / yw;
+
+  /* xyz -> rgb matrix, correctly scaled to white. */
+
+  rx = rx / rw;
+  ry = ry / rw;
+  rz = rz / rw;
+  gx = gx / gw;
+  gy = gy / gw;
+  gz = gz / gw;
+  bx = bx / bw;
+  by = by / bw;
+  bz = bz / bw;
+
+  /* rgb of the desired point */
+
+  *r = (rx * xc) + (ry * yc) + (rz * zc);
+  *g = (gx * xc) + (gy * yc) + (gz * zc);
+  *b = (bx * xc) + (by * yc) + (bz * zc);
+}
+
+/* CIE colour matching functions xBar, yBar, and zBar for
+   wavelengths from 380 through 780 nanometers, every 5
+   nanometers.  For a wavelength lambda in this range:
+
+        cie_colour_match[(lambda - 380) / 5][0] = xBar
+        cie_colour_match[(lambda - 380) / 5][1] = yBar
+        cie_colour_match[(lambda - 380) / 5][2] = zBar
+
+    To save memory, this table can be declared as floats
+    rather than doubles; (IEEE) float has enough
+    significant bits to represent the values. It's declared
+    as a double here to avoid warnings about "conversion
+    between floating-point types" from certain persnickety
+    compilers. */
+
+static double cie_colour_match[81][3] = {
+    {0.0014, 0.0000, 0.0065}, {0.0022, 0.0001, 0.0105},
+    {0.0042, 0.0001, 0.0201}, {0.0076, 0.0002, 0.0362},
+    {0.0143, 0.0004, 0.0679}, {0.0232, 0.0006, 0.1102},
+    {0.0435, 0.0012, 0.2074}, {0.0776, 0.0022, 0.3713},
+    {0.1344, 0.0040, 0.6456}, {0.2148, 0.0073, 1.0391},
+    {0.2839, 0.0116, 1.3856}, {0.3285, 0.0168, 1.6230},
+    {0.3483, 0.0230, 1.7471}, {0.3481, 0.0298, 1.7826},
+    {0.3362, 0.0380, 1.7721}, {0.3187, 0.0480, 1.7441},
+    {0.2908, 0.0600, 1.6692}, {0.2511, 0.0739, 1.5281},
+    {0.1954, 0.0910, 1.2876}, {0.1421, 0.1126, 1.0419},
+    {0.0956, 0.1390, 0.8130}, {0.0580, 0.1693, 0.6162},
+    {0.0320, 0.2080, 0.4652}, {0.0147, 0.2586, 0.3533},
+    {0.0049, 0.3230, 0.2720}, {0.0024, 0.4073, 0.2123},
+    {0.0093, 0.5030, 0.1582}, {0.0291, 0.6082, 0.1117},
+    {0.0633, 0.7100, 0.0782}, {0.1096, 0.7932, 0.0573},
+    {0.1655, 0.8620, 0.0422}, {0.2257, 0.9149, 0.0298},
+    {0.2904, 0.9540, 0.0203}, {0.3597, 0.9803, 0.0134},
+    {0.4334, 0.9950, 0.0087}, {0.5121, 1.0000, 0.0057},
+    {0.5945, 0.9950, 0.0039}, {0.6784, 0.9786, 0.0027},
+    {0.7621, 0.9520, 0.0021}, {0.8425, 0.9154, 0.0018},
+    {0.9163, 0.8700, 0.0017}, {0.9786, 0.8163, 0.0014},
+    {1.0263, 0.7570, 0.0011}, {1.0567, 0.6949, 0.0010},
+    {1.0622, 0.6310, 0.0008}, {1.0456, 0.5668, 0.0006},
+    {1.0026, 0.5030, 0.0003}, {0.9384, 0.4412, 0.0002},
+    {0.8544, 0.3810, 0.0002}, {0.7514, 0.3210, 0.0001},
+    {0.6424, 0.2650, 0.0000}, {0.5419, 0.2170, 0.0000},
+    {0.4479, 0.1750, 0.0000}, {0.3608, 0.1382, 0.0000},
+    {0.2835, 0.1070, 0.0000}, {0.2187, 0.0816, 0.0000},
+    {0.1649, 0.0610, 0.0000}, {0.1212, 0.0446, 0.0000},
+    {0.0874, 0.0320, 0.0000}, {0.0636, 0.0232, 0.0000},
+    {0.0468, 0.0170, 0.0000}, {0.0329, 0.0119, 0.0000},
+    {0.0227, 0.0082, 0.0000}, {0.0158, 0.0057, 0.0000},
+    {0.0114, 0.0041, 0.0000}, {0.0081, 0.0029, 0.0000},
+    {0.0058, 0.0021, 0.0000}, {0.0041, 0.0015, 0.0000},
+    {0.0029, 0.0010, 0.0000}, {0.0020, 0.0007, 0.0000},
+    {0.0014, 0.0005, 0.0000}, {0.0010, 0.0004, 0.0000},
+    {0.0007, 0.0002, 0.0000}, {0.0005, 0.0002, 0.0000},
+    {0.0003, 0.0001, 0.0000}, {0.0002, 0.0001, 0.0000},
+    {0.0002, 0.0001, 0.0000}, {0.0001, 0.0000, 0.0000},
+    {0.0001, 0.0000, 0.0000}, {0.0001, 0.0000, 0.0000},
+    {0.0000, 0.0000, 0.0000}};
+
+/*                          SPECTRUM_TO_XYZ
+
+    Calculate the CIE X, Y, and Z coordinates corresponding to
+    a light source with spectral distribution given by  the
+    function SPEC_INTENS, which is called with a series of
+    wavelengths between 380 and 780 nm (the argument is
+    expressed in meters), which returns emittance at  that
+    wavelength in arbitrary units.  The chromaticity
+    coordinates of the spectrum are returned in the x, y, and z
+    arguments which respect the identity:
+
+            x + y + z = 1.
+*/
+
+void spectrum_to_xyz(double (*spec_intens)(double wavelength), double *x,
+                     double *y, double *z) {
+  int i;
+  double lambda, X = 0, Y = 0, Z = 0, XYZ;
+
+  for (i = 0, lambda = 380; lambda < 780.1; i++, lambda += 5) {
+    double Me;
+
+    Me = (*spec_intens)(lambda);
+    X += Me * cie_colour_match[i][0];
+    Y += Me * cie_colour_match[i][1];
+    Z += Me * cie_colour_match[i][2];
+  }
+  XYZ = (X + Y + Z);
+  *x = X / XYZ;
+  *y = Y / XYZ;
+  *z = Z / XYZ;
+}
+
+
+/*                          FORWARD MODEL
+
+    RGB of a sigmoid-quadratic reflectance: integrate over the
+    81 table bands, scale so s = 1 gives Y = 1, convert with the
+    xyz_to_rgb() matrix and white balance.
+
+*/
+
+#define BANDS 81
+
+struct model {
+  double m[9];        /* xyz_to_rgb() matrix, row major */
+  double white[3];    /* RGB of s = 1, divided out */
+  double cmf[BANDS][3]; /* CMF table scaled so sum of yBar is 1 */
+};
+
+static inline double sigmoid(double x) {
+  return 0.5 + x / (2 * sqrt(1 + x * x));
+}
+
+static void model_rgb(const struct model *md, const double c[3],
+                      double rgb[3]) {
+  double X = 0, Y = 0, Z = 0;
+
+  for (int i = 0; i < BANDS; i++) {
+    double t = i / (BANDS - 1.0);
+    double s = sigmoid((c[0] * t + c[1]) * t + c[2]);
+
+    X += s * md->cmf[i][0];
+    Y += s * md->cmf[i][1];
+    Z += s * md->cmf[i][2];
+  }
+  for (int k = 0; k < 3; k++) {
+    rgb[k] = (md->m[3 * k] * X + md->m[3 * k + 1] * Y + md->m[3 * k + 2] * Z) /
+             md->white[k];
+  }
+}
+
+static void model_init(struct model *md, struct colourSystem *cs) {
+  double ysum = 0;
+
+  xyz_to_rgb(cs, 1, 0, 0, &md->m[0], &md->m[3], &md->m[6]);
+  xyz_to_rgb(cs, 0, 1, 0, &md->m[1], &md->m[4], &md->m[7]);
+  xyz_to_rgb(cs, 0, 0, 1, &md->m[2], &md->m[5], &md->m[8]);
+
+  for (int i = 0; i < BANDS; i++) {
+    ysum += cie_colour_match[i][1];
+  }
+  for (int i = 0; i < BANDS; i++) {
+    for (int k = 0; k < 3; k++) {
+      md->cmf[i][k] = cie_colour_match[i][k] / ysum;
+    }
+  }
+
+  md->white[0] = md->white[1] = md->white[2] = 1;
+  {
+    double big[3] = {0, 0, 1e6}, w[3]; /* sigmoid(1e6) is 1 to 1e-12 */
+
+    model_rgb(md, big, w);
+    for (int k = 0; k < 3; k++) {
+      md->white[k] = w[k];
+    }
+  }
+}
+
+/*                              SOLVE
+
+    Levenberg-Marquardt on the three coefficients, starting from
+    C, which is updated in place.  Returns the final RGB residual.
+
+*/
+
+static double solve_3x3(double a[3][3], const double b[3], double x[3]) {
+  double det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1]) -
+               a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0]) +
+               a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+
+  if (fabs(det) < 1e-300) {
+    return 0;
+  }
+  for (int k = 0; k < 3; k++) {
+    double t[3][3];
+
+    memcpy(t, a, sizeof t);
+    for (int r = 0; r < 3; r++) {
+      t[r][k] = b[r];
+    }
+    x[k] = (t[0][0] * (t[1][1] * t[2][2] - t[1][2] * t[2][1]) -
+            t[0][1] * (t[1][0] * t[2][2] - t[1][2] * t[2][0]) +
+            t[0][2] * (t[1][0] * t[2][1] - t[1][1] * t[2][0])) /
+           det;
+  }
+  return det;
+}
+
+static double residual(const struct model *md, const double c[3],
+                       const double target[3], double r[3]) {
+  double rgb[3];
+
+  model_rgb(md, c, rgb);
+  for (int k = 0; k < 3; k++) {
+    r[k] = rgb[k] - target[k];
+  }
+  return r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+}
+
+static double fit(const struct model *md, const double target[3],
+                  double c[3]) {
+  double r[3], err = residual(md, c, target, r), lambda = 1e-3;
+
+  for (int it = 0; it < 50 && err > 1e-14; it++) {
+    double J[3][3], A[3][3], g[3], d[3], cn[3], rn[3], errn;
+
+    for (int j = 0; j < 3; j++) {
+      double cp[3] = {c[0], c[1], c[2]}, rp[3];
+
+      cp[j] += 1e-6;
+      residual(md, cp, target, rp);
+      for (int k = 0; k < 3; k++) {
+        J[k][j] = (rp[k] - r[k]) / 1e-6;
+      }
+    }
+    for (int i = 0; i < 3; i++) {
+      g[i] = 0;
+      for (int j = 0; j < 3; j++) {
+        A[i][j] = 0;
+        for (int k = 0; k < 3; k++) {
+          A[i][j] += J[k][i] * J[k][j];
+        }
+      }
+      for (int k = 0; k < 3; k++) {
+        g[i] -= J[k][i] * r[k];
+      }
+    }
+
+    /* Raise the damping until a step reduces the error. */
+    for (;;) {
+      double Ad[3][3];
+
+      memcpy(Ad, A, sizeof Ad);
+      for (int i = 0; i < 3; i++) {
+        Ad[i][i] += lambda * (A[i][i] + 1e-12);
+      }
+      if (solve_3x3(Ad, g, d) == 0 || lambda > 1e12) {
+        return sqrt(err);
+      }
+      for (int i = 0; i < 3; i++) {
+        cn[i] = c[i] + d[i];
+      }
+      errn = residual(md, cn, target, rn);
+      if (errn < err) {
+        break;
+      }
+      lambda *= 10;
+    }
+    memcpy(c, cn, sizeof cn);
+    memcpy(r, rn, sizeof rn);
+    err = errn;
+    lambda = lambda / 10 > 1e-9 ? lambda / 10 : 1e-9;
+  }
+  return sqrt(err);
+}
+
+/*                              TABLE
+
+    coef[k][zi][yi][xi][3] for RGB whose largest component is k,
+    with that component z = (zi / (res - 1))^2 and the next two
+    (in order k+1, k+2 mod 3) equal to z * xi / (res - 1) and
+    z * yi / (res - 1).
+
+*/
+
+struct coef_header {
+  char magic[8]; /* "RGB2SPEC" */
+  int res;
+  char system[32];
+};
+
+struct coef_table {
+  int res;
+  char system[32];
+  float *coef;
+};
+
+static inline size_t coef_index(int res, int k, int zi, int yi, int xi) {
+  return ((((size_t)k * res + zi) * res + yi) * res + xi) * 3;
+}
+
+static void table_build(struct coef_table *tb, const struct model *md) {
+  int res = tb->res;
+  double worst = 0;
+
+  tb->coef = (float *)malloc((size_t)3 * res * res * res * 3 * sizeof(float));
+
+  /* Walk each (x, y) column outwards from a mid grey-ish z, seeding
+     every solve with its neighbour's solution. */
+  for (int k = 0; k < 3; k++) {
+    for (int yi = 0; yi < res; yi++) {
+      for (int xi = 0; xi < res; xi++) {
+        int start = res / 2;
+        double c0[3] = {0, 0, 0};
+
+        for (int pass = 0; pass < 2; pass++) {
+          double c[3] = {c0[0], c0[1], c0[2]};
+
+          for (int zi = start; pass == 0 ? zi < res : zi >= 0;
+               zi += pass == 0 ? 1 : -1) {
+            double z = (double)zi / (res - 1), target[3], e;
+
+            z = z * z;
+            z = z > 1e-4 ? z : 1e-4; /* s = 0 is out of reach */
+            target[k] = z;
+            target[(k + 1) % 3] = z * xi / (res - 1);
+            target[(k + 2) % 3] = z * yi / (res - 1);
+            e = fit(md, target, c);
+            worst = e > worst ? e : worst;
+            if (zi == start && pass == 0) {
+              memcpy(c0, c, sizeof c0);
+            }
+
+            float *out = &tb->coef[coef_index(res, k, zi, yi, xi)];
+            out[0] = c[0];
+            out[1] = c[1];
+            out[2] = c[2];
+          }
+        }
+      }
+    }
+    fprintf(stderr, "table %d of 3 done\n", k + 1);
+  }
+  fprintf(stderr, "worst fit residual %.2e\n", worst);
+}
+
+/*                             LOOKUP
+
+    Coefficients for linear RGB in [0, 1]: pick the table by the
+    largest component, then interpolate trilinearly.
+
+*/
+
+static inline void rgb_to_coef(const struct coef_table *tb, const float rgb[3],
+                               float c[3]) {
+  /* Written without short-circuits or guarded divisions so that the
+     batch loop below if-converts and vectorizes. */
+  int res = tb->res;
+  float r = rgb[0], g = rgb[1], b = rgb[2];
+  int k = (r >= g) & (r >= b) ? 0 : g >= b ? 1 : 2;
+  float z = k == 0 ? r : k == 1 ? g : b;
+  float u = k == 0 ? g : k == 1 ? b : r; /* Component k + 1 */
+  float v = k == 0 ? b : k == 1 ? r : g; /* Component k + 2 */
+  float inv = 1 / (z > 1e-20f ? z : 1e-20f);
+  float fx = u * inv * (res - 1);
+  float fy = v * inv * (res - 1);
+  float fz = sqrtf(z) * (res - 1);
+  int xi = (int)fx, yi = (int)fy, zi = (int)fz;
+
+  xi = xi < res - 2 ? xi : res - 2;
+  yi = yi < res - 2 ? yi : res - 2;
+  zi = zi < res - 2 ? zi : res - 2;
+  fx -= xi;
+  fy -= yi;
+  fz -= zi;
+
+  /* int offsets from one base, which is what gather loads want. */
+  const float *p = tb->coef;
+  int o = (int)coef_index(res, k, zi, yi, xi);
+  int dx = 3, dy = 3 * res, dz = 3 * res * res;
+
+  for (int j = 0; j < 3; j++) {
+    int a = o + j;
+    float c00 = p[a] + (p[a + dx] - p[a]) * fx;
+    float c01 = p[a + dy] + (p[a + dy + dx] - p[a + dy]) * fx;
+    float c10 = p[a + dz] + (p[a + dz + dx] - p[a + dz]) * fx;
+    float c11 = p[a + dz + dy] + (p[a + dz + dy + dx] - p[a + dz + dy]) * fx;
+    float c0 = c00 + (c01 - c00) * fy, c1 = c10 + (c11 - c10) * fy;
+
+    c[j] = c0 + (c1 - c0) * fz;
+  }
+}
+
+static inline float coef_eval(const float c[3], float lambda) {
+  float t = (lambda - 380) * (1 / 400.0f);
+  float x = (c[0] * t + c[1]) * t + c[2];
+
+  return 0.5f + x / (2 * sqrtf(1 + x * x));
+}
+
+/* The renderer's inner loop: for N pixels, the reflectance at one
+   sampled wavelength each. */
+
+void rgb_to_spectrum_batch(const struct coef_table *tb,
+                           const float *__restrict rgb,
+                           const float *__restrict lambda,
+                           float *__restrict out, int n) {
+  for (int i = 0; i < n; i++) {
+    float c[3];
+
+    rgb_to_coef(tb, &rgb[3 * i], c);
+    out[i] = coef_eval(c, lambda[i]);
+  }
+}
+
+static int table_write(const struct coef_table *tb, const char *path) {
+  struct coef_header h;
+  FILE *f = fopen(path, "wb");
+  size_t n = (size_t)3 * tb->res * tb->res * tb->res * 3;
+  int ok;
+
+  if (!f) {
+    return 0;
+  }
+  memset(&h, 0, sizeof h);
+  memcpy(h.magic, "RGB2SPEC", 8);
+  h.res = tb->res;
+  memcpy(h.system, tb->system, sizeof h.system);
+  ok = fwrite(&h, sizeof h, 1, f) == 1 &&
+       fwrite(tb->coef, sizeof(float), n, f) == n;
+  return fclose(f) == 0 && ok;
+}
+
+static int table_read(struct coef_table *tb, const char *path) {
+  struct coef_header h;
+  FILE *f = fopen(path, "rb");
+  size_t n;
+  int ok;
+
+  if (!f) {
+    return 0;
+  }
+  if (fread(&h, sizeof h, 1, f) != 1 || memcmp(h.magic, "RGB2SPEC", 8) != 0 ||
+      h.res < 2 || h.res > 256) {
+    fclose(f);
+    return 0;
+  }
+  tb->res = h.res;
+  memcpy(tb->system, h.system, sizeof tb->system);
+  n = (size_t)3 * h.res * h.res * h.res * 3;
+  tb->coef = (float *)malloc(n * sizeof(float));
+  ok = fread(tb->coef, sizeof(float), n, f) == n;
+  fclose(f);
+  return ok;
+}
+
+static struct colourSystem *find_system(const char *name) {
+  static struct colourSystem *all[] = {&NTSCsystem,  &EBUsystem,
+                                       &SMPTEsystem, &HDTVsystem,
+                                       &CIEsystem,   &Rec709system};
+
+  for (int i = 0; i < 6; i++) {
+    if (strcmp(all[i]->name, name) == 0) {
+      return all[i];
+    }
+  }
+  return NULL;
+}
+
+static double now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*                              BENCH
+
+    Random linear RGB through lookup, evaluation on all 81 bands
+    and back through the forward model gives the round-trip error;
+    the batch call over one wavelength per pixel gives the speed.
+
+*/
+
+static void bench(const struct coef_table *tb, const struct model *md) {
+  enum { N = 1 << 20, CHECK = 100000 };
+  float *rgb = (float *)malloc(3 * N * sizeof(float));
+  float *lam = (float *)malloc(N * sizeof(float));
+  float *out = (float *)malloc(N * sizeof(float));
+  double max_err = 0, sum_err = 0, t0, sink = 0;
+
+  srand(1);
+  for (int i = 0; i < 3 * N; i++) {
+    rgb[i] = rand() / (float)RAND_MAX;
+  }
+  for (int i = 0; i < N; i++) {
+    lam[i] = 380 + 400.0f * rand() / RAND_MAX;
+  }
+
+  for (int i = 0; i < CHECK; i++) {
+    float c[3];
+    double cd[3], back[3], e = 0;
+
+    rgb_to_coef(tb, &rgb[3 * i], c);
+    cd[0] = c[0];
+    cd[1] = c[1];
+    cd[2] = c[2];
+    model_rgb(md, cd, back);
+    for (int k = 0; k < 3; k++) {
+      e = fmax(e, fabs(back[k] - rgb[3 * i + k]));
+    }
+    max_err = fmax(max_err, e);
+    sum_err += e;
+  }
+
+  t0 = now_ns();
+  for (int rep = 0; rep < 10; rep++) {
+    rgb_to_spectrum_batch(tb, rgb, lam, out, N);
+    sink += out[rep];
+  }
+  t0 = (now_ns() - t0) / (10.0 * N);
+
+  printf("%s, %d^3 x 3 table\n", tb->system, tb->res);
+  printf("lookup + eval: %.2f ns/pixel\n", t0);
+  printf("round trip |rgb - rgb'|: max %.4f, mean %.5f over %d colours\n",
+         max_err, sum_err / CHECK, CHECK);
+  if (sink != sink) {
+    printf("NaN in output\n");
+  }
+
+  free(rgb);
+  free(lam);
+  free(out);
+}
+
+int main(int argc, char **argv) {
+  struct coef_table tb;
+  struct model md;
+  struct colourSystem *cs;
+
+  if (argc >= 3 && strcmp(argv[1], "build") == 0) {
+    cs = find_system(argc > 3 ? argv[3] : "SMPTE");
+    tb.res = argc > 4 ? atoi(argv[4]) : 32;
+    if (!cs || tb.res < 2 || tb.res > 256) {
+      fprintf(stderr, "unknown colour system or bad resolution\n");
+      return 2;
+    }
+    snprintf(tb.system, sizeof tb.system, "%s", cs->name);
+    model_init(&md, cs);
+    table_build(&tb, &md);
+    if (!table_write(&tb, argv[2])) {
+      perror(argv[2]);
+      return 1;
+    }
+    return 0;
+  }
+
+  if (argc >= 3 && strcmp(argv[1], "bench") == 0) {
+    if (!table_read(&tb, argv[2]) || !(cs = find_system(tb.system))) {
+      fprintf(stderr, "%s: not a coefficient table\n", argv[2]);
+      return 1;
+    }
+    model_init(&md, cs);
+    bench(&tb, &md);
+    return 0;
+  }
+
+  fprintf(stderr, "usage: %s build FILE [SYSTEM [RES]] | bench FILE\n",
+          argv[0]);
+  return 2;
+}
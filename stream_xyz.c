@@ -0,0 +1,509 @@
+/*
+              Incremental XYZ for live spectrometer streams
+
+    spectrum_to_xyz() is a sum over the 81 bands of the 5 nm
+    table, so when only a few bands of a spectrum change the
+    X, Y and Z sums can be corrected by the change alone:
+
+        X += (new - old) * xBar[band]      (likewise Y and Z)
+
+    A struct xyz_stream keeps the current band values and running
+    sums for one spectrometer channel.  stream_apply() takes a
+    sparse list of band deltas in O(changed bands); every
+    RESYNC_EVERY updates the sums are recomputed from scratch so
+    rounding error in the running sums cannot grow without bound.
+    stream_emit() then gives chromaticity and RGB for the update.
+
+    The built-in test replays a synthetic kHz stream over several
+    channels, reports per-update latency, the largest drift any
+    resync corrected and the final error against
+    spectrum_to_xyz().
+
+    Build:  g++ -O2 stream_xyz.c -o stream_xyz
+
+    Usage:  stream_xyz [channels] [updates]
+
+    The colour code is copied from color_temp.c (John Walker,
+    public domain; see that file for the full credits).
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* A colour system is defined by the CIE x and y coordinates of
+   its three primary illuminants and the x and y coordinates of
+   the white point. */
+
+struct colourSystem {
+  char *name;         /* Colour system name */
+  double xRed, yRed,  /* Red x, y */
+      xGreen, yGreen, /* Green x, y */
+      xBlue, yBlue,   /* Blue x, y */
+      xWhite, yWhite, /* White point x, y */
+      gamma;          /* Gamma correction for system */
+};
+
+/* White point chromaticities. */
+
+#define IlluminantC 0.3101, 0.3162         /* For NTSC television */
+#define IlluminantD65 0.3127, 0.3291       /* For EBU and SMPTE */
+#define IlluminantE 0.33333333, 0.33333333 /* CIE equal-energy illuminant */
+
+/*  Gamma of nonlinear correction.
+
+    See Charles Poynton's ColorFAQ Item 45 and GammaFAQ Item 6 at:
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+
+*/
+
+#define GAMMA_REC709 0 /* Rec. 709 */
+
+static struct colourSystem
+    /* Name                  xRed    yRed    xGreen  yGreen  xBlue  yBlue White
+       point        Gamma   */
+    NTSCsystem = {"NTSC", 0.67, 0.33,        0.21,        0.71,
+                  0.14,   0.08, IlluminantC, GAMMA_REC709},
+    EBUsystem = {"EBU (PAL/SECAM)", 0.64,        0.33, 0.29, 0.60, 0.15, 0.06,
+                 IlluminantD65,     GAMMA_REC709},
+    SMPTEsystem = {"SMPTE", 0.630, 0.340,         0.310,       0.595,
+                   0.155,   0.070, IlluminantD65, GAMMA_REC709},
+    HDTVsystem = {"HDTV", 0.670, 0.330,         0.210,       0.710,
+                  0.150,  0.060, IlluminantD65, GAMMA_REC709},
+    CIEsystem = {"CIE",  0.7355, 0.2645,      0.2658,      0.7243,
+                 0.1669, 0.0085, IlluminantE, GAMMA_REC709},
+    Rec709system = {"CIE REC 709", 0.64, 0.33,          0.30,        0.60,
+                    0.15,          0.06, IlluminantD65, GAMMA_REC709};
+
+/*                             XYZ_TO_RGB
+
+    Given an additive tricolour system CS, defined by the CIE x
+    and y chromaticities of its three primaries (z is derived
+    trivially as 1-(x+y)), and a desired chromaticity (XC, YC,
+    ZC) in CIE space, determine the contribution of each
+    primary in a linear combination which sums to the desired
+    chromaticity.  If the  requested chromaticity falls outside
+    the Maxwell  triangle (colour gamut) formed by the three
+    primaries, one of the r, g, or b weights will be negative.
+
+    Caller can use constrain_rgb() to desaturate an
+    outside-gamut colour to the closest representation within
+    the available gamut and/or norm_rgb to normalise the RGB
+    components so the largest nonzero component has value 1.
+
+*/
+
+void xyz_to_rgb(struct colourSystem *cs, double xc, double yc, double zc,
+                double *r, double *g, double *b) {
+  double xr, yr, zr, xg, yg, zg, xb, yb, zb;
+  double xw, yw, zw;
+  double rx, ry, rz, gx, gy, gz, bx, by, bz;
+  double rw, gw, bw;
+
+  xr = cs->xRed;
+  yr = cs->yRed;
+  zr = 1 - (xr + yr);
+  xg = cs->xGreen;
+  yg = cs->yGreen;
+  zg = 1 - (xg + yg);
+  xb = cs->xBlue;
+  yb = cs->yBlue;
+  zb = 1 - (xb + yb);
+
+  xw = cs->xWhite;
+  yw = cs->yWhite;
+  zw = 1 - (xw + yw);
+
+  /* xyz -> rgb matrix, before scaling to white. */
+
+  rx = (yg * zb) - (yb * zg);
+  ry = (xb * zg) - (xg * zb);
+  rz = (xg * yb) - (xb * yg);
+  gx = (yb * zr) - (yr * zb);
+  gy = (xr * zb) - (xb * zr);
+  gz = (xb * yr) - (xr * yb);
+  bx = (yr * zg) - (yg * zr);
+  by = (xg * zr) - (xr * zg);
+  bz = (xr * yg) - (xg * yr);
+
+  /* White scaling factors.
+     Dividing by yw scales the white luminance to unity, as conventional. */
+
+  rw = ((rx * xw) + (ry * yw) + (rz * zw)) / yw;
+  gw = ((gx * xw) + (gy * yw) + (gz * zw)) / yw;
+  bw = ((bx * xw) + (by * yw) + (bz * zw)) / yw;
+
+  /* xyz -> rgb matrix, correctly scaled to white. */
+
+  rx = rx / rw;
+  ry = ry / rw;
+  rz = rz / rw;
+  gx = gx / gw;
+  gy = gy / gw;
+  gz = gz / gw;
+  bx = bx / bw;
+  by = by / bw;
+  bz = bz / bw;
+
+  /* rgb of the desired point */
+
+  *r = (rx * xc) + (ry * yc) + (rz * zc);
+  *g = (gx * xc) + (gy * yc) + (gz * zc);
+  *b = (bx * xc) + (by * yc) + (bz * zc);
+}
+
+/*                          CONSTRAIN_RGB
+
+    If the requested RGB shade contains a negative weight for
+    one of the primaries, it lies outside the colour gamut
+    accessible from the given triple of primaries.  Desaturate
+    it by adding white, equal quantities of R, G, and B, enough
+    to make RGB all positive.  The function returns 1 if the
+    components were modified, zero otherwise.
+
+*/
+
+int constrain_rgb(double *r, double *g, double *b) {
+  double w;
+
+  /* Amount of white needed is w = - min(0, *r, *g, *b) */
+
+  w = (0 < *r) ? 0 : *r;
+  w = (w < *g) ? w : *g;
+  w = (w < *b) ? w : *b;
+  w = -w;
+
+  /* Add just enough white to make r, g, b all positive. */
+
+  if (w > 0) {
+    *r += w;
+    *g += w;
+    *b += w;
+    return 1; /* Colour modified to fit RGB gamut */
+  }
+
+  return 0; /* Colour within RGB gamut */
+}
+
+/*                          NORM_RGB
+
+    Normalise RGB components so the most intense (unless all
+    are zero) has a value of 1.
+
+*/
+
+void norm_rgb(double *r, double *g, double *b) {
+#define Max(a, b) (((a) > (b)) ? (a) : (b))
+  double greatest = Max(*r, Max(*g, *b));
+
+  if (greatest > 0) {
+    *r /= greatest;
+    *g /= greatest;
+    *b /= greatest;
+  }
+#undef Max
+}
+
+/* CIE colour matching functions xBar, yBar, and zBar for
+   wavelengths from 380 through 780 nanometers, every 5
+   nanometers.  For a wavelength lambda in this range:
+
+        cie_colour_match[(lambda - 380) / 5][0] = xBar
+        cie_colour_match[(lambda - 380) / 5][1] = yBar
+        cie_colour_match[(lambda - 380) / 5][2] = zBar
+
+    To save memory, this table can be declared as floats
+    rather than doubles; (IEEE) float has enough
+    significant bits to represent the values. It's declared
+    as a double here to avoid warnings about "conversion
+    between floating-point types" from certain persnickety
+    compilers. */
+
+static double cie_colour_match[81][3] = {
+    {0.0014, 0.0000, 0.0065}, {0.0022, 0.0001, 0.0105},
+    {0.0042, 0.0001, 0.0201}, {0.0076, 0.0002, 0.0362},
+    {0.0143, 0.0004, 0.0679}, {0.0232, 0.0006, 0.1102},
+    {0.0435, 0.0012, 0.2074}, {0.0776, 0.0022, 0.3713},
+    {0.1344, 0.0040, 0.6456}, {0.2148, 0.0073, 1.0391},
+    {0.2839, 0.0116, 1.3856}, {0.3285, 0.0168, 1.6230},
+    {0.3483, 0.0230, 1.7471}, {0.3481, 0.0298, 1.7826},
+    {0.3362, 0.0380, 1.7721}, {0.3187, 0.0480, 1.7441},
+    {0.2908, 0.0600, 1.6692}, {0.2511, 0.0739, 1.5281},
+    {0.1954, 0.0910, 1.2876}, {0.1421, 0.1126, 1.0419},
+    {0.0956, 0.1390, 0.8130}, {0.0580, 0.1693, 0.6162},
+    {0.0320, 0.2080, 0.4652}, {0.0147, 0.2586, 0.3533},
+    {0.0049, 0.3230, 0.2720}, {0.0024, 0.4073, 0.2123},
+    {0.0093, 0.5030, 0.1582}, {0.0291, 0.6082, 0.1117},
+    {0.0633, 0.7100, 0.0782}, {0.1096, 0.7932, 0.0573},
+    {0.1655, 0.8620, 0.0422}, {0.2257, 0.9149, 0.0298},
+    {0.2904, 0.9540, 0.0203}, {0.3597, 0.9803, 0.0134},
+    {0.4334, 0.9950, 0.0087}, {0.5121, 1.0000, 0.0057},
+    {0.5945, 0.9950, 0.0039}, {0.6784, 0.9786, 0.0027},
+    {0.7621, 0.9520, 0.0021}, {0.8425, 0.9154, 0.0018},
+    {0.9163, 0.8700, 0.0017}, {0.9786, 0.8163, 0.0014},
+    {1.0263, 0.7570, 0.0011}, {1.0567, 0.6949, 0.0010},
+    {1.0622, 0.6310, 0.0008}, {1.0456, 0.5668, 0.0006},
+    {1.0026, 0.5030, 0.0003}, {0.9384, 0.4412, 0.0002},
+    {0.8544, 0.3810, 0.0002}, {0.7514, 0.3210, 0.0001},
+    {0.6424, 0.2650, 0.0000}, {0.5419, 0.2170, 0.0000},
+    {0.4479, 0.1750, 0.0000}, {0.3608, 0.1382, 0.0000},
+    {0.2835, 0.1070, 0.0000}, {0.2187, 0.0816, 0.0000},
+    {0.1649, 0.0610, 0.0000}, {0.1212, 0.0446, 0.0000},
+    {0.0874, 0.0320, 0.0000}, {0.0636, 0.0232, 0.0000},
+    {0.0468, 0.0170, 0.0000}, {0.0329, 0.0119, 0.0000},
+    {0.0227, 0.0082, 0.0000}, {0.0158, 0.0057, 0.0000},
+    {0.0114, 0.0041, 0.0000}, {0.0081, 0.0029, 0.0000},
+    {0.0058, 0.0021, 0.0000}, {0.0041, 0.0015, 0.0000},
+    {0.0029, 0.0010, 0.0000}, {0.0020, 0.0007, 0.0000},
+    {0.0014, 0.0005, 0.0000}, {0.0010, 0.0004, 0.0000},
+    {0.0007, 0.0002, 0.0000}, {0.0005, 0.0002, 0.0000},
+    {0.0003, 0.0001, 0.0000}, {0.0002, 0.0001, 0.0000},
+    {0.0002, 0.0001, 0.0000}, {0.0001, 0.0000, 0.0000},
+    {0.0001, 0.0000, 0.0000}, {0.0001, 0.0000, 0.0000},
+    {0.0000, 0.0000, 0.0000}};
+
+/*                          SPECTRUM_TO_XYZ
+
+    Calculate the CIE X, Y, and Z coordinates corresponding to
+    a light source with spectral distribution given by  the
+    function SPEC_INTENS, which is called with a series of
+    wavelengths between 380 and 780 nm (the argument is
+    expressed in meters), which returns emittance at  that
+    wavelength in arbitrary units.  The chromaticity
+    coordinates of the spectrum are returned in the x, y, and z
+    arguments which respect the identity:
+
+            x + y + z = 1.
+*/
+
+void spectrum_to_xyz(double (*spec_intens)(double wavelength), double *x,
+                     double *y, double *z) {
+  int i;
+  double lambda, X = 0, Y = 0, Z = 0, XYZ;
+
+  for (i = 0, lambda = 380; lambda < 780.1; i++, lambda += 5) {
+    double Me;
+
+    Me = (*spec_intens)(lambda);
+    X += Me * cie_colour_match[i][0];
+    Y += Me * cie_colour_match[i][1];
+    Z += Me * cie_colour_match[i][2];
+  }
+  XYZ = (X + Y + Z);
+  *x = X / XYZ;
+  *y = Y / XYZ;
+  *z = Z / XYZ;
+}
+
+/*                            BB_SPECTRUM
+
+    Calculate, by Planck's radiation law, the emittance of a black body
+    of temperature bbTemp at the given wavelength (in metres).  */
+
+double bbTemp = 5000; /* Hidden temperature argument
+                         to BB_SPECTRUM. */
+double bb_spectrum(double wavelength) {
+  double wlm = wavelength * 1e-9; /* Wavelength in meters */
+
+  return (3.74183e-16 * pow(wlm, -5.0)) /
+         (exp(1.4388e-2 / (wlm * bbTemp)) - 1.0);
+}
+double white(double wavelength) { return 1; }
+
+/*                            XYZ_STREAM                            */
+
+#define BANDS 81 /* 380 to 780 nm every 5 nm, as in spectrum_to_xyz() */
+#define RESYNC_EVERY 4096
+
+struct band_delta {
+  int band;     /* 0 .. BANDS - 1, i.e. (lambda - 380) / 5 */
+  double delta; /* Change in emittance */
+};
+
+struct xyz_stream {
+  double band[BANDS]; /* Current emittance of each band */
+  double X, Y, Z;     /* Running sums over band[] */
+  int since_resync;
+  long resyncs;
+  double max_drift; /* Largest relative correction made by a resync */
+};
+
+struct stream_colour {
+  double x, y;    /* CIE 1931 chromaticity */
+  double r, g, b; /* Constrained, normalised linear RGB */
+};
+
+/* Recompute the sums in the same order as spectrum_to_xyz(). */
+
+static void stream_integrate(const struct xyz_stream *s, double *X,
+                             double *Y, double *Z) {
+  *X = *Y = *Z = 0;
+  for (int i = 0; i < BANDS; i++) {
+    *X += s->band[i] * cie_colour_match[i][0];
+    *Y += s->band[i] * cie_colour_match[i][1];
+    *Z += s->band[i] * cie_colour_match[i][2];
+  }
+}
+
+void stream_reset(struct xyz_stream *s, const double *spectrum) {
+  for (int i = 0; i < BANDS; i++) {
+    s->band[i] = spectrum[i];
+  }
+  stream_integrate(s, &s->X, &s->Y, &s->Z);
+  s->since_resync = 0;
+  s->resyncs = 0;
+  s->max_drift = 0;
+}
+
+void stream_resync(struct xyz_stream *s) {
+  double X, Y, Z, drift;
+
+  stream_integrate(s, &X, &Y, &Z);
+  drift = (fabs(X - s->X) + fabs(Y - s->Y) + fabs(Z - s->Z)) / (X + Y + Z);
+  s->max_drift = drift > s->max_drift ? drift : s->max_drift;
+  s->X = X;
+  s->Y = Y;
+  s->Z = Z;
+  s->since_resync = 0;
+  s->resyncs++;
+}
+
+void stream_apply(struct xyz_stream *s, const struct band_delta *d, int n) {
+  for (int i = 0; i < n; i++) {
+    const double *cmf = cie_colour_match[d[i].band];
+
+    s->band[d[i].band] += d[i].delta;
+    s->X += d[i].delta * cmf[0];
+    s->Y += d[i].delta * cmf[1];
+    s->Z += d[i].delta * cmf[2];
+  }
+  if (++s->since_resync >= RESYNC_EVERY) {
+    stream_resync(s);
+  }
+}
+
+/* M is the xyz_to_rgb() matrix for the colour system, row major. */
+
+void stream_emit(const struct xyz_stream *s, const double m[9],
+                 struct stream_colour *c) {
+  double sum = s->X + s->Y + s->Z;
+  double x = s->X / sum, y = s->Y / sum, z = s->Z / sum;
+
+  c->x = x;
+  c->y = y;
+  c->r = m[0] * x + m[1] * y + m[2] * z;
+  c->g = m[3] * x + m[4] * y + m[5] * z;
+  c->b = m[6] * x + m[7] * y + m[8] * z;
+  constrain_rgb(&c->r, &c->g, &c->b);
+  norm_rgb(&c->r, &c->g, &c->b);
+}
+
+/*                          BUILT-IN TEST                           */
+
+double *streamBands; /* Hidden argument to BAND_SPECTRUM */
+double band_spectrum(double wavelength) {
+  return streamBands[(int)((wavelength - 380) / 5 + 0.5)];
+}
+
+static double now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+  int channels = argc > 1 ? atoi(argv[1]) : 16;
+  long updates = argc > 2 ? atol(argv[2]) : 2000000;
+  struct colourSystem *cs = &SMPTEsystem;
+  struct xyz_stream *streams =
+      (struct xyz_stream *)malloc(channels * sizeof(struct xyz_stream));
+  double *lat = (double *)malloc(updates * sizeof(double));
+  double m[9], spectrum[BANDS], t0, total = 0, max_err = 0, max_drift = 0;
+  double sink = 0;
+  long resyncs = 0;
+
+  if (channels < 1 || updates < 1) {
+    fprintf(stderr, "usage: %s [channels] [updates]\n", argv[0]);
+    return 2;
+  }
+
+  xyz_to_rgb(cs, 1, 0, 0, &m[0], &m[3], &m[6]);
+  xyz_to_rgb(cs, 0, 1, 0, &m[1], &m[4], &m[7]);
+  xyz_to_rgb(cs, 0, 0, 1, &m[2], &m[5], &m[8]);
+
+  /* Each channel starts on a black body between 2000 and 8000 K. */
+  for (int c = 0; c < channels; c++) {
+    bbTemp = 2000 + 6000.0 * c / channels;
+    for (int i = 0; i < BANDS; i++) {
+      spectrum[i] = bb_spectrum(380 + 5 * i);
+    }
+    stream_reset(&streams[c], spectrum);
+  }
+
+  /* Most updates nudge one to four bands by up to 0.1%; they are
+     generated up front so only the stream itself is timed. */
+  srand(1);
+  struct band_delta *deltas =
+      (struct band_delta *)malloc(4 * updates * sizeof(struct band_delta));
+  int *counts = (int *)malloc(updates * sizeof(int));
+  int *chan = (int *)malloc(updates * sizeof(int));
+  for (long u = 0; u < updates; u++) {
+    chan[u] = rand() % channels;
+    counts[u] = 1 + rand() % 4;
+    for (int k = 0; k < counts[u]; k++) {
+      struct band_delta *d = &deltas[4 * u + k];
+
+      d->band = rand() % BANDS;
+      d->delta = streams[chan[u]].band[d->band] * 1e-3 *
+                 (2.0 * rand() / RAND_MAX - 1);
+    }
+  }
+
+  for (long u = 0; u < updates; u++) {
+    struct stream_colour col;
+
+    t0 = now_ns();
+    stream_apply(&streams[chan[u]], &deltas[4 * u], counts[u]);
+    stream_emit(&streams[chan[u]], m, &col);
+    lat[u] = now_ns() - t0;
+    total += lat[u];
+    sink += col.r;
+  }
+
+  for (int c = 0; c < channels; c++) {
+    double x, y, z, sum = streams[c].X + streams[c].Y + streams[c].Z;
+    double X = streams[c].X / sum, Y = streams[c].Y / sum;
+
+    streamBands = streams[c].band;
+    spectrum_to_xyz(band_spectrum, &x, &y, &z);
+    max_err = fmax(max_err, fmax(fabs(X - x), fabs(Y - y)));
+    max_drift = fmax(max_drift, streams[c].max_drift);
+    resyncs += streams[c].resyncs;
+  }
+
+  qsort(lat, updates, sizeof(double), cmp_double);
+  printf("%ld updates over %d channels, %ld resyncs\n", updates, channels,
+         resyncs);
+  printf("latency: mean %.0f ns, p50 %.0f ns, p99 %.0f ns, max %.0f ns\n",
+         total / updates, lat[updates / 2], lat[(long)(updates * 0.99)],
+         lat[updates - 1]);
+  printf("largest drift corrected by a resync: %.2e (relative)\n", max_drift);
+  printf("final x, y error against spectrum_to_xyz(): %.2e\n", max_err);
+
+  free(streams);
+  free(lat);
+  free(deltas);
+  free(counts);
+  free(chan);
+  return sink != sink; /* NaN would mean a broken stream */
+}
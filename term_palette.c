@@ -0,0 +1,456 @@
+/*
+                Terminal palette fallback output
+
+    rainbow.c and friends paint with 24-bit escapes,
+    \033[48;2;r;g;bm, which many consoles and serial terminals do
+    not understand.  This maps 8-bit RGB onto the xterm 256-colour
+    palette (the 6x6x6 cube and the grey ramp, entries 16..255; the
+    first 16 are left out because every terminal theme redefines
+    them) or onto the 16 basic colours.
+
+    The nearest palette entry is looked up, not searched for: a
+    32x32x32 grid over RGB, 5 bits per channel, holds the palette
+    index nearest to the centre of each cell.  It is built once,
+    after which a frame is quantized in one pass of shifts and
+    loads.  Nearness is either plain distance in encoded RGB or,
+    with "luv", CIE 1976 L*u*v* distance, where u', v' come from
+    xy_to_upvp() and the RGB is taken as sRGB (Rec. 709 primaries
+    with the sRGB transfer curve).
+
+    Build:  g++ -O3 -march=native term_palette.c -o term_palette
+
+    Usage:  term_palette [24 | 256 | 16] [luv]
+            term_palette bench
+
+    The first form prints a rainbow the way rainbow.c does, plus a
+    grey ramp, in the chosen mode.  bench times the quantization of
+    a 1920x1080 frame and measures how far the grid lookup strays
+    from an exhaustive search of the palette.
+
+    The colour code is copied from color_temp.c (John Walker,
+    public domain; see that file for the full credits).
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* A colour system is defined by the CIE x and y coordinates of
+   its three primary illuminants and the x and y coordinates of
+   the white point. */
+
+struct colourSystem {
+  char *name;         /* Colour system name */
+  double xRed, yRed,  /* Red x, y */
+      xGreen, yGreen, /* Green x, y */
+      xBlue, yBlue,   /* Blue x, y */
+      xWhite, yWhite, /* White point x, y */
+      gamma;          /* Gamma correction for system */
+};
+
+/* White point chromaticities. */
+
+#define IlluminantC 0.3101, 0.3162         /* For NTSC television */
+#define IlluminantD65 0.3127, 0.3291       /* For EBU and SMPTE */
+#define IlluminantE 0.33333333, 0.33333333 /* CIE equal-energy illuminant */
+
+/*  Gamma of nonlinear correction.
+
+    See Charles Poynton's ColorFAQ Item 45 and GammaFAQ Item 6 at:
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+
+*/
+
+#define GAMMA_REC709 0 /* Rec. 709 */
+
+static struct colourSystem
+    /* Name                  xRed    yRed    xGreen  yGreen  xBlue  yBlue White
+       point        Gamma   */
+    NTSCsystem = {"NTSC", 0.67, 0.33,        0.21,        0.71,
+                  0.14,   0.08, IlluminantC, GAMMA_REC709},
+    EBUsystem = {"EBU (PAL/SECAM)", 0.64,        0.33, 0.29, 0.60, 0.15, 0.06,
+                 IlluminantD65,     GAMMA_REC709},
+    SMPTEsystem = {"SMPTE", 0.630, 0.340,         0.310,       0.595,
+                   0.155,   0.070, IlluminantD65, GAMMA_REC709},
+    HDTVsystem = {"HDTV", 0.670, 0.330,         0.210,       0.710,
+                  0.150,  0.060, IlluminantD65, GAMMA_REC709},
+    CIEsystem = {"CIE",  0.7355, 0.2645,      0.2658,      0.7243,
+                 0.1669, 0.0085, IlluminantE, GAMMA_REC709},
+    Rec709system = {"CIE REC 709", 0.64, 0.33,          0.30,        0.60,
+                    0.15,          0.06, IlluminantD65, GAMMA_REC709};
+
+/*                          XY_TO_UPVP
+
+    Given 1931 chromaticities x, y, determine 1976 coordinates u', v'
+
+*/
+
+void xy_to_upvp(double xc, double yc, double *up, double *vp) {
+  *up = (4 * xc) / ((-2 * xc) + (12 * yc) + 3);
+  *vp = (9 * yc) / ((-2 * xc) + (12 * yc) + 3);
+}
+
+
+/*                          RGB_TO_XYZ_MATRIX
+
+    The inverse of what xyz_to_rgb() does: the matrix taking linear
+    R, G, B of colour system CS to X, Y, Z, scaled so that
+    R = G = B = 1 is the white point with Y = 1.
+
+*/
+
+void rgb_to_xyz_matrix(struct colourSystem *cs, double m[3][3]) {
+  double p[3][3] = {
+      {cs->xRed, cs->xGreen, cs->xBlue},
+      {cs->yRed, cs->yGreen, cs->yBlue},
+      {1 - cs->xRed - cs->yRed, 1 - cs->xGreen - cs->yGreen,
+       1 - cs->xBlue - cs->yBlue}};
+  double w[3] = {cs->xWhite / cs->yWhite, 1,
+                 (1 - cs->xWhite - cs->yWhite) / cs->yWhite};
+  double inv[3][3], det, s[3];
+
+  /* Cofactor inverse of the primaries' chromaticities. */
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      int i1 = (j + 1) % 3, i2 = (j + 2) % 3, j1 = (i + 1) % 3,
+          j2 = (i + 2) % 3;
+      inv[i][j] = p[i1][j1] * p[i2][j2] - p[i1][j2] * p[i2][j1];
+    }
+  }
+  det = p[0][0] * inv[0][0] + p[0][1] * inv[1][0] + p[0][2] * inv[2][0];
+
+  /* Primary intensities that add up to the white point. */
+  for (int i = 0; i < 3; i++) {
+    s[i] = (inv[i][0] * w[0] + inv[i][1] * w[1] + inv[i][2] * w[2]) / det;
+  }
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      m[i][j] = p[i][j] * s[j];
+    }
+  }
+}
+
+/*                             PALETTES
+
+    xterm's default values.  The cube levels are 0, 95, 135, 175,
+    215, 255 and the greys 8, 18, ..., 238.
+
+*/
+
+enum term_mode { MODE_24BIT, MODE_256, MODE_16 };
+
+struct palette {
+  int first, count; /* Palette indices first .. first + count - 1 */
+  unsigned char rgb[256][3];
+};
+
+static const unsigned char basic16[16][3] = {
+    {0, 0, 0},       {205, 0, 0},     {0, 205, 0},     {205, 205, 0},
+    {0, 0, 238},     {205, 0, 205},   {0, 205, 205},   {229, 229, 229},
+    {127, 127, 127}, {255, 0, 0},     {0, 255, 0},     {255, 255, 0},
+    {92, 92, 255},   {255, 0, 255},   {0, 255, 255},   {255, 255, 255}};
+
+static void make_palette(enum term_mode mode, struct palette *pal) {
+  static const unsigned char level[6] = {0, 95, 135, 175, 215, 255};
+
+  memcpy(pal->rgb, basic16, sizeof basic16);
+  for (int i = 0; i < 216; i++) {
+    pal->rgb[16 + i][0] = level[i / 36];
+    pal->rgb[16 + i][1] = level[i / 6 % 6];
+    pal->rgb[16 + i][2] = level[i % 6];
+  }
+  for (int i = 0; i < 24; i++) {
+    pal->rgb[232 + i][0] = pal->rgb[232 + i][1] = pal->rgb[232 + i][2] =
+        8 + 10 * i;
+  }
+  pal->first = mode == MODE_16 ? 0 : 16;
+  pal->count = mode == MODE_16 ? 16 : 240;
+}
+
+/*                           DISTANCES
+
+    Colours are compared as points: either encoded R, G, B as they
+    are, or L*, u*, v* with u* = 13 L* (u' - u'n) and likewise v*,
+    which is where the u', v' from xy_to_upvp() come in.
+
+*/
+
+static double srgb_to_linear(double c) {
+  return c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+}
+
+static void rgb_to_luv(double m[3][3], double r, double g, double b,
+                       double luv[3]) {
+  double X, Y, Z, sum, up, vp, upn, vpn, L;
+  struct colourSystem *cs = &Rec709system;
+
+  r = srgb_to_linear(r / 255);
+  g = srgb_to_linear(g / 255);
+  b = srgb_to_linear(b / 255);
+  X = m[0][0] * r + m[0][1] * g + m[0][2] * b;
+  Y = m[1][0] * r + m[1][1] * g + m[1][2] * b;
+  Z = m[2][0] * r + m[2][1] * g + m[2][2] * b;
+
+  xy_to_upvp(cs->xWhite, cs->yWhite, &upn, &vpn);
+  sum = X + Y + Z;
+  if (sum > 0) {
+    xy_to_upvp(X / sum, Y / sum, &up, &vp);
+  } else {
+    up = upn; /* Black has no chromaticity; call it neutral */
+    vp = vpn;
+  }
+  L = Y > 216.0 / 24389 ? 116 * cbrt(Y) - 16 : Y * 24389.0 / 27;
+  luv[0] = L;
+  luv[1] = 13 * L * (up - upn);
+  luv[2] = 13 * L * (vp - vpn);
+}
+
+/* Points in which to measure distance for each palette entry and any
+   RGB, as chosen by PERCEPTUAL. */
+
+struct metric {
+  int perceptual;
+  double m[3][3];
+  double pal[256][3];
+};
+
+static void to_point(const struct metric *mt, double r, double g, double b,
+                     double p[3]) {
+  if (mt->perceptual) {
+    rgb_to_luv((double(*)[3])mt->m, r, g, b, p);
+  } else {
+    p[0] = r;
+    p[1] = g;
+    p[2] = b;
+  }
+}
+
+static void make_metric(const struct palette *pal, int perceptual,
+                        struct metric *mt) {
+  mt->perceptual = perceptual;
+  rgb_to_xyz_matrix(&Rec709system, mt->m);
+  for (int i = pal->first; i < pal->first + pal->count; i++) {
+    to_point(mt, pal->rgb[i][0], pal->rgb[i][1], pal->rgb[i][2], mt->pal[i]);
+  }
+}
+
+static int nearest(const struct palette *pal, const struct metric *mt,
+                   double r, double g, double b, double *dist) {
+  double p[3], best = 1e30;
+  int besti = pal->first;
+
+  to_point(mt, r, g, b, p);
+  for (int i = pal->first; i < pal->first + pal->count; i++) {
+    double d0 = p[0] - mt->pal[i][0], d1 = p[1] - mt->pal[i][1],
+           d2 = p[2] - mt->pal[i][2], d = d0 * d0 + d1 * d1 + d2 * d2;
+
+    if (d < best) {
+      best = d;
+      besti = i;
+    }
+  }
+  if (dist) {
+    *dist = sqrt(best);
+  }
+  return besti;
+}
+
+/*                          NEAREST-COLOUR GRID
+
+    Cell (r >> 3, g >> 3, b >> 3) holds the palette entry nearest to
+    the middle of the cell, r = 8 * (r >> 3) + 3.5 and so on.
+
+*/
+
+#define GRID_BITS 5
+#define GRID_SIZE (1 << GRID_BITS)
+#define GRID_SHIFT (8 - GRID_BITS)
+
+static unsigned char grid[GRID_SIZE * GRID_SIZE * GRID_SIZE];
+
+static void build_grid(const struct palette *pal, const struct metric *mt) {
+  double half = (1 << GRID_SHIFT) / 2.0 - 0.5;
+
+  for (int r = 0; r < GRID_SIZE; r++) {
+    for (int g = 0; g < GRID_SIZE; g++) {
+      for (int b = 0; b < GRID_SIZE; b++) {
+        grid[(r << 2 * GRID_BITS) | (g << GRID_BITS) | b] =
+            nearest(pal, mt, (r << GRID_SHIFT) + half,
+                    (g << GRID_SHIFT) + half, (b << GRID_SHIFT) + half, NULL);
+      }
+    }
+  }
+}
+
+/* Palette indices for N packed RGB pixels.  Cell numbers are worked
+   out a block at a time, which vectorizes; there is no byte gather,
+   so the grid loads that follow are plain scalar ones. */
+
+void quantize_frame(const unsigned char *rgb, int n, unsigned char *out) {
+  unsigned short cell[256];
+
+  for (int base = 0; base < n; base += 256) {
+    int m = n - base < 256 ? n - base : 256;
+    const unsigned char *p = rgb + 3 * base;
+
+    for (int i = 0; i < m; i++) {
+      cell[i] = (p[3 * i] >> GRID_SHIFT) << 2 * GRID_BITS |
+                (p[3 * i + 1] >> GRID_SHIFT) << GRID_BITS |
+                p[3 * i + 2] >> GRID_SHIFT;
+    }
+    for (int i = 0; i < m; i++) {
+      out[base + i] = grid[cell[i]];
+    }
+  }
+}
+
+/*                             EMIT_ROW
+
+    Write N pixels as background-coloured blank pairs, sending an
+    escape only where the colour changes.
+
+*/
+
+static void emit_row(enum term_mode mode, const unsigned char *rgb,
+                     const unsigned char *idx, int n) {
+  int last = -1;
+
+  for (int i = 0; i < n; i++) {
+    int c = mode == MODE_24BIT
+                ? rgb[3 * i] << 16 | rgb[3 * i + 1] << 8 | rgb[3 * i + 2]
+                : idx[i];
+
+    if (c != last) {
+      if (mode == MODE_24BIT) {
+        printf("\033[48;2;%d;%d;%dm", rgb[3 * i], rgb[3 * i + 1],
+               rgb[3 * i + 2]);
+      } else if (mode == MODE_256) {
+        printf("\033[48;5;%dm", c);
+      } else {
+        printf("\033[%dm", c < 8 ? 40 + c : 100 + c - 8);
+      }
+      last = c;
+    }
+    printf("  ");
+  }
+  printf("\033[0m\n");
+}
+
+/*                          BUILT-IN DEMO                           */
+
+#define WIDTH 100
+
+/* Same colours as print_rainbow() in rainbow.c. */
+
+static void rainbow_row(float shift, float speed, unsigned char *rgb) {
+  for (int i = 0; i < WIDTH; i++) {
+    rgb[3 * i] = (sin(speed * i + 0 + shift) + 1) * 127;
+    rgb[3 * i + 1] = (sin(speed * i + ((2 * M_PI) / 3) + shift) + 1) * 127;
+    rgb[3 * i + 2] = (sin(speed * i + ((4 * M_PI) / 3) + shift) + 1) * 127;
+  }
+}
+
+static double now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(enum term_mode mode, int perceptual) {
+  static struct palette pal;
+  static struct metric mt;
+  int n = 1920 * 1080, reps = 50;
+  unsigned char *rgb = (unsigned char *)malloc(3 * n),
+                *idx = (unsigned char *)malloc(n);
+  double t0, t, worst = 0, extra = 0;
+
+  make_palette(mode, &pal);
+  make_metric(&pal, perceptual, &mt);
+  t0 = now_ns();
+  build_grid(&pal, &mt);
+  t = now_ns() - t0;
+
+  srand(1);
+  for (int i = 0; i < 3 * n; i++) {
+    rgb[i] = rand() & 255;
+  }
+
+  /* How much farther the grid's choice is than the true nearest,
+     over a sample of the pixels. */
+  for (int i = 0; i < n; i += 97) {
+    double best, got, *p, q[3];
+
+    quantize_frame(rgb + 3 * i, 1, idx);
+    nearest(&pal, &mt, rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2], &best);
+    to_point(&mt, rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2], q);
+    p = mt.pal[idx[0]];
+    got = sqrt((q[0] - p[0]) * (q[0] - p[0]) + (q[1] - p[1]) * (q[1] - p[1]) +
+               (q[2] - p[2]) * (q[2] - p[2]));
+    extra += got - best;
+    worst = got - best > worst ? got - best : worst;
+  }
+
+  t0 = now_ns();
+  for (int r = 0; r < reps; r++) {
+    quantize_frame(rgb, n, idx);
+  }
+  printf("%3d colours, %s: grid built in %.1f ms, %.2f ns/pixel, "
+         "excess distance mean %.3f max %.3f\n",
+         pal.count, perceptual ? "L*u*v*" : "RGB   ", t / 1e6,
+         (now_ns() - t0) / ((double)reps * n), extra / (n / 97 + 1), worst);
+  free(rgb);
+  free(idx);
+}
+
+int main(int argc, char **argv) {
+  enum term_mode mode = MODE_256;
+  int perceptual = 0;
+  static struct palette pal;
+  static struct metric mt;
+  unsigned char rgb[3 * WIDTH], idx[WIDTH];
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "bench") == 0) {
+      for (int p = 0; p < 2; p++) {
+        bench(MODE_256, p);
+        bench(MODE_16, p);
+      }
+      return 0;
+    } else if (strcmp(argv[i], "24") == 0) {
+      mode = MODE_24BIT;
+    } else if (strcmp(argv[i], "256") == 0) {
+      mode = MODE_256;
+    } else if (strcmp(argv[i], "16") == 0) {
+      mode = MODE_16;
+    } else if (strcmp(argv[i], "luv") == 0) {
+      perceptual = 1;
+    } else {
+      fprintf(stderr, "Usage: term_palette [24 | 256 | 16] [luv] | bench\n");
+      return 2;
+    }
+  }
+
+  if (mode != MODE_24BIT) {
+    make_palette(mode, &pal);
+    make_metric(&pal, perceptual, &mt);
+    build_grid(&pal, &mt);
+  }
+
+  for (int row = 0; row < 4; row++) {
+    rainbow_row(row * 0.5f, 0.1, rgb);
+    quantize_frame(rgb, WIDTH, idx);
+    emit_row(mode, rgb, idx, WIDTH);
+  }
+  for (int i = 0; i < WIDTH; i++) {
+    rgb[3 * i] = rgb[3 * i + 1] = rgb[3 * i + 2] = i * 255 / (WIDTH - 1);
+  }
+  quantize_frame(rgb, WIDTH, idx);
+  emit_row(mode, rgb, idx, WIDTH);
+
+  return 0;
+}
@@ -0,0 +1,925 @@
+/*
+                 Work-stealing batch conversion scheduler
+
+    Every workload in these programs is a serial loop, over
+    temperatures in color_temp.c or wavelengths in real_rainbow.c.
+    A service taking requests from many clients sees a mix of
+    single colours and whole images or spectral cubes.  This
+    scheduler runs such batches on a pool of worker threads:
+
+      - A job is a function over an index range 0..n.  If its
+        estimated cost (n times the cost per item) is below about
+        20 us, it runs inline on the calling thread.  Handing it
+        to a worker and waking the caller again would cost more
+        than the work.
+      - Larger jobs go on a shared injection queue.  The worker
+        that takes one splits it in halves, keeping one half and
+        pushing the other on its own deque, until the piece left
+        is one chunk.  A chunk is sized to fit its input and output
+        in L1 (32 KB) and to take no more than about 50 us.
+      - Idle workers steal from the top of other workers' deques,
+        where the largest pieces are.  The deques are Chase-Lev:
+        the owner pushes and pops at the bottom without locks, and
+        thieves take from the top with a compare-and-swap.
+      - Each worker counts its busy time, chunks, items and steals,
+        so utilization can be reported.
+
+    Build:  g++ -O2 -pthread work_steal.c -o work_steal
+
+    Usage:  work_steal [workers [clients [seconds]]]
+
+    The test measures the cost per item of two conversions
+    (black body temperature to RGB via spectrum_to_xyz(), and
+    wavelength to RGB from the interpolated CIE table). Several
+    client threads then submit a random mix of 1-item, 2000-item,
+    10000-item and 1000000-item jobs for a few seconds, and the test
+    reports latency per job size and per-worker statistics.
+
+    The colour code is copied from color_temp.c (John Walker,
+    public domain; see that file for the full credits); bbTemp is
+    thread local here so workers can convert temperatures at the
+    same time.
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A colour system is defined by the CIE x and y coordinates of
+   its three primary illuminants and the x and y coordinates of
+   the white point. */
+
+struct colourSystem {
+  char *name;         /* Colour system name */
+  double xRed, yRed,  /* Red x, y */
+      xGreen, yGreen, /* Green x, y */
+      xBlue, yBlue,   /* Blue x, y */
+      xWhite, yWhite, /* White point x, y */
+      gamma;          /* Gamma correction for system */
+};
+
+/* White point chromaticities. */
+
+#define IlluminantC 0.3101, 0.3162         /* For NTSC television */
+#define IlluminantD65 0.3127, 0.3291       /* For EBU and SMPTE */
+#define IlluminantE 0.33333333, 0.33333333 /* CIE equal-energy illuminant */
+
+/*  Gamma of nonlinear correction.
+
+    See Charles Poynton's ColorFAQ Item 45 and GammaFAQ Item 6 at:
+
+       http://www.poynton.com/ColorFAQ.html
+       http://www.poynton.com/GammaFAQ.html
+
+*/
+
+#define GAMMA_REC709 0 /* Rec. 709 */
+
+static struct colourSystem
+    /* Name                  xRed    yRed    xGreen  yGreen  xBlue  yBlue White
+       point        Gamma   */
+    NTSCsystem = {"NTSC", 0.67, 0.33,        0.21,        0.71,
+                  0.14,   0.08, IlluminantC, GAMMA_REC709},
+    EBUsystem = {"EBU (PAL/SECAM)", 0.64,        0.33, 0.29, 0.60, 0.15, 0.06,
+                 IlluminantD65,     GAMMA_REC709},
+    SMPTEsystem = {"SMPTE", 0.630, 0.340,         0.310,       0.595,
+                   0.155,   0.070, IlluminantD65, GAMMA_REC709},
+    HDTVsystem = {"HDTV", 0.670, 0.330,         0.210,       0.710,
+                  0.150,  0.060, IlluminantD65, GAMMA_REC709},
+    CIEsystem = {"CIE",  0.7355, 0.2645,      0.2658,      0.7243,
+                 0.1669, 0.0085, IlluminantE, GAMMA_REC709},
+    Rec709system = {"CIE REC 709", 0.64, 0.33,          0.30,        0.60,
+                    0.15,          0.06, IlluminantD65, GAMMA_REC709};
+
+/*                             XYZ_TO_RGB
+
+    Given an additive tricolour system CS, defined by the CIE x
+    and y chromaticities of its three primaries (z is derived
+    trivially as 1-(x+y)), and a desired chromaticity (XC, YC,
+    ZC) in CIE space, determine the contribution of each
+    primary in a linear combination which sums to the desired
+    chromaticity.  If the  requested chromaticity falls outside
+    the Maxwell  triangle (colour gamut) formed by the three
+    primaries, one of the r, g, or b weights will be negative.
+
+    Caller can use constrain_rgb() to desaturate an
+    outside-gamut colour to the closest representation within
+    the available gamut and/or norm_rgb to normalise the RGB
+    components so the largest nonzero component has value 1.
+
+*/
+
+void xyz_to_rgb(struct colourSystem *cs, double xc, double yc, double zc,
+                double *r, double *g, double *b) {
+  double xr, yr, zr, xg, yg, zg, xb, yb, zb;
+  double xw, yw, zw;
+  double rx, ry, rz, gx, gy, gz, bx, by, bz;
+  double rw, gw, bw;
+
+  xr = cs->xRed;
+  yr = cs->yRed;
+  zr = 1 - (xr + yr);
+  xg = cs->xGreen;
+  yg = cs->yGreen;
+  zg = 1 - (xg + yg);
+  xb = cs->xBlue;
+  yb = cs->yBlue;
+  zb = 1 - (xb + yb);
+
+  xw = cs->xWhite;
+  yw = cs->yWhite;
+  zw = 1 - (xw + yw);
+
+  /* xyz -> rgb matrix, before scaling to white. */
+
+  rx = (yg * zb) - (yb * zg);
+  ry = (xb * zg) - (xg * zb);
+  rz = (xg * yb) - (xb * yg);
+  gx = (yb * zr) - (yr * zb);
+  gy = (xr * zb) - (xb * zr);
+  gz = (xb * yr) - (xr * yb);
+  bx = (yr * zg) - (yg * zr);
+  by = (xg * zr) - (xr * zg);
+  bz = (xr * yg) - (xg * yr);
+
+  /* White scaling factors.
+     Dividing by yw scales the white luminance to unity, as conventional. */
+
+  rw = ((rx * xw) + (ry * yw) + (rz * zw)) / yw;
+  gw = ((gx * xw) + (gy * yw) + (gz * zw)) / yw;
+  bw = ((bx * xw) + (by * yw) + (bz * zw)) / yw;
+
+  /* xyz -> rgb matrix, correctly scaled to white. */
+
+  rx = rx / rw;
+  ry = ry / rw;
+  rz = rz / rw;
+  gx = gx / gw;
+  gy = gy / gw;
+  gz = gz / gw;
+  bx = bx / bw;
+  by = by / bw;
+  bz = bz / bw;
+
+  /* rgb of the desired point */
+
+  *r = (rx * xc) + (ry * yc) + (rz * zc);
+  *g = (gx * xc) + (gy * yc) + (gz * zc);
+  *b = (bx * xc) + (by * yc) + (bz * zc);
+}
+
+/*                          CONSTRAIN_RGB
+
+    If the requested RGB shade contains a negative weight for
+    one of the primaries, it lies outside the colour gamut
+    accessible from the given triple of primaries.  Desaturate
+    it by adding white, equal quantities of R, G, and B, enough
+    to make RGB all positive.  The function returns 1 if the
+    components were modified, zero otherwise.
+
+*/
+
+int constrain_rgb(double *r, double *g, double *b) {
+  double w;
+
+  /* Amount of white needed is w = - min(0, *r, *g, *b) */
+
+  w = (0 < *r) ? 0 : *r;
+  w = (w < *g) ? w : *g;
+  w = (w < *b) ? w : *b;
+  w = -w;
+
+  /* Add just enough white to make r, g, b all positive. */
+
+  if (w > 0) {
+    *r += w;
+    *g += w;
+    *b += w;
+    return 1; /* Colour modified to fit RGB gamut */
+  }
+
+  return 0; /* Colour within RGB gamut */
+}
+
+/*                          NORM_RGB
+
+    Normalise RGB components so the most intense (unless all
+    are zero) has a value of 1.
+
+*/
+
+void norm_rgb(double *r, double *g, double *b) {
+#define Max(a, b) (((a) > (b)) ? (a) : (b))
+  double greatest = Max(*r, Max(*g, *b));
+
+  if (greatest > 0) {
+    *r /= greatest;
+    *g /= greatest;
+    *b /= greatest;
+  }
+#undef Max
+}
+
+/* CIE colour matching functions xBar, yBar, and zBar for
+   wavelengths from 380 through 780 nanometers, every 5
+   nanometers.  For a wavelength lambda in this range:
+
+        cie_colour_match[(lambda - 380) / 5][0] = xBar
+        cie_colour_match[(lambda - 380) / 5][1] = yBar
+        cie_colour_match[(lambda - 380) / 5][2] = zBar
+
+    To save memory, this table can be declared as floats
+    rather than doubles; (IEEE) float has enough
+    significant bits to represent the values. It's declared
+    as a double here to avoid warnings about "conversion
+    between floating-point types" from certain persnickety
+    compilers. */
+
+static double cie_colour_match[81][3] = {
+    {0.0014, 0.0000, 0.0065}, {0.0022, 0.0001, 0.0105},
+    {0.0042, 0.0001, 0.0201}, {0.0076, 0.0002, 0.0362},
+    {0.0143, 0.0004, 0.0679}, {0.0232, 0.0006, 0.1102},
+    {0.0435, 0.0012, 0.2074}, {0.0776, 0.0022, 0.3713},
+    {0.1344, 0.0040, 0.6456}, {0.2148, 0.0073, 1.0391},
+    {0.2839, 0.0116, 1.3856}, {0.3285, 0.0168, 1.6230},
+    {0.3483, 0.0230, 1.7471}, {0.3481, 0.0298, 1.7826},
+    {0.3362, 0.0380, 1.7721}, {0.3187, 0.0480, 1.7441},
+    {0.2908, 0.0600, 1.6692}, {0.2511, 0.0739, 1.5281},
+    {0.1954, 0.0910, 1.2876}, {0.1421, 0.1126, 1.0419},
+    {0.0956, 0.1390, 0.8130}, {0.0580, 0.1693, 0.6162},
+    {0.0320, 0.2080, 0.4652}, {0.0147, 0.2586, 0.3533},
+    {0.0049, 0.3230, 0.2720}, {0.0024, 0.4073, 0.2123},
+    {0.0093, 0.5030, 0.1582}, {0.0291, 0.6082, 0.1117},
+    {0.0633, 0.7100, 0.0782}, {0.1096, 0.7932, 0.0573},
+    {0.1655, 0.8620, 0.0422}, {0.2257, 0.9149, 0.0298},
+    {0.2904, 0.9540, 0.0203}, {0.3597, 0.9803, 0.0134},
+    {0.4334, 0.9950, 0.0087}, {0.5121, 1.0000, 0.0057},
+    {0.5945, 0.9950, 0.0039}, {0.6784, 0.9786, 0.0027},
+    {0.7621, 0.9520, 0.0021}, {0.8425, 0.9154, 0.0018},
+    {0.9163, 0.8700, 0.0017}, {0.9786, 0.8163, 0.0014},
+    {1.0263, 0.7570, 0.0011}, {1.0567, 0.6949, 0.0010},
+    {1.0622, 0.6310, 0.0008}, {1.0456, 0.5668, 0.0006},
+    {1.0026, 0.5030, 0.0003}, {0.9384, 0.4412, 0.0002},
+    {0.8544, 0.3810, 0.0002}, {0.7514, 0.3210, 0.0001},
+    {0.6424, 0.2650, 0.0000}, {0.5419, 0.2170, 0.0000},
+    {0.4479, 0.1750, 0.0000}, {0.3608, 0.1382, 0.0000},
+    {0.2835, 0.1070, 0.0000}, {0.2187, 0.0816, 0.0000},
+    {0.1649, 0.0610, 0.0000}, {0.1212, 0.0446, 0.0000},
+    {0.0874, 0.0320, 0.0000}, {0.0636, 0.0232, 0.0000},
+    {0.0468, 0.0170, 0.0000}, {0.0329, 0.0119, 0.0000},
+    {0.0227, 0.0082, 0.0000}, {0.0158, 0.0057, 0.0000},
+    {0.0114, 0.0041, 0.0000}, {0.0081, 0.0029, 0.0000},
+    {0.0058, 0.0021, 0.0000}, {0.0041, 0.0015, 0.0000},
+    {0.0029, 0.0010, 0.0000}, {0.0020, 0.0007, 0.0000},
+    {0.0014, 0.0005, 0.0000}, {0.0010, 0.0004, 0.0000},
+    {0.0007, 0.0002, 0.0000}, {0.0005, 0.0002, 0.0000},
+    {0.0003, 0.0001, 0.0000}, {0.0002, 0.0001, 0.0000},
+    {0.0002, 0.0001, 0.0000}, {0.0001, 0.0000, 0.0000},
+    {0.0001, 0.0000, 0.0000}, {0.0001, 0.0000, 0.0000},
+    {0.0000, 0.0000, 0.0000}};
+
+/*                          SPECTRUM_TO_XYZ
+
+    Calculate the CIE X, Y, and Z coordinates corresponding to
+    a light source with spectral distribution given by  the
+    function SPEC_INTENS, which is called with a series of
+    wavelengths between 380 and 780 nm (the argument is
+    expressed in meters), which returns emittance at  that
+    wavelength in arbitrary units.  The chromaticity
+    coordinates of the spectrum are returned in the x, y, and z
+    arguments which respect the identity:
+
+            x + y + z = 1.
+*/
+
+void spectrum_to_xyz(double (*spec_intens)(double wavelength), double *x,
+                     double *y, double *z) {
+  int i;
+  double lambda, X = 0, Y = 0, Z = 0, XYZ;
+
+  for (i = 0, lambda = 380; lambda < 780.1; i++, lambda += 5) {
+    double Me;
+
+    Me = (*spec_intens)(lambda);
+    X += Me * cie_colour_match[i][0];
+    Y += Me * cie_colour_match[i][1];
+    Z += Me * cie_colour_match[i][2];
+  }
+  XYZ = (X + Y + Z);
+  *x = X / XYZ;
+  *y = Y / XYZ;
+  *z = Z / XYZ;
+}
+
+/*                            BB_SPECTRUM
+
+    Calculate, by Planck's radiation law, the emittance of a black body
+    of temperature bbTemp at the given wavelength (in metres).  */
+
+__thread double bbTemp = 5000; /* Hidden temperature argument
+                                  to BB_SPECTRUM. */
+double bb_spectrum(double wavelength) {
+  double wlm = wavelength * 1e-9; /* Wavelength in meters */
+
+  return (3.74183e-16 * pow(wlm, -5.0)) /
+         (exp(1.4388e-2 / (wlm * bbTemp)) - 1.0);
+}
+double white(double wavelength) { return 1; }
+
+/*                            SCHEDULER                             */
+
+#define MAX_WORKERS 256
+#define DEQUE_SIZE 1024       /* Splitting nests log2(n / grain) deep */
+#define CACHE_LINE 64
+#define CHUNK_BYTES (32 * 1024) /* L1 data cache */
+#define CHUNK_NS 50000.0        /* Longest a chunk should run */
+#define INLINE_NS 20000.0       /* Jobs cheaper than this run inline */
+
+typedef void (*batch_fn)(void *arg, long begin, long end);
+
+struct job {
+  batch_fn fn;
+  void *arg;
+  long n;
+  long grain;   /* Items per chunk */
+  long pending; /* Items not yet done */
+  int finished;
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  struct job *next; /* On the injection queue */
+};
+
+struct task {
+  struct job *job;
+  long begin, end;
+};
+
+/* Chase-Lev deque, fixed size.  A slot is only rewritten after top
+   has moved past it, and a thief that read a slot the owner was
+   rewriting loses the race for top, so slot fields are read with
+   relaxed atomics and thrown away when the CAS fails. */
+
+struct deque {
+  long top __attribute__((aligned(CACHE_LINE)));
+  long bottom __attribute__((aligned(CACHE_LINE)));
+  struct task slot[DEQUE_SIZE];
+};
+
+struct worker_stats {
+  long chunks;
+  long items;
+  long steals;
+  long steal_attempts;
+  long busy_ns;
+};
+
+struct worker {
+  struct deque dq;
+  struct scheduler *s;
+  int id;
+  unsigned rng;
+  pthread_t thread;
+  struct worker_stats st;
+};
+
+struct scheduler {
+  int nworkers;
+  struct worker *w;
+  pthread_mutex_t lock; /* Guards the injection queue and sleeping */
+  pthread_cond_t wake;
+  struct job *inject_head, *inject_tail;
+  int sleeping;
+  int stop;
+  double start_ns;
+  long inline_jobs; /* Run on the caller, updated atomically */
+  long queued_jobs;
+};
+
+static double now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void dq_push(struct deque *d, const struct task *t) {
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  struct task *s = &d->slot[b & (DEQUE_SIZE - 1)];
+
+  __atomic_store_n(&s->job, t->job, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->begin, t->begin, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->end, t->end, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+static void dq_read(struct deque *d, long i, struct task *t) {
+  struct task *s = &d->slot[i & (DEQUE_SIZE - 1)];
+
+  t->job = __atomic_load_n(&s->job, __ATOMIC_RELAXED);
+  t->begin = __atomic_load_n(&s->begin, __ATOMIC_RELAXED);
+  t->end = __atomic_load_n(&s->end, __ATOMIC_RELAXED);
+}
+
+/* Owner end.  Returns 0 if the deque is empty. */
+
+static int dq_pop(struct deque *d, struct task *t) {
+  long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1, top;
+  int ok = 1;
+
+  __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  top = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+  if (top > b) {
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+  dq_read(d, b, t);
+  if (top == b) {
+    /* The last one; a thief may be after it too. */
+    ok = __atomic_compare_exchange_n(&d->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return ok;
+}
+
+/* Thief end.  Returns 0 if empty or if another thread won. */
+
+static int dq_steal(struct deque *d, struct task *t) {
+  long top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE), b;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+  if (top >= b) {
+    return 0;
+  }
+  dq_read(d, top, t);
+  return __atomic_compare_exchange_n(&d->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static void wake_one(struct scheduler *s) {
+  if (__atomic_load_n(&s->sleeping, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&s->lock);
+    pthread_cond_signal(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+static void job_finish_items(struct job *j, long n) {
+  if (__atomic_sub_fetch(&j->pending, n, __ATOMIC_ACQ_REL) == 0) {
+    pthread_mutex_lock(&j->lock);
+    j->finished = 1;
+    pthread_cond_signal(&j->done);
+    pthread_mutex_unlock(&j->lock);
+  }
+}
+
+/* Split T down to one chunk, leaving the other halves for this
+   worker or for thieves, then run the chunk. */
+
+static void run_task(struct worker *w, struct task t) {
+  struct job *j = t.job;
+  double t0;
+
+  while (t.end - t.begin > j->grain) {
+    long chunks = (t.end - t.begin + j->grain - 1) / j->grain;
+    long mid = t.begin + chunks / 2 * j->grain;
+    struct task rest = {j, mid, t.end};
+
+    dq_push(&w->dq, &rest);
+    wake_one(w->s);
+    t.end = mid;
+  }
+
+  t0 = now_ns();
+  j->fn(j->arg, t.begin, t.end);
+
+  /* Only this worker writes its stats; the atomics are for
+     sched_report() reading them meanwhile. */
+  __atomic_store_n(&w->st.busy_ns, w->st.busy_ns + (long)(now_ns() - t0),
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&w->st.chunks, w->st.chunks + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&w->st.items, w->st.items + t.end - t.begin,
+                   __ATOMIC_RELAXED);
+  job_finish_items(j, t.end - t.begin);
+}
+
+static int take_injected(struct scheduler *s, struct task *t) {
+  struct job *j;
+
+  if (!__atomic_load_n(&s->inject_head, __ATOMIC_ACQUIRE)) {
+    return 0;
+  }
+  pthread_mutex_lock(&s->lock);
+  j = s->inject_head;
+  if (j) {
+    __atomic_store_n(&s->inject_head, j->next, __ATOMIC_RELAXED);
+    if (!s->inject_head) {
+      s->inject_tail = NULL;
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+  if (!j) {
+    return 0;
+  }
+  t->job = j;
+  t->begin = 0;
+  t->end = j->n;
+  return 1;
+}
+
+static int steal_any(struct worker *w, struct task *t) {
+  struct scheduler *s = w->s;
+
+  for (int k = 0; k < 2 * s->nworkers; k++) {
+    struct worker *v;
+
+    w->rng = w->rng * 1103515245 + 12345;
+    v = &s->w[(w->rng >> 16) % s->nworkers];
+    if (v == w) {
+      continue;
+    }
+    __atomic_store_n(&w->st.steal_attempts, w->st.steal_attempts + 1,
+                     __ATOMIC_RELAXED);
+    if (dq_steal(&v->dq, t)) {
+      __atomic_store_n(&w->st.steals, w->st.steals + 1, __ATOMIC_RELAXED);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int any_work(struct scheduler *s) {
+  if (s->inject_head) {
+    return 1;
+  }
+  for (int i = 0; i < s->nworkers; i++) {
+    struct deque *d = &s->w[i].dq;
+
+    if (__atomic_load_n(&d->top, __ATOMIC_SEQ_CST) <
+        __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void *worker_main(void *arg) {
+  struct worker *w = (struct worker *)arg;
+  struct scheduler *s = w->s;
+  struct task t;
+
+  while (1) {
+    if (dq_pop(&w->dq, &t) || take_injected(s, &t) || steal_any(w, &t)) {
+      run_task(w, t);
+      continue;
+    }
+
+    /* Nothing anywhere: sleep.  Announcing ourselves before looking
+       once more means a push either sees us sleeping and wakes us,
+       or we see its work. */
+    pthread_mutex_lock(&s->lock);
+    if (s->stop) {
+      pthread_mutex_unlock(&s->lock);
+      break;
+    }
+    __atomic_add_fetch(&s->sleeping, 1, __ATOMIC_SEQ_CST);
+    if (!any_work(s)) {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += 1000000; /* A backstop; wake-ups are signalled */
+      if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait(&s->wake, &s->lock, &ts);
+    }
+    __atomic_sub_fetch(&s->sleeping, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&s->lock);
+  }
+  return NULL;
+}
+
+void sched_start(struct scheduler *s, int nworkers) {
+  memset(s, 0, sizeof *s);
+  s->nworkers = nworkers;
+  s->w = (struct worker *)aligned_alloc(CACHE_LINE,
+                                        nworkers * sizeof(struct worker));
+  memset(s->w, 0, nworkers * sizeof(struct worker));
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->wake, NULL);
+  s->start_ns = now_ns();
+  for (int i = 0; i < nworkers; i++) {
+    s->w[i].s = s;
+    s->w[i].id = i;
+    s->w[i].rng = 2 * i + 1;
+    pthread_create(&s->w[i].thread, NULL, worker_main, &s->w[i]);
+  }
+}
+
+void sched_stop(struct scheduler *s) {
+  pthread_mutex_lock(&s->lock);
+  s->stop = 1;
+  pthread_cond_broadcast(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+  for (int i = 0; i < s->nworkers; i++) {
+    pthread_join(s->w[i].thread, NULL);
+  }
+  free(s->w);
+}
+
+/*                              JOB_RUN
+
+    Run FN over 0..N and return when it is done.  BYTES_PER_ITEM
+    (input plus output) and ITEM_NS (a cost estimate) decide the
+    chunk size and whether the job is worth handing to the pool.
+
+*/
+
+void job_run(struct scheduler *s, batch_fn fn, void *arg, long n,
+             long bytes_per_item, double item_ns) {
+  struct job j;
+  long by_cache = CHUNK_BYTES / (bytes_per_item > 0 ? bytes_per_item : 1);
+  long by_time = (long)(CHUNK_NS / (item_ns > 0 ? item_ns : 1));
+
+  if (n * item_ns <= INLINE_NS || s->nworkers == 0) {
+    fn(arg, 0, n);
+    __atomic_add_fetch(&s->inline_jobs, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  j.fn = fn;
+  j.arg = arg;
+  j.n = n;
+  j.grain = by_cache < by_time ? by_cache : by_time;
+  j.grain = j.grain > 0 ? j.grain : 1;
+  j.pending = n;
+  j.finished = 0;
+  j.next = NULL;
+  pthread_mutex_init(&j.lock, NULL);
+  pthread_cond_init(&j.done, NULL);
+
+  pthread_mutex_lock(&s->lock);
+  if (s->inject_tail) {
+    s->inject_tail->next = &j;
+  } else {
+    __atomic_store_n(&s->inject_head, &j, __ATOMIC_RELEASE);
+  }
+  s->inject_tail = &j;
+  s->queued_jobs++;
+  pthread_cond_signal(&s->wake);
+  pthread_mutex_unlock(&s->lock);
+
+  pthread_mutex_lock(&j.lock);
+  while (!j.finished) {
+    pthread_cond_wait(&j.done, &j.lock);
+  }
+  pthread_mutex_unlock(&j.lock);
+  pthread_mutex_destroy(&j.lock);
+  pthread_cond_destroy(&j.done);
+}
+
+void sched_report(struct scheduler *s, FILE *f) {
+  double wall = now_ns() - s->start_ns;
+
+  fprintf(f, "worker  chunks     items      steals/tries  busy\n");
+  for (int i = 0; i < s->nworkers; i++) {
+    struct worker_stats *st = &s->w[i].st;
+
+    fprintf(f, "%6d  %7ld  %10ld  %7ld/%-7ld  %5.1f%%\n", i,
+            __atomic_load_n(&st->chunks, __ATOMIC_RELAXED),
+            __atomic_load_n(&st->items, __ATOMIC_RELAXED),
+            __atomic_load_n(&st->steals, __ATOMIC_RELAXED),
+            __atomic_load_n(&st->steal_attempts, __ATOMIC_RELAXED),
+            100 * __atomic_load_n(&st->busy_ns, __ATOMIC_RELAXED) / wall);
+  }
+  pthread_mutex_lock(&s->lock);
+  fprintf(f, "jobs: %ld inline on the caller, %ld through the pool\n",
+          __atomic_load_n(&s->inline_jobs, __ATOMIC_RELAXED),
+          s->queued_jobs);
+  pthread_mutex_unlock(&s->lock);
+}
+
+/*                            WORKLOADS                             */
+
+struct cct_batch {
+  const double *temp;
+  double *rgb;
+};
+
+static void cct_to_rgb(void *arg, long begin, long end) {
+  struct cct_batch *b = (struct cct_batch *)arg;
+  struct colourSystem *cs = &SMPTEsystem;
+
+  for (long i = begin; i < end; i++) {
+    double x, y, z, *c = &b->rgb[3 * i];
+
+    bbTemp = b->temp[i];
+    spectrum_to_xyz(bb_spectrum, &x, &y, &z);
+    xyz_to_rgb(cs, x, y, z, &c[0], &c[1], &c[2]);
+    constrain_rgb(&c[0], &c[1], &c[2]);
+    norm_rgb(&c[0], &c[1], &c[2]);
+  }
+}
+
+struct wavelength_batch {
+  const float *lambda;
+  float *rgb;
+};
+
+static void wavelength_to_rgb(void *arg, long begin, long end) {
+  struct wavelength_batch *b = (struct wavelength_batch *)arg;
+  struct colourSystem *cs = &SMPTEsystem;
+
+  for (long i = begin; i < end; i++) {
+    double p = (b->lambda[i] - 380) / 5, x, y, z, sum, r, g, bl;
+    int k = p < 0 ? 0 : p >= 80 ? 79 : (int)p;
+    double f = p - k, xyz[3];
+
+    for (int c = 0; c < 3; c++) {
+      xyz[c] = cie_colour_match[k][c] +
+               (cie_colour_match[k + 1][c] - cie_colour_match[k][c]) * f;
+    }
+    sum = xyz[0] + xyz[1] + xyz[2];
+    x = xyz[0] / sum;
+    y = xyz[1] / sum;
+    z = xyz[2] / sum;
+    xyz_to_rgb(cs, x, y, z, &r, &g, &bl);
+    constrain_rgb(&r, &g, &bl);
+    norm_rgb(&r, &g, &bl);
+    b->rgb[3 * i] = r;
+    b->rgb[3 * i + 1] = g;
+    b->rgb[3 * i + 2] = bl;
+  }
+}
+
+/*                          BUILT-IN TEST                           */
+
+/* The request mix: kind, items, percentage of requests. */
+
+enum { KIND_CCT, KIND_WAVELENGTH };
+
+#define KINDS 4
+
+static const struct {
+  const char *label;
+  int kind;
+  long n;
+  int percent;
+} mix[KINDS] = {{"1 CCT", KIND_CCT, 1, 60},
+                {"2000 wavelengths", KIND_WAVELENGTH, 2000, 30},
+                {"10000 CCTs", KIND_CCT, 10000, 5},
+                {"1000000 wavelengths", KIND_WAVELENGTH, 1000000, 5}};
+
+struct client {
+  struct scheduler *s;
+  double seconds;
+  unsigned rng;
+  long jobs[KINDS];
+  double latency_sum[KINDS], latency_max[KINDS];
+};
+
+static double cct_ns, wavelength_ns; /* Measured cost per item */
+
+static void *client_main(void *arg) {
+  struct client *c = (struct client *)arg;
+  long cap = 1000000;
+  double *temp = (double *)malloc(cap * sizeof(double));
+  double *rgb = (double *)malloc(3 * cap * sizeof(double));
+  float *lambda = (float *)malloc(cap * sizeof(float));
+  float *frgb = (float *)malloc(3 * cap * sizeof(float));
+  double end = now_ns() + c->seconds * 1e9;
+
+  for (long i = 0; i < cap; i++) {
+    temp[i] = 1000 + (i * 37) % 9000;
+    lambda[i] = 380 + (i * 7) % 400;
+  }
+
+  while (now_ns() < end) {
+    int r, k = 0;
+    double t0;
+
+    c->rng = c->rng * 1103515245 + 12345;
+    r = (c->rng >> 16) % 100;
+    while (r >= mix[k].percent) {
+      r -= mix[k++].percent;
+    }
+
+    t0 = now_ns();
+    if (mix[k].kind == KIND_CCT) {
+      struct cct_batch b = {temp, rgb};
+
+      job_run(c->s, cct_to_rgb, &b, mix[k].n, 4 * sizeof(double), cct_ns);
+    } else {
+      struct wavelength_batch b = {lambda, frgb};
+
+      job_run(c->s, wavelength_to_rgb, &b, mix[k].n, 4 * sizeof(float),
+              wavelength_ns);
+    }
+    t0 = now_ns() - t0;
+    c->jobs[k]++;
+    c->latency_sum[k] += t0;
+    c->latency_max[k] = t0 > c->latency_max[k] ? t0 : c->latency_max[k];
+  }
+
+  free(temp);
+  free(rgb);
+  free(lambda);
+  free(frgb);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  int nworkers = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+  int nclients = argc > 2 ? atoi(argv[2]) : 4;
+  double seconds = argc > 3 ? atof(argv[3]) : 3;
+  static struct scheduler s;
+  struct client *clients;
+  pthread_t *threads;
+  double t0;
+
+  nworkers = nworkers < 1 ? 1 : nworkers > MAX_WORKERS ? MAX_WORKERS : nworkers;
+  nclients = nclients < 1 ? 1 : nclients > MAX_WORKERS ? MAX_WORKERS : nclients;
+
+  /* Cost per item, serially. */
+  {
+    static double temp[1000], rgb[3000];
+    static float lambda[100000], frgb[300000];
+    struct cct_batch cb = {temp, rgb};
+    struct wavelength_batch wb = {lambda, frgb};
+
+    for (int i = 0; i < 1000; i++) {
+      temp[i] = 1000 + 9 * i;
+    }
+    for (int i = 0; i < 100000; i++) {
+      lambda[i] = 380 + i * 0.004f;
+    }
+    t0 = now_ns();
+    cct_to_rgb(&cb, 0, 1000);
+    cct_ns = (now_ns() - t0) / 1000;
+    t0 = now_ns();
+    wavelength_to_rgb(&wb, 0, 100000);
+    wavelength_ns = (now_ns() - t0) / 100000;
+  }
+  printf("Serial cost: %.0f ns per CCT, %.1f ns per wavelength\n", cct_ns,
+         wavelength_ns);
+  printf("%d workers, %d clients, %.0f s\n\n", nworkers, nclients, seconds);
+
+  sched_start(&s, nworkers);
+
+  /* The pool must produce exactly what the serial loop does. */
+  {
+    static float lambda[1000000], serial[3000000], pooled[3000000];
+    struct wavelength_batch a = {lambda, serial}, b = {lambda, pooled};
+
+    for (int i = 0; i < 1000000; i++) {
+      lambda[i] = 380 + i * 0.0004f;
+    }
+    wavelength_to_rgb(&a, 0, 1000000);
+    job_run(&s, wavelength_to_rgb, &b, 1000000, 4 * sizeof(float),
+            wavelength_ns);
+    if (memcmp(serial, pooled, sizeof serial) != 0) {
+      printf("Pooled result differs from the serial one\n");
+      return 1;
+    }
+  }
+  clients = (struct client *)calloc(nclients, sizeof(struct client));
+  threads = (pthread_t *)malloc(nclients * sizeof(pthread_t));
+  for (int i = 0; i < nclients; i++) {
+    clients[i].s = &s;
+    clients[i].seconds = seconds;
+    clients[i].rng = 7 * i + 3;
+    pthread_create(&threads[i], NULL, client_main, &clients[i]);
+  }
+  for (int i = 0; i < nclients; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  printf("job                   count     mean latency   max latency\n");
+  for (int k = 0; k < KINDS; k++) {
+    long n = 0;
+    double sum = 0, max = 0;
+
+    for (int i = 0; i < nclients; i++) {
+      n += clients[i].jobs[k];
+      sum += clients[i].latency_sum[k];
+      max = clients[i].latency_max[k] > max ? clients[i].latency_max[k] : max;
+    }
+    printf("%-19s  %6ld  %12.1f us  %10.1f us\n", mix[k].label, n,
+           n ? sum / n / 1e3 : 0, max / 1e3);
+  }
+  printf("\n");
+  sched_report(&s, stdout);
+
+  sched_stop(&s);
+  free(clients);
+  free(threads);
+  return 0;
+}